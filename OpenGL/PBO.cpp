@@ -0,0 +1,37 @@
+#include <OpenGL/PBO.h>
+
+PBO::PBO(GLsizeiptr size_) : size(size_)
+{
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Leaves the buffer bound until Unmap()
+const void* PBO::Map()
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+    return glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+}
+
+void PBO::Unmap()
+{
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void PBO::Bind()
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ID);
+}
+
+void PBO::Unbind()
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void PBO::Delete()
+{
+    glDeleteBuffers(1, &ID);
+}
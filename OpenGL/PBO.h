@@ -0,0 +1,20 @@
+#pragma once
+
+#include<glad/glad.h>
+
+// Pixel pack buffer, glReadPixels / glGetTexImage write into it without waiting for the GPU
+class PBO
+{
+public:
+    GLuint ID;
+    GLsizeiptr size;
+
+    PBO(GLsizeiptr size_);
+
+    const void* Map();
+    void Unmap();
+
+    void Bind();
+    void Unbind();
+    void Delete();
+};
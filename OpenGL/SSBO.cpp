@@ -1,7 +1,9 @@
 #include <OpenGL/SSBO.h>
+#include <profiling/traceRecorder.h>
 
 SSBO::SSBO(void* data, GLsizeiptr size, GLuint bindIndex) : bindingIndex(bindIndex)
 {
+	TraceScope scope("upload SSBO", "load", size);
 	glGenBuffers(1, &ID);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingIndex, ID);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
@@ -9,6 +11,13 @@ SSBO::SSBO(void* data, GLsizeiptr size, GLuint bindIndex) : bindingIndex(bindInd
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
+void SSBO::Read(void* data, GLsizeiptr size)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
 void SSBO::Bind()
 {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ID);
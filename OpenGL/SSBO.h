@@ -10,6 +10,9 @@ public:
 
     SSBO(void* data, GLsizeiptr size, GLuint bindIndex);
 
+    // Copies size bytes of the buffer back, waits for the GPU
+    void Read(void* data, GLsizeiptr size);
+
     void Bind();
     void Unbind();
     void Delete();
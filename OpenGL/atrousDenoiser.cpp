@@ -0,0 +1,54 @@
+#include <OpenGL/atrousDenoiser.h>
+
+AtrousDenoiser::AtrousDenoiser(int width_, int height_, const std::string& shaderPath, GLenum textureUnit, int iterations_)
+    : width(width_), height(height_), iterations(iterations_),
+      albedo(width_, height_, textureUnit), normalDepth(width_, height_, textureUnit), shader(shaderPath),
+      pingPong{ Texture2D(width_, height_, textureUnit), Texture2D(width_, height_, textureUnit) }
+{
+}
+
+// Image bindings 1 and 2 of compute.glsl
+void AtrousDenoiser::BindFeatures()
+{
+    albedo.BindImage(1, GL_WRITE_ONLY);
+    normalDepth.BindImage(2, GL_WRITE_ONLY);
+}
+
+// Returns the texture holding the result, valid until the next call. Rebinds image unit 0, so input (or whatever
+// compute.glsl draws on) has to be bound to it again before the next frame
+Texture2D& AtrousDenoiser::Denoise(Texture2D& input)
+{
+    shader.Activate();
+    shader.setFloat("depthSigma", depthSigma);
+    albedo.BindImage(1, GL_READ_ONLY);
+    normalDepth.BindImage(2, GL_READ_ONLY);
+
+    Texture2D* source = &input;
+    for (int i = 0; i < iterations; i++)
+    {
+        Texture2D& target = pingPong[i % 2];
+        source->BindImage(0, GL_READ_ONLY);
+        target.BindImage(3, GL_WRITE_ONLY);
+
+        shader.setInt("stepWidth", 1 << i);
+        // The noise drops with every iteration, so the color has to match more closely
+        shader.setFloat("colorSigma", colorSigma / float(1 << i));
+        shader.setBool("demodulate", i == 0);
+        shader.setBool("remodulate", i == iterations - 1);
+
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        source = &target;
+    }
+
+    return *source;
+}
+
+void AtrousDenoiser::Delete()
+{
+    albedo.Delete();
+    normalDepth.Delete();
+    pingPong[0].Delete();
+    pingPong[1].Delete();
+    shader.Delete();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <OpenGL/shaderClass.h>
+#include <OpenGL/textureClass.h>
+
+// Runs the à-trous filter of denoise.glsl over a screen sized RGBA32F texture. The ray tracing compute shader fills
+// Albedo and NormalDepth when writeFeatures is set (bind them with BindFeatures() before dispatching it), the noisy
+// input is left untouched so it can keep accumulating.
+//
+//     denoiser.BindFeatures(); dispatch compute.glsl with writeFeatures = true
+//     Texture2D& denoised = denoiser.Denoise(screenTexture);
+class AtrousDenoiser
+{
+public:
+    int width;
+    int height;
+    int iterations;
+    float colorSigma = 16.0f;
+    float depthSigma = 0.05f;
+
+    Texture2D albedo;
+    Texture2D normalDepth;
+
+    // Results are put on textureUnit, e.g. the one the screen quad samples
+    AtrousDenoiser(int width_, int height_, const std::string& shaderPath, GLenum textureUnit, int iterations_ = 5);
+
+    void BindFeatures();
+    Texture2D& Denoise(Texture2D& input);
+    void Delete();
+
+private:
+    ComputeShader shader;
+    Texture2D pingPong[2];
+};
@@ -0,0 +1,79 @@
+#include <OpenGL/frameCapture.h>
+
+FrameCapture::FrameCapture(int width_, int height_, GLenum pixelFormat_, GLenum pixelType_, int bytesPerPixel, Callback onFrame_, int ringSize)
+    : width(width_), height(height_), pixelFormat(pixelFormat_), pixelType(pixelType_), onFrame(onFrame_)
+{
+    for (int i = 0; i < ringSize; i++)
+        slots.push_back({ PBO(GLsizeiptr(width) * height * bytesPerPixel), nullptr, -1 });
+}
+
+// Queues the copy of the texture, writes done by compute shaders have to be made visible with
+// glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT) first
+void FrameCapture::Capture(Texture2D& texture, int frame)
+{
+    if (numPending == int(slots.size()))
+        Finish(true);
+
+    Slot& slot = slots[(oldest + numPending) % slots.size()];
+    slot.frame = frame;
+
+    slot.buffer.Bind();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    texture.Bind();
+    glGetTexImage(GL_TEXTURE_2D, 0, pixelFormat, pixelType, nullptr);
+    texture.Unbind();
+    slot.buffer.Unbind();
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    numPending++;
+}
+
+// Hands over every frame the GPU has already finished, never waits
+void FrameCapture::Poll()
+{
+    while (numPending > 0 && Finish(false));
+}
+
+// Waits for and hands over every frame still in flight
+void FrameCapture::Flush()
+{
+    while (numPending > 0)
+        Finish(true);
+}
+
+void FrameCapture::Delete()
+{
+    for (Slot& slot : slots)
+    {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        slot.buffer.Delete();
+    }
+    slots.clear();
+    numPending = 0;
+}
+
+// Passes the oldest pending frame to the callback once its fence signaled, returns false if it isn't done yet
+bool FrameCapture::Finish(bool wait)
+{
+    Slot& slot = slots[oldest];
+
+    GLuint64 timeout = wait ? 1000000000ull : 0; // Nanoseconds
+    GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    const void* pixels = slot.buffer.Map();
+    if (pixels)
+        onFrame(slot.frame, pixels);
+    slot.buffer.Unmap();
+
+    oldest = (oldest + 1) % slots.size();
+    numPending--;
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include <glad/glad.h>
+#include <OpenGL/PBO.h>
+#include <OpenGL/textureClass.h>
+
+// Reads textures back to the CPU without stalling: every Capture() only queues a copy into the next PBO of a ring
+// and a fence, the pixels are handed to the callback later, once the GPU is done, so the readback of frame N
+// overlaps with rendering frame N + 1. Only a full ring waits, for its oldest frame.
+//
+//     FrameCapture capture(width, height, GL_RGBA, GL_FLOAT, 4 * sizeof(float), [](int frame, const void* pixels) { ... });
+//     for each frame: render, capture.Capture(texture, frame), capture.Poll();
+//     capture.Flush();
+class FrameCapture
+{
+public:
+    // Pixels are width * height texels of the format and type given to the constructor, bottom row first
+    typedef std::function<void(int frame, const void* pixels)> Callback;
+
+    int width;
+    int height;
+
+    FrameCapture(int width_, int height_, GLenum pixelFormat_, GLenum pixelType_, int bytesPerPixel, Callback onFrame_, int ringSize = 3);
+
+    void Capture(Texture2D& texture, int frame);
+    void Poll();
+    void Flush();
+    void Delete();
+
+private:
+    struct Slot
+    {
+        PBO buffer;
+        GLsync fence;
+        int frame;
+    };
+
+    GLenum pixelFormat;
+    GLenum pixelType;
+    Callback onFrame;
+    std::vector<Slot> slots;
+    int oldest = 0;
+    int numPending = 0;
+
+    bool Finish(bool wait);
+};
@@ -0,0 +1,281 @@
+#include <OpenGL/frameProfiler.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+FrameProfiler::Scope::Scope(FrameProfiler& profiler_, const char* name, bool gpu) : profiler(profiler_)
+{
+    profiler.BeginStage(name, gpu);
+}
+
+FrameProfiler::Scope::~Scope()
+{
+    profiler.EndStage();
+}
+
+FrameProfiler::FrameProfiler(int historySize, int numBuffers)
+    : origin(Clock::now()), frames(std::max(historySize, numBuffers + 1)), freeQueries(std::max(1, numBuffers)), pendingQueries(std::max(1, numBuffers))
+{
+}
+
+void FrameProfiler::BeginFrame()
+{
+    if (!enabled)
+        return;
+    frameNumber++;
+    inFrame = true;
+
+    // The queries of this buffer were issued numBuffers frames ago
+    ResolveQueries(int(frameNumber % pendingQueries.size()));
+
+    Frame& frame = frames[frameNumber % frames.size()];
+    frame.number = frameNumber;
+    frame.start = Now();
+    frame.cpuSeconds = 0.0f;
+    frame.stages.clear();
+}
+
+void FrameProfiler::EndFrame()
+{
+    if (!inFrame)
+        return;
+    if (openStage >= 0)
+        EndStage();
+
+    Frame& frame = frames[frameNumber % frames.size()];
+    frame.cpuSeconds = float(Now() - frame.start);
+    inFrame = false;
+}
+
+void FrameProfiler::BeginStage(const char* name, bool gpu)
+{
+    if (!enabled)
+        return;
+    if (openStage >= 0)
+        EndStage();
+
+    Stage stage = { NameIndex(name), Now(), 0.0f, -1.0f };
+    openInFrame = inFrame;
+    openQuery = 0;
+    if (inFrame)
+    {
+        Frame& frame = frames[frameNumber % frames.size()];
+        openStage = int(frame.stages.size());
+        frame.stages.push_back(stage);
+
+        if (gpu)
+        {
+            std::vector<GLuint>& available = freeQueries[frameNumber % freeQueries.size()];
+            if (available.empty())
+            {
+                GLuint query;
+                glGenQueries(1, &query);
+                available.push_back(query);
+            }
+            openQuery = available.back();
+            available.pop_back();
+            glBeginQuery(GL_TIME_ELAPSED, openQuery);
+        }
+    }
+    else
+    {
+        openStage = int(startup.size());
+        startup.push_back(stage);
+    }
+    openStart = Clock::now();
+}
+
+void FrameProfiler::EndStage()
+{
+    if (openStage < 0)
+        return;
+
+    float seconds = std::chrono::duration<float>(Clock::now() - openStart).count();
+    if (openInFrame)
+    {
+        frames[frameNumber % frames.size()].stages[openStage].cpuSeconds = seconds;
+        if (openQuery)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            pendingQueries[frameNumber % pendingQueries.size()].push_back({ openQuery, frameNumber, openStage });
+        }
+    }
+    else
+        startup[openStage].cpuSeconds = seconds;
+
+    openStage = -1;
+    openQuery = 0;
+}
+
+bool FrameProfiler::PrintSummaryEvery(float intervalSeconds, std::ostream& out)
+{
+    float now = float(Now());
+    if (now - lastSummary < intervalSeconds)
+        return false;
+
+    lastSummary = now;
+    PrintSummary(out);
+    return true;
+}
+
+void FrameProfiler::PrintSummary(std::ostream& out) const
+{
+    std::vector<double> cpu(names.size(), 0.0), gpu(names.size(), 0.0);
+    std::vector<int> numCpu(names.size(), 0), numGpu(names.size(), 0);
+    double frameSeconds = 0.0;
+    int numFrames = 0;
+
+    for (const Frame& frame : frames)
+    {
+        // Only finished frames
+        if (frame.number < 0 || (frame.number == frameNumber && inFrame))
+            continue;
+        frameSeconds += frame.cpuSeconds;
+        numFrames++;
+        for (const Stage& stage : frame.stages)
+        {
+            cpu[stage.name] += stage.cpuSeconds;
+            numCpu[stage.name]++;
+            if (stage.gpuSeconds >= 0.0f)
+            {
+                gpu[stage.name] += stage.gpuSeconds;
+                numGpu[stage.name]++;
+            }
+        }
+    }
+    if (numFrames == 0)
+        return;
+
+    double averageFrame = frameSeconds / numFrames;
+    out << std::fixed << std::setprecision(3) << "Last " << numFrames << " frames: " << averageFrame * 1000.0 << " ms CPU per frame" << std::endl;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (numCpu[i] == 0)
+            continue;
+        out << "  " << std::left << std::setw(16) << names[i] << std::right
+            << " CPU " << std::setw(8) << cpu[i] / numCpu[i] * 1000.0 << " ms";
+        if (numGpu[i] > 0)
+            out << "  GPU " << std::setw(8) << gpu[i] / numGpu[i] * 1000.0 << " ms";
+        out << std::endl;
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+void FrameProfiler::PrintStartup(std::ostream& out) const
+{
+    double total = 0.0;
+    out << std::fixed << std::setprecision(3) << "Startup:" << std::endl;
+    for (const Stage& stage : startup)
+    {
+        out << "  " << std::left << std::setw(16) << names[stage.name] << std::right << " " << std::setw(10) << stage.cpuSeconds * 1000.0 << " ms" << std::endl;
+        total += stage.cpuSeconds;
+    }
+    out << "  " << std::left << std::setw(16) << "total" << std::right << " " << std::setw(10) << total * 1000.0 << " ms" << std::endl;
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+bool FrameProfiler::WriteChromeTrace(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot write trace: " << path << std::endl;
+        return false;
+    }
+
+    // Names are string literals of the caller, only quotes and backslashes need escaping
+    auto escaped = [](const std::string& name)
+    {
+        std::string result;
+        for (char c : name)
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            result += c;
+        }
+        return result;
+    };
+    bool first = true;
+    auto event = [&](const std::string& name, const char* category, int track, double start, double seconds)
+    {
+        file << (first ? "\n" : ",\n") << "{\"name\":\"" << escaped(name) << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track
+            << ",\"ts\":" << start * 1e6 << ",\"dur\":" << seconds * 1e6 << "}";
+        first = false;
+    };
+
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    file << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}";
+    file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    first = false;
+
+    for (const Stage& stage : startup)
+        event(names[stage.name], "startup", 1, stage.start, stage.cpuSeconds);
+
+    // Oldest frame first
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        const Frame& frame = frames[(frameNumber + 1 + i) % frames.size()];
+        if (frame.number < 0 || (frame.number == frameNumber && inFrame))
+            continue;
+
+        event("frame " + std::to_string(frame.number), "frame", 1, frame.start, frame.cpuSeconds);
+        for (const Stage& stage : frame.stages)
+        {
+            event(names[stage.name], "cpu", 1, stage.start, stage.cpuSeconds);
+            // Elapsed time queries have no timestamp, the GPU stage is shown from when it was issued
+            if (stage.gpuSeconds >= 0.0f)
+                event(names[stage.name], "gpu", 2, stage.start, stage.gpuSeconds);
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    return true;
+}
+
+void FrameProfiler::Delete()
+{
+    if (openStage >= 0)
+        EndStage();
+    for (size_t buffer = 0; buffer < freeQueries.size(); buffer++)
+    {
+        for (GLuint query : freeQueries[buffer])
+            glDeleteQueries(1, &query);
+        for (const PendingQuery& pending : pendingQueries[buffer])
+            glDeleteQueries(1, &pending.query);
+        freeQueries[buffer].clear();
+        pendingQueries[buffer].clear();
+    }
+}
+
+double FrameProfiler::Now() const
+{
+    return std::chrono::duration<double>(Clock::now() - origin).count();
+}
+
+int FrameProfiler::NameIndex(const char* name)
+{
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return int(i);
+    names.push_back(name);
+    return int(names.size()) - 1;
+}
+
+// Reads the queries of a buffer into their frames, they are numBuffers frames old so the GPU is normally done with
+// them and GL_QUERY_RESULT doesn't wait
+void FrameProfiler::ResolveQueries(int buffer)
+{
+    for (const PendingQuery& pending : pendingQueries[buffer])
+    {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &nanoseconds);
+
+        // The frame may already have left the ring
+        Frame& frame = frames[pending.frame % frames.size()];
+        if (frame.number == pending.frame && pending.stage < int(frame.stages.size()))
+            frame.stages[pending.stage].gpuSeconds = float(nanoseconds * 1e-9);
+        freeQueries[buffer].push_back(pending.query);
+    }
+    pendingQueries[buffer].clear();
+}
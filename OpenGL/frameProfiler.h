@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+#include <glad/glad.h>
+
+// Where the time of a frame goes, on the CPU and on the GPU. Every stage of a frame (UBO update, dispatch, blit, swap)
+// gets its CPU time from a steady clock and its GPU time from a GL_TIME_ELAPSED query. The queries of a frame are only
+// read back numBuffers frames later, when the GPU has long finished them, so timing never stalls the pipeline. The
+// last historySize frames are kept for the summary and the trace, startup steps (load, BVH, uploads) are kept apart.
+//
+//     profiler.BeginFrame();
+//     { FrameProfiler::Scope scope(profiler, "dispatch"); glDispatchCompute(...); }
+//     profiler.BeginStage("blit"); draw; profiler.BeginStage("swap"); glfwSwapBuffers(window);
+//     profiler.EndFrame();
+//     profiler.PrintSummaryEvery(5.0f, std::cout);
+//     profiler.WriteChromeTrace("trace.json");
+//
+// A stage ends where the next one begins. GL_TIME_ELAPSED queries can't nest, so neither can stages.
+class FrameProfiler
+{
+public:
+    // Timed code, ends when it goes out of scope. gpu = false only measures the CPU, e.g. for loading files
+    class Scope
+    {
+    public:
+        Scope(FrameProfiler& profiler_, const char* name, bool gpu = true);
+        ~Scope();
+
+    private:
+        FrameProfiler& profiler;
+    };
+
+    bool enabled = true; // When false nothing is measured
+
+    FrameProfiler(int historySize = 240, int numBuffers = 2);
+
+    void BeginFrame();
+    void EndFrame();
+
+    // Outside of a frame a stage is a startup step, its GPU time is not measured. Ends the stage that is still open
+    void BeginStage(const char* name, bool gpu = true);
+    void EndStage();
+
+    // Prints the average of every stage over the recorded frames once every interval seconds, returns whether it did
+    bool PrintSummaryEvery(float intervalSeconds, std::ostream& out);
+    void PrintSummary(std::ostream& out) const;
+    void PrintStartup(std::ostream& out) const;
+
+    // For chrome://tracing or Perfetto: startup steps and CPU stages on one track, GPU stages on another
+    bool WriteChromeTrace(const std::string& path) const;
+
+    void Delete();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage
+    {
+        int name;            // Index into names
+        double start;        // Seconds since the profiler was made
+        float cpuSeconds;
+        float gpuSeconds;    // -1 until the query was read, or without one
+    };
+
+    struct Frame
+    {
+        long long number = -1;
+        double start = 0.0;
+        float cpuSeconds = 0.0f;
+        std::vector<Stage> stages;
+    };
+
+    struct PendingQuery
+    {
+        GLuint query;
+        long long frame;
+        int stage;
+    };
+
+    Clock::time_point origin;
+    std::vector<std::string> names;
+    std::vector<Frame> frames; // Ring of the last frames, frames[number % size]
+    std::vector<Stage> startup;
+    long long frameNumber = -1;
+    bool inFrame = false;
+
+    // Per buffer the free queries and the ones still to be read, a buffer is reused every numBuffers frames
+    std::vector<std::vector<GLuint>> freeQueries;
+    std::vector<std::vector<PendingQuery>> pendingQueries;
+
+    int openStage = -1;       // Index in the current frame or in startup, -1 when none is open
+    bool openInFrame = false;
+    GLuint openQuery = 0;
+    Clock::time_point openStart;
+    float lastSummary = 0.0f;
+
+    double Now() const;
+    int NameIndex(const char* name);
+    void ResolveQueries(int buffer);
+};
@@ -1,4 +1,5 @@
 #include <OpenGL/shaderClass.h>
+#include <profiling/traceRecorder.h>
 
 // Helper function to check for shader compilation/linking errors.
 void compileErrors(GLuint shader, const char* type)
@@ -27,6 +28,7 @@ void compileErrors(GLuint shader, const char* type)
 
 Shader::Shader(const std::string& vertexFilePath, const std::string& fragmentFilePath)
 {
+    TraceScope scope("compile shader", "load");
     std::string vertexCode = getFileContents(vertexFilePath);
     std::string fragmentCode = getFileContents(fragmentFilePath);
 
@@ -148,6 +150,7 @@ void Shader::setUBO(const char* uniformBlockName, GLuint bindingIndex)
 
 ComputeShader::ComputeShader(const std::string& path)
 {
+    TraceScope scope("compile shader", "load");
     std::string codeStr = getFileContents(path);
     const char* code = codeStr.c_str();;
 
@@ -1,6 +1,7 @@
 #include <OpenGL/textureClass.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
+#include <profiling/traceRecorder.h>
 
 // Constructor to generate the texture and set its parameters
 Texture2D::Texture2D(int width, int height, const void* pixels, int mipmapLevel, GLenum pixelFormat, GLint filterMode, GLint wrapMode, GLenum textureUnit)
@@ -43,6 +44,7 @@ Texture2D::Texture2D(const std::string& path, GLenum textureUnit)
     glBindTexture(GL_TEXTURE_2D, ID);
 
     int width, height, numColCh;
+    TraceScope decodeScope("decode texture", "load");
     // stbi_set_flip_vertically_on_load(true);
     unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &numColCh, 0);
     if (pixels)
@@ -55,8 +57,11 @@ Texture2D::Texture2D(const std::string& path, GLenum textureUnit)
             rgbPixels[4 * i + 1] = pixels[numColCh * i + 1];
             rgbPixels[4 * i + 2] = pixels[numColCh * i + 2];
         }
+        decodeScope.End();
 
+        TraceScope uploadScope("upload texture", "load", static_cast<long long>(width) * height * 4);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA , GL_UNSIGNED_BYTE, rgbPixels);
+        uploadScope.End();
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -82,6 +87,21 @@ glm::vec3 Texture2D::readPixel(const glm::vec2& uv)
     return glm::vec3(pixel[0], pixel[1], pixel[2]);
 }
 
+// Copies the whole texture back, pixels has to be large enough for width * height texels of the given format and type
+void Texture2D::ReadImage(GLenum pixelFormat, GLenum pixelType, void* pixels)
+{
+    glBindTexture(GL_TEXTURE_2D, ID);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, pixelFormat, pixelType, pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Makes an RGBA32F texture (the screen sized ones) an image of compute shaders at the given binding
+void Texture2D::BindImage(GLuint imageUnit, GLenum access)
+{
+    glBindImageTexture(imageUnit, ID, 0, GL_FALSE, 0, access, GL_RGBA32F);
+}
+
 void Texture2D::Bind()
 {
     glBindTexture(GL_TEXTURE_2D, ID);
@@ -17,6 +17,8 @@ public:
     Texture2D(int width, int height, GLenum textureUnit);
 
     glm::vec3 readPixel(const glm::vec2& uv);
+    void ReadImage(GLenum pixelFormat, GLenum pixelType, void* pixels);
+    void BindImage(GLuint imageUnit, GLenum access);
 
     void SetActive();
     void Bind();
@@ -3,6 +3,18 @@
 layout (local_size_x = 4, local_size_y = 4, local_size_z = 1) in;
 
 layout(rgba32f, binding = 0) uniform image2D imgOutput;
+// Guides of the denoiser (denoise.glsl), only written when writeFeatures is set
+layout(rgba32f, binding = 1) uniform writeonly image2D imgAlbedo;
+layout(rgba32f, binding = 2) uniform writeonly image2D imgNormalDepth;
+
+// Counts the nodes visited, box tests and triangle tests of every pixel's traversals (same as TRAVERSAL_STATS of the
+// CPU tracer) and shows them as a heatmap of the box and triangle tests instead of the render, red at
+// TRAVERSAL_HEATMAP_MAX tests per path
+// #define TRAVERSAL_STATS
+#ifdef TRAVERSAL_STATS
+const float TRAVERSAL_HEATMAP_MAX = 1000.0f;
+uvec3 traversalStats = uvec3(0u);
+#endif
 
 const int DIFFUSE = 0;
 const int SPECULAR = 1;
@@ -46,7 +58,7 @@ struct Triangle
 	vec2 bTex;
 	vec2 cTex;
 	int mtlIndex;
-	int pad;
+	int lightIndex; // Entry in lights, -1 for triangles that emit nothing
 };
 
 struct BoundingBox
@@ -81,6 +93,39 @@ layout(binding = 3, std430) buffer MaterialsBlock
 	Material materials[];
 };
 
+// Emissive triangles for next-event estimation, picked with an alias table or a light BVH, see lights.h
+const int LIGHT_SAMPLER_ALIAS = 0;
+const int LIGHT_SAMPLER_BVH = 1;
+
+struct Light
+{
+	int triangleIndex;
+	float probability;
+	float threshold;
+	int alias;
+	uint bitTrail;
+};
+
+struct LightNode
+{
+	vec4 boundsMin; // w: power of the lights below
+	vec4 boundsMax;
+	int childIndex;
+	int lightIndex;
+	int pad0;
+	int pad1;
+};
+
+layout(binding = 4, std430) buffer LightsBlock
+{
+	Light lights[];
+};
+
+layout(binding = 5, std430) buffer LightNodesBlock
+{
+	LightNode lightNodes[];
+};
+
 struct Ray
 {
 	vec3 origin;
@@ -109,6 +154,17 @@ uniform sampler2D texture4;
 
 uniform bool qualityShading;
 
+// Instead of rendering, the pixels checkSamplerAgainstCPU() asks for write the numbers of their first sample
+uniform bool checkSamples;
+const int SAMPLE_CHECK_SPACING = 97; // Pixels of the diagonal 0, 97, 194, ...
+const int SAMPLE_CHECK_PIXELS = 8;
+const int SAMPLE_CHECK_DIMENSIONS = 12;
+
+layout(binding = 6, std430) buffer SampleCheckBlock
+{
+	vec4 sampleChecks[]; // get1D(dimension), get2D(dimension) of every pixel and dimension
+};
+
 layout(binding = 3, std140) uniform GlobalUniformsBlock {
     int pad;
     int numTextures;
@@ -136,6 +192,16 @@ layout(binding = 3, std140) uniform GlobalUniformsBlock {
     vec4 pixelUp;
     vec4 defocusDiskRight;
     vec4 defocusDiskUp;
+
+    bool accumulate;
+    bool writeFeatures;
+    bool nextEventEstimation;
+    int numLights;
+
+    int lightSampler;
+    int samplerType;
+    uint seed;
+    int pad4;
 };
 
 float random(inout uint state)
@@ -151,10 +217,167 @@ float random(float left, float right, inout uint state)
 	return left + (right - left) * random(state);
 }
 
-vec2 randomDirection2D(inout uint rngState)
+// Samplers of sampler.h: every decision of a path reads its own dimension of the sample
+const int SAMPLER_PCG = 0;
+const int SAMPLER_SOBOL = 1;
+const int SAMPLER_BLUE_NOISE = 2;
+
+const int DIMENSION_PIXEL = 0;
+const int DIMENSION_LENS = 1;
+const int NUM_CAMERA_DIMENSIONS = 2;
+
+const int DIMENSION_LIGHT_CHOICE = 0;
+const int DIMENSION_LIGHT_POINT = 1;
+const int DIMENSION_DIRECTION = 2;
+const int DIMENSION_LOBE = 3;
+const int DIMENSION_ROULETTE = 4;
+const int NUM_BOUNCE_DIMENSIONS = 5;
+
+struct PathSampler
+{
+	uint rngState;
+	uint pixelHash;
+	uint seedHash;
+	ivec2 pixel;
+	uint sampleIndex;
+	uint nextSampleIndex;
+	int bounceDimension;
+};
+
+uint hashInt(uint x)
 {
-	float angle = random(rngState);
-	return vec2(cos(angle), sin(angle));
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+uint laineKarrasPermutation(uint x, uint key)
+{
+	x += key;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint nestedUniformScramble(uint x, uint key)
+{
+	return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), key));
+}
+
+float toUnitFloat(uint x)
+{
+	return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+float interleavedGradientNoise(float x, float y)
+{
+	return fract(52.9829189f * fract(0.06711056f * x + 0.00583715f * y));
+}
+
+void startSample(inout PathSampler pathSampler)
+{
+	pathSampler.sampleIndex = pathSampler.nextSampleIndex++;
+	pathSampler.bounceDimension = NUM_CAMERA_DIMENSIONS;
+}
+
+void startBounce(inout PathSampler pathSampler, int bounce)
+{
+	pathSampler.bounceDimension = NUM_CAMERA_DIMENSIONS + bounce * NUM_BOUNCE_DIMENSIONS;
+}
+
+float get1D(inout PathSampler pathSampler, int dimension)
+{
+	if (samplerType == SAMPLER_SOBOL)
+	{
+		uint dimensionSeed = hashInt(pathSampler.pixelHash ^ hashInt(uint(dimension)));
+		uint index = nestedUniformScramble(pathSampler.sampleIndex, dimensionSeed);
+		return toUnitFloat(nestedUniformScramble(bitfieldReverse(index), hashInt(dimensionSeed)));
+	}
+	if (samplerType == SAMPLER_BLUE_NOISE)
+	{
+		uint index = nestedUniformScramble(pathSampler.sampleIndex, hashInt(uint(dimension)));
+		float offset = interleavedGradientNoise(pathSampler.pixel.x + 5.588238f * dimension, pathSampler.pixel.y + 3.7f * dimension);
+		return toUnitFloat((uint(offset * 16777216.0f) << 8) + index * 2654435769u + pathSampler.seedHash);
+	}
+	return random(pathSampler.rngState);
+}
+
+vec2 get2D(inout PathSampler pathSampler, int dimension)
+{
+	if (samplerType == SAMPLER_SOBOL)
+	{
+		uint dimensionSeed = hashInt(pathSampler.pixelHash ^ hashInt(uint(dimension)));
+		uint index = nestedUniformScramble(pathSampler.sampleIndex, dimensionSeed);
+
+		uint y = 0u;
+		uint v = 1u << 31;
+		for (uint i = index; i != 0u; i >>= 1, v ^= v >> 1)
+			if ((i & 1u) != 0u)
+				y ^= v;
+
+		return vec2(toUnitFloat(nestedUniformScramble(bitfieldReverse(index), hashInt(dimensionSeed))),
+		            toUnitFloat(nestedUniformScramble(y, hashInt(dimensionSeed ^ 0x5bd1e995u))));
+	}
+	if (samplerType == SAMPLER_BLUE_NOISE)
+	{
+		uint index = nestedUniformScramble(pathSampler.sampleIndex, hashInt(uint(dimension)));
+		float offsetX = interleavedGradientNoise(pathSampler.pixel.x + 5.588238f * dimension, pathSampler.pixel.y + 3.7f * dimension);
+		float offsetY = interleavedGradientNoise(pathSampler.pixel.x + 17.0f + 5.588238f * dimension, pathSampler.pixel.y + 29.0f + 3.7f * dimension);
+		return vec2(toUnitFloat((uint(offsetX * 16777216.0f) << 8) + index * 3242174889u + pathSampler.seedHash),
+		            toUnitFloat((uint(offsetY * 16777216.0f) << 8) + index * 2447445413u + hashInt(pathSampler.seedHash)));
+	}
+	float x = random(pathSampler.rngState);
+	float y = random(pathSampler.rngState);
+	return vec2(x, y);
+}
+
+float sample1D(inout PathSampler pathSampler, int slot)
+{
+	return get1D(pathSampler, pathSampler.bounceDimension + slot);
+}
+
+vec2 sample2D(inout PathSampler pathSampler, int slot)
+{
+	return get2D(pathSampler, pathSampler.bounceDimension + slot);
+}
+
+vec2 concentricDisk(vec2 u)
+{
+	vec2 offset = u * 2.0f - 1.0f;
+	if (offset.x == 0.0f && offset.y == 0.0f)
+		return vec2(0.0f);
+
+	float radius, angle;
+	if (abs(offset.x) > abs(offset.y))
+	{
+		radius = offset.x;
+		angle = 3.1415926f / 4.0f * (offset.y / offset.x);
+	}
+	else
+	{
+		radius = offset.y;
+		angle = 3.1415926f / 2.0f - 3.1415926f / 4.0f * (offset.x / offset.y);
+	}
+	return radius * vec2(cos(angle), sin(angle));
+}
+
+// Cosine weighted direction around normal
+vec3 cosineHemisphere(vec3 normal, vec2 u)
+{
+	vec2 disk = concentricDisk(u);
+	float z = sqrt(max(0.0f, 1.0f - disk.x * disk.x - disk.y * disk.y));
+
+	float signZ = normal.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (signZ + normal.z);
+	float b = normal.x * normal.y * a;
+	vec3 tangent = vec3(1.0f + signZ * normal.x * normal.x * a, signZ * b, -signZ * normal.x);
+	vec3 bitangent = vec3(b, signZ + normal.y * normal.y * a, -normal.y);
+	return normalize(tangent * disk.x + bitangent * disk.y + normal * z);
 }
 
 float randomNormalDist(inout uint rngState)
@@ -374,9 +597,15 @@ HitInfo calculateRayCollisionBVH(Ray ray)
 
 		int nodeIndex = stack[stackIndex];
 		Node node = allNodes[nodeIndex];
+#ifdef TRAVERSAL_STATS
+		traversalStats.x++;
+#endif
 
 		if (node.childIndex == -1)
 		{				
+#ifdef TRAVERSAL_STATS
+			traversalStats.z += uint(node.triangleCount);
+#endif
 			for (int i = node.triangleIndex; i < node.triangleIndex + node.triangleCount; i++)
 			{
 				HitInfo hitInfo = rayTriangleIntersect(ray, triangles[i], i);
@@ -396,6 +625,9 @@ HitInfo calculateRayCollisionBVH(Ray ray)
 			
 			float dstA = rayBoundsIntersect(ray, childA.bounds);
 			float dstB = rayBoundsIntersect(ray, childB.bounds);
+#ifdef TRAVERSAL_STATS
+			traversalStats.y += 2u;
+#endif
 
 			bool isNearestA = dstA < dstB;
 			float dstNear = isNearestA ? dstA : dstB;
@@ -410,10 +642,186 @@ HitInfo calculateRayCollisionBVH(Ray ray)
 	return result;
 }
 
-vec3 trace(Ray ray, inout uint rngState)
+// Occlusion query: whether any triangle but ignoreTriangle is hit closer than tMax, stops at the first one
+bool isOccludedBVH(Ray ray, float tMax, int ignoreTriangle)
+{
+	int stack[MAX_DEPTH];
+	int stackIndex = 0;
+	stack[stackIndex++] = 0;
+
+	while(stackIndex > 0)
+	{
+		stackIndex -= 1;
+
+		Node node = allNodes[stack[stackIndex]];
+#ifdef TRAVERSAL_STATS
+		traversalStats.x++;
+#endif
+
+		if (node.childIndex == -1)
+		{
+			for (int i = node.triangleIndex; i < node.triangleIndex + node.triangleCount; i++)
+			{
+#ifdef TRAVERSAL_STATS
+				traversalStats.z++;
+#endif
+				HitInfo hitInfo = rayTriangleIntersect(ray, triangles[i], i);
+				if (hitInfo.didHit && hitInfo.dst < tMax && i != ignoreTriangle)
+					return true;
+			}
+		}
+		else
+		{
+			int childIndexA = node.childIndex;
+			int childIndexB = node.childIndex + 1;
+
+			float dstA = rayBoundsIntersect(ray, allNodes[childIndexA].bounds);
+			float dstB = rayBoundsIntersect(ray, allNodes[childIndexB].bounds);
+#ifdef TRAVERSAL_STATS
+			traversalStats.y += 2u;
+#endif
+
+			bool isNearestA = dstA < dstB;
+			float dstNear = isNearestA ? dstA : dstB;
+			float dstFar  = isNearestA ? dstB : dstA;
+			int childIndexNear = isNearestA ? childIndexA : childIndexB;
+			int childIndexFar  = isNearestA ? childIndexB : childIndexA;
+
+			if (dstFar  < tMax) stack[stackIndex++] = childIndexFar;
+			if (dstNear < tMax) stack[stackIndex++] = childIndexNear;
+		}
+	}
+	return false;
+}
+
+float triangleArea(Triangle tri)
+{
+	return 0.5f * length(cross(tri.b - tri.a, tri.c - tri.a));
+}
+
+float lightNodeImportance(LightNode node, vec3 point)
+{
+	vec3 toCenter = (node.boundsMin.xyz + node.boundsMax.xyz) * 0.5f - point;
+	vec3 diagonal = node.boundsMax.xyz - node.boundsMin.xyz;
+	return node.boundsMin.w / max(dot(toCenter, toCenter), dot(diagonal, diagonal) * 0.25f);
+}
+
+float lightFirstChildProbability(LightNode node, vec3 point)
+{
+	float first = lightNodeImportance(lightNodes[node.childIndex], point);
+	float second = lightNodeImportance(lightNodes[node.childIndex + 1], point);
+	return first + second > 0.0f ? first / (first + second) : 0.5f;
+}
+
+int pickLight(vec3 point, float u, out float probability)
+{
+	if (lightSampler == LIGHT_SAMPLER_ALIAS)
+	{
+		float scaled = u * numLights;
+		int slot = min(int(scaled), numLights - 1);
+		int index = scaled - slot < lights[slot].threshold ? slot : lights[slot].alias;
+		probability = lights[index].probability;
+		return index;
+	}
+
+	int nodeIndex = 0;
+	probability = 1.0f;
+	while (lightNodes[nodeIndex].childIndex >= 0)
+	{
+		LightNode node = lightNodes[nodeIndex];
+		float first = lightFirstChildProbability(node, point);
+		if (u < first)
+		{
+			u = u / first;
+			probability *= first;
+			nodeIndex = node.childIndex;
+		}
+		else
+		{
+			u = (u - first) / (1.0f - first);
+			probability *= 1.0f - first;
+			nodeIndex = node.childIndex + 1;
+		}
+		u = min(u, 0.99999994f);
+	}
+	return lightNodes[nodeIndex].lightIndex;
+}
+
+float lightProbability(vec3 point, int lightIndex)
+{
+	if (lightSampler == LIGHT_SAMPLER_ALIAS)
+		return lights[lightIndex].probability;
+
+	uint bitTrail = lights[lightIndex].bitTrail;
+	int nodeIndex = 0;
+	float probability = 1.0f;
+	while (lightNodes[nodeIndex].childIndex >= 0)
+	{
+		LightNode node = lightNodes[nodeIndex];
+		float first = lightFirstChildProbability(node, point);
+		bool second = (bitTrail & 1u) != 0u;
+		probability *= second ? 1.0f - first : first;
+		nodeIndex = node.childIndex + (second ? 1 : 0);
+		bitTrail >>= 1;
+	}
+	return probability;
+}
+
+// Solid angle density of picking the point a ray hit on a light with sampleLight() from the ray's origin
+float lightPdf(Ray ray, HitInfo lightHit)
+{
+	Triangle tri = triangles[lightHit.triangleIndex];
+	float cosLight = -dot(ray.direction, lightHit.normal);
+	if (tri.lightIndex < 0 || cosLight <= 0.0f)
+		return 0.0f;
+	return lightProbability(ray.origin, tri.lightIndex) / triangleArea(tri) * lightHit.dst * lightHit.dst / cosLight;
+}
+
+// Next-event estimation at a diffuse hit, a shadow ray towards a point on a light picked from the origin of the
+// bounce ray, weighted with the power heuristic against the bounce finding the same point
+vec3 sampleLight(HitInfo hitInfo, vec3 origin, vec3 albedo, vec3 rayColor, inout PathSampler pathSampler)
+{
+	float lightChoice = sample1D(pathSampler, DIMENSION_LIGHT_CHOICE);
+	vec2 lightPoint = sample2D(pathSampler, DIMENSION_LIGHT_POINT);
+	float u1 = lightPoint.x;
+	float u2 = lightPoint.y;
+
+	float probability;
+	int triangleIndex = lights[pickLight(origin, lightChoice, probability)].triangleIndex;
+	Triangle tri = triangles[triangleIndex];
+
+	float su = sqrt(u1);
+	vec3 point = tri.a * (1.0f - su) + tri.b * (u2 * su) + tri.c * (su - u2 * su);
+	vec3 toLight = point - hitInfo.hitPoint;
+	float dst2 = dot(toLight, toLight);
+	float dst = sqrt(dst2);
+	vec3 direction = toLight / dst;
+
+	float cosSurface = dot(hitInfo.normal, direction);
+	float cosLight = -dot(direction, normalize(cross(tri.b - tri.a, tri.c - tri.a)));
+	if (cosSurface <= 0.0f || cosLight <= 0.0f)
+		return vec3(0.0f);
+
+	Ray shadowRay;
+	shadowRay.origin = hitInfo.hitPoint + hitInfo.normal * 1e-4f;
+	shadowRay.direction = direction;
+	shadowRay.insideGlass = false;
+	if (isOccludedBVH(shadowRay, dst * 0.999f, triangleIndex))
+		return vec3(0.0f);
+
+	Material light = materials[tri.mtlIndex];
+	float pdfLight = probability / triangleArea(tri) * dst2 / cosLight;
+	float pdfBounce = cosSurface / 3.1415926f;
+	float weight = pdfLight * pdfLight / (pdfLight * pdfLight + pdfBounce * pdfBounce);
+	return light.emissionColor.xyz * light.emissionStrength * rayColor * albedo * (cosSurface / 3.1415926f * weight / pdfLight);
+}
+
+vec3 trace(Ray ray, inout PathSampler pathSampler)
 {
 	vec3 rayColor = vec3(1.0f);
 	vec3 incomingLight = vec3(0.0f);
+	bool nextEvent = nextEventEstimation && numLights > 0;
+	float bouncePdf = 0.0f; // Density of the last diffuse bounce direction, 0 after other bounces
 
 	vec3 emittedLight = vec3(0.0f);
 	vec3 attenuation = vec3(0.0f);
@@ -424,6 +832,10 @@ vec3 trace(Ray ray, inout uint rngState)
 		if (hitInfo.didHit)
 		{
 			Material material = materials[hitInfo.mtlIndex];
+			// A light found by the last bounce would not be reached by the bounce rays either
+			bool sampleLights = nextEvent && i + 1 < maxBounceCount;
+			Ray incomingRay = ray;
+			startBounce(pathSampler, i);
 
 			if (material.materialType != GLASS)
 				ray.origin = hitInfo.hitPoint - ray.direction * hitInfo.dst * -1e-3; // Offset intersection above the surface
@@ -437,29 +849,44 @@ vec3 trace(Ray ray, inout uint rngState)
 			{
 				case DIFFUSE:
 				case TEXTURE:
-					ray.direction = normalize(hitInfo.normal + randomDirection(rngState));
+					if (sampleLights)
+						incomingLight += sampleLight(hitInfo, ray.origin, material.materialType == DIFFUSE ? material.color.xyz : getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex),
+							rayColor, pathSampler);
+
+					ray.direction = cosineHemisphere(hitInfo.normal, sample2D(pathSampler, DIMENSION_DIRECTION));
 					attenuation = material.materialType == DIFFUSE ? material.color.xyz : getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex);
+					bouncePdf = nextEvent ? max(dot(hitInfo.normal, ray.direction), 0.0f) / 3.1415926f : 0.0f;
 					break;
 				case SPECULAR:
-					vec3 diffuseDirection = normalize(hitInfo.normal + randomDirection(rngState));
+					vec3 diffuseDirection = cosineHemisphere(hitInfo.normal, sample2D(pathSampler, DIMENSION_DIRECTION));
 					vec3 specularDirection = reflect(ray.direction, hitInfo.normal);
-					bool isSpecularBounce = material.specularProbability > random(rngState);
+					bool isSpecularBounce = material.specularProbability > sample1D(pathSampler, DIMENSION_LOBE);
 
 					ray.direction = mix(diffuseDirection, specularDirection, isSpecularBounce ? material.smoothness : 0.0f);
 					attenuation = isSpecularBounce ? vec3(1.0f) : material.color.xyz;
+					bouncePdf = 0.0f;
 					break;
 				case LIGHT:
 					emittedLight = material.emissionColor.xyz * material.emissionStrength;
-					return emittedLight * rayColor;
+					float weight = 1.0f;
+					if (nextEvent && bouncePdf > 0.0f)
+					{
+						float pdfLight = lightPdf(incomingRay, hitInfo);
+						weight = bouncePdf * bouncePdf / (bouncePdf * bouncePdf + pdfLight * pdfLight);
+					}
+					return incomingLight + emittedLight * rayColor * weight;
 				case CHECKER:
-					ray.direction = normalize(hitInfo.normal + randomDirection(rngState));
-
 					bool isBlackChecker = material.checkerScale > 0.0f
 						&& (mod(floor(ray.origin.x * material.checkerScale)
 						+ floor(ray.origin.y * material.checkerScale)
 						+ floor(ray.origin.z * material.checkerScale), 2) == 0);
 
+					if (sampleLights && !isBlackChecker)
+						incomingLight += sampleLight(hitInfo, ray.origin, vec3(1.0f), rayColor, pathSampler);
+
+					ray.direction = cosineHemisphere(hitInfo.normal, sample2D(pathSampler, DIMENSION_DIRECTION));
 					attenuation = isBlackChecker ? vec3(0.0f) : vec3(1.0f);
+					bouncePdf = nextEvent ? max(dot(hitInfo.normal, ray.direction), 0.0f) / 3.1415926f : 0.0f;
 					break;
 				case GLASS:
 					float refractiveIndex = ray.insideGlass ? material.refractiveIndex : 1.0f / material.refractiveIndex;
@@ -467,7 +894,7 @@ vec3 trace(Ray ray, inout uint rngState)
 					ray.direction = refract_(ray.direction, hitInfo.normal, refractiveIndex, isRefracted);
 					ray.insideGlass = isRefracted != ray.insideGlass;
 					attenuation = material.color.xyz;
-
+					bouncePdf = 0.0f;
 					break;
 				default:
 					return vec3(0.0f);
@@ -475,7 +902,7 @@ vec3 trace(Ray ray, inout uint rngState)
 			rayColor *= attenuation;
 			// A simple optimization
 			float p = max(rayColor.r, max(rayColor.g, rayColor.b));
-			if (random(rngState) > p)
+			if (sample1D(pathSampler, DIMENSION_ROULETTE) > p)
 			    break;
 			rayColor *= 1.0f / p;
 		}
@@ -535,12 +962,12 @@ vec3 traceBasic(Ray ray)
 
 				if (basicShadingShadow)
 				{
-					vec3 directionToLight = normalize(basicShadingLightPosition.xyz - hitInfo.hitPoint);
+					vec3 toLight = basicShadingLightPosition.xyz - hitInfo.hitPoint;
 					Ray rayToLight;
 					rayToLight.origin = ray.origin;
-					rayToLight.direction = directionToLight;
-					HitInfo hitInfoToLight = calculateRayCollisionBVH(rayToLight);
-					return (hitInfoToLight.didHit ? colorCumulative / 5 : colorCumulative) / bounceCount; 
+					rayToLight.direction = normalize(toLight);
+					bool inShadow = isOccludedBVH(rayToLight, length(toLight), -1);
+					return (inShadow ? colorCumulative / 5 : colorCumulative) / bounceCount;
 				}
 				else
 					return colorCumulative / bounceCount;
@@ -567,6 +994,39 @@ vec3 traceBasic(Ray ray)
 	return colorCumulative / bounceCount;
 }
 
+// Albedo, normal and distance of the first surface the ray hits, a miss has a zero normal and depth
+void firstHitFeatures(Ray ray, out vec3 albedo, out vec4 normalDepth)
+{
+	albedo = vec3(1.0f);
+	normalDepth = vec4(0.0f);
+
+	HitInfo hitInfo = calculateRayCollisionBVH(ray);
+	if (!hitInfo.didHit)
+		return;
+
+	normalDepth = vec4(hitInfo.normal, hitInfo.dst);
+
+	Material material = materials[hitInfo.mtlIndex];
+	switch (material.materialType)
+	{
+	case DIFFUSE:
+	case SPECULAR:
+	case GLASS:
+		albedo = material.color.xyz;
+		break;
+	case TEXTURE:
+		albedo = getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex);
+		break;
+	case CHECKER:
+		bool isBlackChecker = material.checkerScale > 0.0f
+			&& (mod(floor(hitInfo.hitPoint.x * material.checkerScale)
+			+ floor(hitInfo.hitPoint.y * material.checkerScale)
+			+ floor(hitInfo.hitPoint.z * material.checkerScale), 2) == 0);
+		albedo = isBlackChecker ? vec3(0.0f) : vec3(1.0f);
+		break;
+	}
+}
+
 void main()
 {
     vec3 color = vec3(1.0f);
@@ -578,7 +1038,31 @@ void main()
     // color = vec3(x * 0.5f + 0.5f, y * 0.5f + 0.5f, 0.0f);
     // imageStore(imgOutput, texelCoord, vec4(color, 1.0f));
 
-	uint seed = texelCoord.x + texelCoord.y * size.x + frameIndex * 968824447u;
+	// The samples continue where the previous frames stopped
+	uint pixelIndex = texelCoord.x + texelCoord.y * size.x;
+	PathSampler pathSampler;
+	pathSampler.seedHash = hashInt(seed);
+	pathSampler.rngState = pixelIndex + frameIndex * 968824447u + pathSampler.seedHash;
+	pathSampler.pixelHash = hashInt(pixelIndex ^ pathSampler.seedHash);
+	pathSampler.pixel = texelCoord;
+	pathSampler.sampleIndex = 0u;
+	pathSampler.nextSampleIndex = frameIndex * uint(numRaysPerPixel);
+	pathSampler.bounceDimension = 0;
+
+	if (checkSamples)
+	{
+		int checkPixel = texelCoord.x / SAMPLE_CHECK_SPACING;
+		if (texelCoord.x == texelCoord.y && texelCoord.x % SAMPLE_CHECK_SPACING == 0 && checkPixel < SAMPLE_CHECK_PIXELS)
+		{
+			startSample(pathSampler);
+			for (int dimension = 0; dimension < SAMPLE_CHECK_DIMENSIONS; dimension++)
+			{
+				float value = get1D(pathSampler, dimension);
+				sampleChecks[checkPixel * SAMPLE_CHECK_DIMENSIONS + dimension] = vec4(value, get2D(pathSampler, dimension), 0.0f);
+			}
+		}
+		return;
+	}
 
 	vec3 endPoint = cameraPos.xyz + viewportFront.xyz + viewportRight.xyz * x + viewportUp.xyz * y;
 
@@ -595,18 +1079,50 @@ void main()
 
 		for (int i = 0; i < numRaysPerPixel; i++)
 		{
+			startSample(pathSampler);
+			vec2 jitter = get2D(pathSampler, DIMENSION_PIXEL) - 0.5f;
+			vec2 lensPoint = concentricDisk(get2D(pathSampler, DIMENSION_LENS));
+
 			Ray rayJittered;
-			vec2 randDir2D = randomDirection2D(seed);
-			rayJittered.origin = cameraPos.xyz + defocusDiskRight.xyz * randDir2D.x + defocusDiskUp.xyz * randDir2D.y;
-			vec3 endPointJittered = endPoint + pixelRight.xyz * random(-0.5f, 0.5f, seed) + pixelUp.xyz * random(-0.5f, 0.5f, seed);
+			rayJittered.origin = cameraPos.xyz + defocusDiskRight.xyz * lensPoint.x + defocusDiskUp.xyz * lensPoint.y;
+			vec3 endPointJittered = endPoint + pixelRight.xyz * jitter.x + pixelUp.xyz * jitter.y;
 			rayJittered.direction = normalize(endPointJittered - rayJittered.origin);
 			rayJittered.insideGlass = false;
 
-			colorCumulative += trace(rayJittered, seed);
+			colorCumulative += trace(rayJittered, pathSampler);
 		}
 
 		color = colorCumulative / numRaysPerPixel;
 	}
 
+#ifdef TRAVERSAL_STATS
+	// Same colors as heatmapColor() of the CPU side
+	float work = min(1.0f, float(traversalStats.y + traversalStats.z) / (TRAVERSAL_HEATMAP_MAX * float(basicShading ? 1 : numRaysPerPixel)));
+	color = work < 0.5f ? mix(vec3(0.0f, 0.0f, 0.5f), vec3(0.0f, 1.0f, 0.0f), work * 2.0f)
+	                    : mix(vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), work * 2.0f - 1.0f);
+#endif
+
+	// Running mean of every frame since frameIndex 0, kept in full float precision
+	if (accumulate && frameIndex > 0)
+	{
+		vec3 previous = imageLoad(imgOutput, texelCoord).rgb;
+		color = previous + (color - previous) / float(frameIndex + 1);
+	}
+
 	imageStore(imgOutput, texelCoord, vec4(color, 1.0f));
+
+	// The center ray sees the same surface every frame, so an average only needs it once
+	if (writeFeatures && (!accumulate || frameIndex == 0))
+	{
+		Ray centerRay;
+		centerRay.origin = cameraPos.xyz;
+		centerRay.direction = normalize(viewportFront.xyz + viewportRight.xyz * x + viewportUp.xyz * y);
+		centerRay.insideGlass = false;
+
+		vec3 albedo;
+		vec4 normalDepth;
+		firstHitFeatures(centerRay, albedo, normalDepth);
+		imageStore(imgAlbedo, texelCoord, vec4(albedo, 1.0f));
+		imageStore(imgNormalDepth, texelCoord, normalDepth);
+	}
 }
@@ -0,0 +1,81 @@
+#version 430 core
+
+// One iteration of the edge-avoiding à-trous filter of denoiser.h, the first divides the color by the albedo and
+// the last multiplies it back. imgInput and imgOutput are swapped between iterations, stepWidth doubles every time.
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(rgba32f, binding = 0) uniform readonly image2D imgInput;
+layout(rgba32f, binding = 1) uniform readonly image2D imgAlbedo;
+layout(rgba32f, binding = 2) uniform readonly image2D imgNormalDepth;
+layout(rgba32f, binding = 3) uniform writeonly image2D imgOutput;
+
+uniform int stepWidth;
+uniform float colorSigma;
+uniform float depthSigma;
+uniform bool demodulate;
+uniform bool remodulate;
+
+const float NORMAL_POWER = 128.0f;
+const float KERNEL[5] = float[](1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f);
+
+float luminance(vec3 color)
+{
+	return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// The falloff expNegative() of denoiser.h uses instead of exp(-x), so both filters weight their taps the same
+float expNegative(float x)
+{
+	return 1.0f / (1.0f + x * (1.0f + x * (0.5f + x * (1.0f / 6.0f + x * (1.0f / 24.0f)))));
+}
+
+vec3 loadIllumination(ivec2 coord)
+{
+	vec3 color = imageLoad(imgInput, coord).rgb;
+	return demodulate ? color / max(imageLoad(imgAlbedo, coord).rgb, vec3(1e-3f)) : color;
+}
+
+void main()
+{
+	ivec2 texelCoord = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(imgInput);
+	if (texelCoord.x >= size.x || texelCoord.y >= size.y)
+		return;
+
+	vec3 color = loadIllumination(texelCoord);
+	vec4 normalDepth = imageLoad(imgNormalDepth, texelCoord);
+	float centerLuminance = luminance(color);
+	float depthScale = normalDepth.w * depthSigma * stepWidth + 1e-4f;
+
+	vec3 sum = vec3(0.0f);
+	float sumWeight = 0.0f;
+	for (int dy = -2; dy <= 2; dy++)
+	{
+		for (int dx = -2; dx <= 2; dx++)
+		{
+			ivec2 tapCoord = texelCoord + ivec2(dx, dy) * stepWidth;
+			if (any(lessThan(tapCoord, ivec2(0))) || any(greaterThanEqual(tapCoord, size)))
+				continue;
+
+			vec3 tapColor = loadIllumination(tapCoord);
+			float weight = KERNEL[dx + 2] * KERNEL[dy + 2];
+			if (dx != 0 || dy != 0)
+			{
+				vec4 tapNormalDepth = imageLoad(imgNormalDepth, tapCoord);
+				float colorWeight = expNegative(abs(centerLuminance - luminance(tapColor)) / colorSigma);
+				float normalWeight = pow(max(0.0f, dot(normalDepth.xyz, tapNormalDepth.xyz)), NORMAL_POWER);
+				float depthWeight = expNegative(abs(normalDepth.w - tapNormalDepth.w) / depthScale);
+				weight *= colorWeight * normalWeight * depthWeight;
+			}
+
+			sum += tapColor * weight;
+			sumWeight += weight;
+		}
+	}
+
+	vec3 filtered = sum / sumWeight;
+	if (remodulate)
+		filtered *= max(imageLoad(imgAlbedo, texelCoord).rgb, vec3(1e-3f));
+	imageStore(imgOutput, texelCoord, vec4(filtered, 1.0f));
+}
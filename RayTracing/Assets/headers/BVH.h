@@ -150,6 +150,7 @@ public:
     BVH(std::vector<BVHTriangle>& bvhTriangles, std::vector<RTXTriangle>& rtxTriangles)
     {
         std::cout << "Building BVH..." << std::endl;
+        TraceScope scope("build BVH", "load", static_cast<long long>(bvhTriangles.size()));
 
         BoundingBox bounds;
         for (const BVHTriangle& tri : bvhTriangles)
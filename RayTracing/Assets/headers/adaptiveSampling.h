@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/imageOutput.h>
+
+// Adaptive sampling: the image is rendered in passes of numRaysPerPixel samples and every pixel keeps the mean and
+// variance of its pass results. Once a pixel has had minPasses passes and the standard error of the mean brightness,
+// measured after clamping to what the screen shows, is below the threshold for it and its 8 neighbours, it gets no
+// more samples. Looking at the neighbours keeps a pixel whose few first passes happened to agree (e.g. all black in a
+// noisy area) from stopping early. Flat walls stop after a few passes while glass and caustics keep sampling, and the
+// render is done once no pixel is left.
+
+struct PixelEstimate
+{
+    glm::vec3 sum = glm::vec3(0.0f);
+    float mean = 0.0f; // Welford's running mean and squared deviations of the displayed brightness
+    float m2 = 0.0f;
+    int passes = 0;
+    bool done = false;
+};
+
+class AdaptiveSampler
+{
+public:
+    AdaptiveSampler(int width_, int height_, float threshold_, int minPasses_, int maxPasses_)
+        : width(width_), height(height_), threshold(threshold_), minPasses(std::max(2, minPasses_)), maxPasses(maxPasses_),
+          pixels(width_ * height_), errors(width_ * height_) {}
+
+    bool active(int pixel) const
+    {
+        return !pixels[pixel].done;
+    }
+
+    // Adds one pass of a pixel, thread safe as long as no two threads share a pixel
+    void addPass(int pixel, const glm::vec3& color)
+    {
+        PixelEstimate& estimate = pixels[pixel];
+        glm::vec3 shown = glm::clamp(color, 0.0f, 1.0f);
+        float brightness = glm::dot(shown, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+
+        estimate.sum += color;
+        estimate.passes++;
+        float delta = brightness - estimate.mean;
+        estimate.mean += delta / estimate.passes;
+        estimate.m2 += delta * (brightness - estimate.mean);
+    }
+
+    // Called between passes, retires the pixels that reached the threshold and returns how many are left
+    int update()
+    {
+        for (size_t i = 0; i < pixels.size(); i++)
+            errors[i] = pixels[i].passes >= 2 ? standardError(pixels[i]) : 1.0f;
+
+        int numActive = 0;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                PixelEstimate& estimate = pixels[y * width + x];
+                if (estimate.done)
+                    continue;
+
+                float error = 0.0f;
+                for (int ny = std::max(0, y - 1); ny <= std::min(height - 1, y + 1); ny++)
+                    for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1); nx++)
+                        error = std::max(error, errors[ny * width + nx]);
+
+                estimate.done = estimate.passes >= maxPasses || (estimate.passes >= minPasses && error < threshold);
+                numActive += !estimate.done;
+            }
+        return numActive;
+    }
+
+    long long totalPasses() const
+    {
+        long long total = 0;
+        for (const PixelEstimate& estimate : pixels)
+            total += estimate.passes;
+        return total;
+    }
+
+    std::vector<glm::vec3> image() const
+    {
+        std::vector<glm::vec3> colors(pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++)
+            colors[i] = pixels[i].passes > 0 ? pixels[i].sum / float(pixels[i].passes) : glm::vec3(0.0f);
+        return colors;
+    }
+
+    // Passes per pixel from dark blue (fewest) over green to red (most)
+    std::vector<glm::vec3> heatmap() const
+    {
+        int fewest = maxPasses, most = 0;
+        for (const PixelEstimate& estimate : pixels)
+        {
+            fewest = std::min(fewest, estimate.passes);
+            most = std::max(most, estimate.passes);
+        }
+
+        std::vector<glm::vec3> colors(pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            float t = most > fewest ? float(pixels[i].passes - fewest) / float(most - fewest) : 0.0f;
+            colors[i] = heatmapColor(t);
+        }
+        return colors;
+    }
+
+private:
+    int width;
+    int height;
+    float threshold;
+    int minPasses;
+    int maxPasses;
+    std::vector<PixelEstimate> pixels;
+    std::vector<float> errors;
+
+    static float standardError(const PixelEstimate& estimate)
+    {
+        float variance = estimate.m2 / float(estimate.passes - 1);
+        return std::sqrt(variance / float(estimate.passes));
+    }
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/camera.h>
+#include <RayTracing/Assets/headers/cpuTracer.h>
+#include <RayTracing/Assets/headers/renderSettings.h>
+
+// Ray throughput of the CPU tracer, apart for the three kinds of rays a path traces:
+//  - primary: camera rays, coherent, every pixel of a few views around the scene
+//  - diffuse: one cosine weighted bounce from every primary hit, incoherent
+//  - shadow: one occlusion query from every primary hit towards a point on a light (the basic shading light when the
+//    scene has none)
+// The rays are generated up front, only the traversals are timed, and every set is traced a few times keeping the
+// fastest run so a busy machine disturbs the numbers less. The views orbit the scene's bounds, the same for every
+// machine and every build, so results can be compared with a baseline.
+
+const int BENCHMARK_VIEWS = 4;
+
+struct BenchmarkResult
+{
+    std::string name;
+    int numTriangles = 0;
+    SceneLoadTimings loadTimings;
+    float wideBVHSeconds = 0.0f;
+    long long numPrimaryRays = 0;
+    long long numDiffuseRays = 0;
+    long long numShadowRays = 0;
+    double primaryMrays = 0.0; // Millions of rays per second
+    double diffuseMrays = 0.0;
+    double shadowMrays = 0.0;
+};
+
+// Looks at the center of the scene from outside its bounds, the scene about fills the view. The Cornell box walls only
+// face inwards, so it doesn't hide the model
+Camera benchmarkCamera(const RenderSettings& settings, const BoundingBox& bounds, int view)
+{
+    glm::vec3 center = bounds.center();
+    float distance = glm::length(bounds.max - bounds.min);
+    float angle = (view + 0.5f) * 2.0f * PI / BENCHMARK_VIEWS;
+    float elevation = 0.35f;
+
+    glm::vec3 toCamera = glm::vec3(std::cos(angle) * std::cos(elevation), std::sin(elevation), std::sin(angle) * std::cos(elevation));
+    // The camera looks along -front, front points back at it
+    float yaw = std::atan2(toCamera.z, toCamera.x);
+    return Camera(settings.width, settings.height, 10.0f, center + toCamera * distance, PI / 6.0f, elevation, yaw, distance, 0.0f, 0.0f);
+}
+
+// Traces count rays on numThreads threads, trace(i) traces ray i. Returns the seconds of the fastest of repeats runs
+template <typename TraceFunction>
+double timeRays(long long count, int numThreads, int repeats, const TraceFunction& trace)
+{
+    double best = 1e30;
+    for (int run = 0; run < repeats; run++)
+    {
+        std::vector<std::thread> threads;
+        std::vector<int> sinks(numThreads, 0); // Keeps the results alive
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < numThreads; t++)
+            threads.push_back(std::thread([&, t]()
+            {
+                int sink = 0;
+                for (long long i = count * t / numThreads; i < count * (t + 1) / numThreads; i++)
+                    sink += trace(i);
+                sinks[t] = sink;
+            }));
+        for (std::thread& thread : threads)
+            thread.join();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+void runBenchmark(const CPUTracer& tracer, const CPUScene& scene, const RenderSettings& settings, SamplerType samplerType,
+                  LightSampler lightSampler, int numThreads, int repeats, BenchmarkResult& result)
+{
+    BoundingBox bounds = scene.nodes[0].bounds;
+    std::vector<Ray> primaryRays, diffuseRays;
+    std::vector<ShadowRay> shadowRays;
+
+    for (int view = 0; view < BENCHMARK_VIEWS; view++)
+    {
+        Camera camera = benchmarkCamera(settings, bounds, view);
+        GlobalUniforms uniforms = makeUniforms(settings, camera, scene.rtxTriangles.size(), scene.textures.size());
+        uniforms.numLights = scene.lights.lights.size();
+        uniforms.lightSampler = lightSampler;
+        uniforms.samplerType = samplerType;
+
+        for (int y = 0; y < settings.height; y++)
+            for (int x = 0; x < settings.width; x++)
+            {
+                PixelSampler sampler = tracer.pixelSampler(uniforms, x, y);
+                Ray ray = tracer.generateCameraRay(uniforms, x, y, sampler);
+                primaryRays.push_back(ray);
+
+                HitInfo hitInfo = tracer.closestHit(ray);
+                if (!hitInfo.didHit || tracer.materials[hitInfo.mtlIndex].materialType == LIGHT)
+                    continue;
+
+                // The same offset and direction scatter() would take
+                sampler.startBounce(0);
+                Ray bounce;
+                bounce.origin = hitInfo.hitPoint - ray.direction * hitInfo.dst * -1e-3f;
+                bounce.direction = cosineHemisphere(hitInfo.normal, sampler.sample2D(DIMENSION_DIRECTION));
+                diffuseRays.push_back(bounce);
+
+                ShadowRay shadowRay;
+                if (uniforms.numLights > 0)
+                {
+                    tracer.sampleLight(hitInfo, bounce.origin, lightSampler, glm::vec3(1.0f), glm::vec3(1.0f), sampler, shadowRay);
+                    if (shadowRay.lightTriangle >= 0)
+                        shadowRays.push_back(shadowRay);
+                }
+                else
+                {
+                    glm::vec3 toLight = glm::vec3(uniforms.basicShadingLightPosition) - hitInfo.hitPoint;
+                    shadowRay.ray.origin = hitInfo.hitPoint + hitInfo.normal * 1e-4f;
+                    shadowRay.ray.direction = glm::normalize(toLight);
+                    shadowRay.maxDst = glm::length(toLight);
+                    shadowRays.push_back(shadowRay);
+                }
+            }
+    }
+
+    result.numPrimaryRays = primaryRays.size();
+    result.numDiffuseRays = diffuseRays.size();
+    result.numShadowRays = shadowRays.size();
+
+    auto mrays = [](long long count, double seconds) { return seconds > 0.0 ? count / seconds * 1e-6 : 0.0; };
+    result.primaryMrays = mrays(result.numPrimaryRays, timeRays(result.numPrimaryRays, numThreads, repeats,
+        [&](long long i) { return int(tracer.closestHit(primaryRays[i]).didHit); }));
+    result.diffuseMrays = mrays(result.numDiffuseRays, timeRays(result.numDiffuseRays, numThreads, repeats,
+        [&](long long i) { return int(tracer.closestHit(diffuseRays[i]).didHit); }));
+    result.shadowMrays = mrays(result.numShadowRays, timeRays(result.numShadowRays, numThreads, repeats,
+        [&](long long i) { return int(tracer.isVisible(shadowRays[i])); }));
+}
+
+// One scene per line, so the baseline reader doesn't need a full JSON parser
+bool writeBenchmarkJson(const std::string& path, const std::vector<BenchmarkResult>& results, int numThreads, int kernelWidth, const RenderSettings& settings)
+{
+    std::ofstream file(toNativePath(path));
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot write benchmark results: " << path << std::endl;
+        return false;
+    }
+
+    file << std::setprecision(6);
+    file << "{" << std::endl
+        << "  \"threads\": " << numThreads << "," << std::endl
+        << "  \"kernelWidth\": " << kernelWidth << "," << std::endl
+        << "  \"width\": " << settings.width << "," << std::endl
+        << "  \"height\": " << settings.height << "," << std::endl
+        << "  \"views\": " << BENCHMARK_VIEWS << "," << std::endl
+        << "  \"scenes\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results[i];
+        file << "    { \"name\": \"" << result.name << "\", \"triangles\": " << result.numTriangles
+            << ", \"meshSeconds\": " << result.loadTimings.meshSeconds
+            << ", \"bvhSeconds\": " << result.loadTimings.bvhSeconds
+            << ", \"wideBvhSeconds\": " << result.wideBVHSeconds
+            << ", \"lightSeconds\": " << result.loadTimings.lightSeconds
+            << ", \"primaryRays\": " << result.numPrimaryRays
+            << ", \"diffuseRays\": " << result.numDiffuseRays
+            << ", \"shadowRays\": " << result.numShadowRays
+            << ", \"primaryMrays\": " << result.primaryMrays
+            << ", \"diffuseMrays\": " << result.diffuseMrays
+            << ", \"shadowMrays\": " << result.shadowMrays
+            << " }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    file << "  ]" << std::endl << "}" << std::endl;
+    return true;
+}
+
+// Reads the scenes of a file writeBenchmarkJson() wrote: name -> number fields
+bool readBenchmarkJson(const std::string& path, std::map<std::string, std::map<std::string, double>>& scenes)
+{
+    std::ifstream file(toNativePath(path));
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot open benchmark baseline: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t namePos = line.find("\"name\": \"");
+        if (namePos == std::string::npos)
+            continue;
+        size_t nameBegin = namePos + 9;
+        std::string name = line.substr(nameBegin, line.find('"', nameBegin) - nameBegin);
+
+        std::map<std::string, double>& fields = scenes[name];
+        for (size_t keyBegin = line.find('"', line.find('"', nameBegin) + 1); keyBegin != std::string::npos; keyBegin = line.find('"', keyBegin + 1))
+        {
+            size_t keyEnd = line.find('"', keyBegin + 1);
+            if (keyEnd == std::string::npos)
+                break;
+            std::string key = line.substr(keyBegin + 1, keyEnd - keyBegin - 1);
+            std::stringstream value(line.substr(line.find(':', keyEnd) + 1));
+            double number;
+            if (value >> number)
+                fields[key] = number;
+            keyBegin = keyEnd;
+        }
+    }
+    return true;
+}
+
+// Prints every throughput that dropped and every build time that grew by more than tolerance (0.1 for 10%) against
+// the baseline, returns how many did. Times below 10 ms are too noisy to compare
+int compareWithBaseline(const std::vector<BenchmarkResult>& results, const std::map<std::string, std::map<std::string, double>>& baseline, float tolerance)
+{
+    int numRegressions = 0;
+    for (const BenchmarkResult& result : results)
+    {
+        auto scene = baseline.find(result.name);
+        if (scene == baseline.end())
+        {
+            std::cout << "  " << result.name << ": not in the baseline" << std::endl;
+            continue;
+        }
+
+        std::pair<std::string, double> throughputs[] = {
+            { "primaryMrays", result.primaryMrays }, { "diffuseMrays", result.diffuseMrays }, { "shadowMrays", result.shadowMrays } };
+        std::pair<std::string, double> times[] = {
+            { "bvhSeconds", result.loadTimings.bvhSeconds }, { "wideBvhSeconds", result.wideBVHSeconds }, { "meshSeconds", result.loadTimings.meshSeconds } };
+
+        auto report = [&](const std::string& key, double current, bool higherIsBetter)
+        {
+            auto field = scene->second.find(key);
+            if (field == scene->second.end() || field->second <= 0.0)
+                return;
+            double change = current / field->second - 1.0;
+            bool regressed = higherIsBetter ? change < -tolerance : (change > tolerance && current - field->second > 0.01);
+            numRegressions += regressed;
+            std::cout << "  " << std::left << std::setw(24) << result.name << std::setw(16) << key << std::right << std::setw(10) << field->second
+                << " -> " << std::setw(10) << current << std::showpos << std::setw(9) << std::fixed << std::setprecision(1) << change * 100.0 << "%"
+                << std::noshowpos << std::defaultfloat << std::setprecision(6) << (regressed ? "  REGRESSION" : "") << std::endl;
+        };
+        for (const auto& throughput : throughputs)
+            report(throughput.first, throughput.second, true);
+        for (const auto& time : times)
+            report(time.first, time.second, false);
+    }
+    return numRegressions;
+}
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <iostream>
+#include <cstdint>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <math/math_util.h>
-#include <OpenGL/shaderClass.h>
 
 struct GlobalUniforms {
 	int pad;
@@ -33,6 +35,16 @@ struct GlobalUniforms {
     glm::vec4 pixelUp;
     glm::vec4 defocusDiskRight;
     glm::vec4 defocusDiskUp; // 24 units
+
+    int accumulate; // Average into imgOutput over frameIndex + 1 frames instead of overwriting it
+    int writeFeatures; // Also store the first hit's albedo, normal and depth for the denoiser
+    int nextEventEstimation; // Sample the lights directly at diffuse hits, combined with the bounces by MIS
+    int numLights;
+
+    int lightSampler; // LightSampler picking the light of a shadow ray
+    int samplerType; // SamplerType of the path's random numbers
+    unsigned int seed; // Picks another set of samples, 0 keeps the default ones
+    int pad4;
 };
 
 class Camera
@@ -84,6 +96,9 @@ public:
 	glm::vec3 defocusDiskRight;
 	glm::vec3 defocusDiskUp;
 
+	// Set whenever the view moves, cleared by whoever accumulates frames of the same view
+	bool viewChanged = true;
+
 public:
 	enum Movement : uint8_t {
 		FORWARD = 0b10000000,
@@ -120,6 +135,8 @@ public:
 	// Movement and Defocus
 	void keyboardInput(uint8_t inputBits, float dt)
 	{
+		if (inputBits)
+			viewChanged = true;
 		if (inputBits & FORWARD)
 			position -= glm::normalize(glm::vec3(front.x, 0.0f, front.z)) * speed * dt;
 		if (inputBits & BACKWARD)
@@ -163,6 +180,7 @@ public:
 	void updateViewportVectors(float mouseYOffset)
 	{
 		zoom += mouseYOffset;
+		viewChanged = true;
 
 		float h = glm::tan(hfov / 2);
 		float viewportWidth = 2 * h / exp(zoom * zoomSensitivity);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <filesUtil/myFile.h>
+
+// Camera keyframes of a turntable or fly-through. A path file has one keyframe per line, '#' starts a comment:
+//
+//     # time  position  yaw pitch  focusDistance defocusAngle zoom
+//     0   0 5 10   1.5707963 0   20 0 1
+//     2   10 5 0   0 0           20 0 1
+//
+// Times are in any unit but have to increase. Position, yaw and pitch follow a Catmull-Rom spline through the keyframes,
+// so the camera doesn't jerk at them, the lens settings are blended linearly. Angles are not wrapped: a turntable
+// goes from 0 to 6.2831853 rather than back to 0.
+
+struct CameraKeyframe
+{
+    float time = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    float focusDistance = 20.0f;
+    float defocusAngle = 0.0f;
+    float zoom = 1.0f;
+};
+
+bool loadCameraPath(const std::string& path, std::vector<CameraKeyframe>& keyframes)
+{
+    std::ifstream fileStream(toNativePath(path));
+    if (!fileStream.is_open())
+    {
+        std::cerr << "Cannot open camera path: " << path << std::endl;
+        return false;
+    }
+
+    keyframes.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(fileStream, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        std::stringstream strStream(line);
+        CameraKeyframe keyframe;
+        if (!(strStream >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.yaw >> keyframe.pitch
+            >> keyframe.focusDistance >> keyframe.defocusAngle >> keyframe.zoom)
+            || (!keyframes.empty() && keyframe.time <= keyframes.back().time))
+        {
+            std::cerr << path << ":" << lineNumber << ": invalid keyframe: " << line << std::endl;
+            return false;
+        }
+        keyframes.push_back(keyframe);
+    }
+
+    if (keyframes.empty())
+    {
+        std::cerr << "Camera path has no keyframes: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Uniform Catmull-Rom segment from p1 (t = 0) to p2 (t = 1)
+template <typename T>
+T catmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t)
+{
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+// The camera at time, held at the first and last keyframe outside of the path
+CameraKeyframe sampleCameraPath(const std::vector<CameraKeyframe>& keyframes, float time)
+{
+    if (time <= keyframes.front().time)
+        return keyframes.front();
+    if (time >= keyframes.back().time)
+        return keyframes.back();
+
+    int segment = 0;
+    while (keyframes[segment + 1].time < time)
+        segment++;
+    const CameraKeyframe& k0 = keyframes[std::max(segment - 1, 0)];
+    const CameraKeyframe& k1 = keyframes[segment];
+    const CameraKeyframe& k2 = keyframes[segment + 1];
+    const CameraKeyframe& k3 = keyframes[std::min(segment + 2, static_cast<int>(keyframes.size()) - 1)];
+    float t = (time - k1.time) / (k2.time - k1.time);
+
+    CameraKeyframe camera;
+    camera.time = time;
+    camera.position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+    camera.yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+    camera.pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+    camera.focusDistance = glm::mix(k1.focusDistance, k2.focusDistance, t);
+    camera.defocusAngle = glm::mix(k1.defocusAngle, k2.defocusAngle, t);
+    camera.zoom = glm::mix(k1.zoom, k2.zoom, t);
+    return camera;
+}
+
+// Frame index of a sequence of numFrames spread evenly from the first to the last keyframe
+CameraKeyframe sampleCameraPathFrame(const std::vector<CameraKeyframe>& keyframes, int frame, int numFrames)
+{
+    float start = keyframes.front().time;
+    float end = keyframes.back().time;
+    return sampleCameraPath(keyframes, numFrames > 1 ? start + (end - start) * frame / float(numFrames - 1) : start);
+}
+
+// "Images/orbit.png" becomes "Images/orbit_0007.png"
+std::string sequenceFramePath(const std::string& output, int frame)
+{
+    fs::path path = toNativePath(output);
+    std::ostringstream name;
+    name << path.stem().string() << "_";
+    name.width(4);
+    name.fill('0');
+    name << frame << path.extension().string();
+    return (path.parent_path() / name.str()).string();
+}
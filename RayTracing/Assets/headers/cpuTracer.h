@@ -0,0 +1,836 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "stb/stb_image.h"
+
+#include <RayTracing/Assets/headers/mesh.h>
+#include <RayTracing/Assets/headers/BVH.h>
+#include <RayTracing/Assets/headers/camera.h>
+#include <RayTracing/Assets/headers/scene.h>
+#include <RayTracing/Assets/headers/lights.h>
+#include <RayTracing/Assets/headers/sampler.h>
+#include <RayTracing/Assets/headers/renderSettings.h>
+
+// CPU port of compute.glsl. The functions mirror the shader one to one (including its samplers, sampler.h) so that
+// both backends produce the same image for the same uniforms.
+
+// Same sampling as the model textures of the OpenGL renderer: GL_NEAREST filtering, GL_REPEAT wrapping
+class CPUTexture
+{
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<glm::vec3> texels;
+
+    CPUTexture(const std::string& path)
+    {
+        TraceScope scope("decode texture", "load");
+        int numColCh;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &numColCh, 3);
+        if (!pixels)
+        {
+            std::cout << "Failed to load texture: " << path << std::endl;
+            throw(errno);
+        }
+
+        texels.resize(width * height);
+        for (int i = 0; i < width * height; i++)
+            texels[i] = glm::vec3(pixels[3 * i], pixels[3 * i + 1], pixels[3 * i + 2]) / 255.0f;
+
+        stbi_image_free(pixels);
+    }
+
+    glm::vec3 sample(const glm::vec2& uv) const
+    {
+        // Grazing hits on degenerate triangles get no texture coordinates
+        if (!std::isfinite(uv.x) || !std::isfinite(uv.y))
+            return texels[0];
+
+        float u = uv.x - std::floor(uv.x);
+        float v = uv.y - std::floor(uv.y);
+        int x = std::min(static_cast<int>(u * width), width - 1);
+        int y = std::min(static_cast<int>(v * height), height - 1);
+        return texels[y * width + x];
+    }
+};
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    bool insideGlass = false;
+};
+
+struct HitInfo
+{
+    int mtlIndex = -1;
+    bool didHit = false;
+    glm::vec3 hitPoint;
+    glm::vec3 normal;
+    float dst = 1e38f;
+    int triangleIndex = -1;
+};
+
+glm::vec3 refract_(const glm::vec3& I, const glm::vec3& N, float eta, bool& isRefracted)
+{
+    float k = 1.0f - eta * eta * (1.0f - glm::dot(N, I) * glm::dot(N, I));
+    if (k < 0.0f)
+    {
+        isRefracted = false;
+        return glm::reflect(I, N);
+    }
+    else
+    {
+        isRefracted = true;
+        return eta * I - (eta * glm::dot(N, I) + std::sqrt(k)) * N;
+    }
+}
+
+glm::vec3 getEnvironmentalLight(const Ray& ray)
+{
+    return (ray.direction.y > 0) ?
+            glm::mix(glm::mix(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f), ray.direction.y * 0.5f + 0.5f),
+                glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.4f, 0.0f), ray.direction.x * 0.5f + 0.5f), 0.9f) :
+            glm::mix(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.1f, 0.05f, 0.1f), -std::max(ray.direction.y, -1.0f) * 2);
+}
+
+bool isCloseToZero(float val)
+{
+    return (val < 1e-6f) && (val > -1e-6f);
+}
+
+float rayBoundsIntersect(const Ray& ray, const BoundingBox& bounds)
+{
+    float tMin = -1e32f;
+    float tMax = 1e32f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (!isCloseToZero(ray.direction[i]))
+        {
+            float t0 = (bounds.min[i] - ray.origin[i]) / ray.direction[i];
+            float t1 = (bounds.max[i] - ray.origin[i]) / ray.direction[i];
+
+            if (t0 > t1) std::swap(t0, t1);
+            if (tMin < t0) tMin = t0;
+            if (tMax > t1) tMax = t1;
+
+            if (tMin >= tMax || tMax < 0) return 1e38f;
+        }
+    }
+
+    return tMin;
+}
+
+HitInfo rayTriangleIntersect(const Ray& ray, const RTXTriangle& tri, int triIndex)
+{
+    HitInfo hitInfo;
+    hitInfo.didHit = false;
+
+    glm::vec3 a = glm::vec3(tri.a);
+    glm::vec3 e0 = glm::vec3(tri.b) - a;
+    glm::vec3 e1 = glm::vec3(tri.c) - a;
+    glm::vec3 cross01 = glm::cross(e0, e1);
+    float det = -glm::dot(ray.direction, cross01);
+
+    if ((det < 1e-10f && det > -1e-10f) || det < 0)
+        return hitInfo;
+
+    float invDet = 1.0f / det;
+    glm::vec3 ao = ray.origin - a;
+    float dst = glm::dot(ao, cross01) * invDet;
+
+    if (dst <= 0)
+        return hitInfo;
+
+    glm::vec3 dirCrossAO = glm::cross(ray.direction, ao);
+    float u = -glm::dot(e1, dirCrossAO) * invDet;
+    float v = glm::dot(e0, dirCrossAO) * invDet;
+
+    if (u < 0 || v < 0 || 1 - u - v < 0)
+        return hitInfo;
+
+    hitInfo.didHit = true;
+    hitInfo.hitPoint = ray.origin + ray.direction * dst;
+    hitInfo.normal = glm::normalize(cross01);
+    hitInfo.dst = dst;
+    hitInfo.mtlIndex = tri.materialIndex;
+    hitInfo.triangleIndex = triIndex;
+
+    return hitInfo;
+}
+
+// Visibility test towards a point picked on a light, contribution is added to the path's light when nothing blocks it
+struct ShadowRay
+{
+    Ray ray;
+    float maxDst = 0.0f;
+    int lightTriangle = -1; // -1 when no light was sampled
+    glm::vec3 contribution = glm::vec3(0.0f);
+};
+
+// Nodes visited, bounding box and triangle tests of the binary BVH traversals, counted when they get one
+struct TraversalCounts
+{
+    long long rays = 0;
+    long long nodeVisits = 0;
+    long long nodeTests = 0;
+    long long triangleTests = 0;
+};
+
+// Compiling with TRAVERSAL_STATS defined makes closestHit() and occluded() take the binary BVH and count into the
+// calling thread's traversalStats, so the work of whole paths can be measured (see traversalStats.h). Without it they
+// count nothing and keep their SIMD kernels
+#ifdef TRAVERSAL_STATS
+thread_local TraversalCounts traversalStats;
+#endif
+
+class CPUTracer;
+
+// Replacement for the binary BVH traversal of single rays, e.g. the SIMD kernels of wideBVH.h
+typedef HitInfo (*ClosestHitKernel)(const CPUTracer& tracer, const void* bvh, const Ray& ray);
+// Same for occlusion queries, on the same BVH
+typedef bool (*OcclusionKernel)(const CPUTracer& tracer, const void* bvh, const Ray& ray, float tMax, int ignoreTriangle);
+
+class CPUTracer
+{
+public:
+    const std::vector<RTXTriangle>& triangles;
+    const std::vector<Node>& allNodes;
+    const std::vector<Material>& materials;
+    const std::vector<CPUTexture>& textures;
+
+    ClosestHitKernel closestHitKernel = nullptr;
+    OcclusionKernel occlusionKernel = nullptr;
+    const void* closestHitBVH = nullptr;
+
+    // Emissive triangles for next-event estimation, none without them
+    const LightList* lights = nullptr;
+
+    CPUTracer(const std::vector<RTXTriangle>& triangles_, const std::vector<Node>& nodes,
+              const std::vector<Material>& materials_, const std::vector<CPUTexture>& textures_)
+        : triangles(triangles_), allNodes(nodes), materials(materials_), textures(textures_) {}
+
+    glm::vec3 getTriangleTextureColor(const Ray& ray, const RTXTriangle& tri, int textureIndex) const
+    {
+        glm::vec3 a = glm::vec3(tri.a);
+        glm::vec3 e0 = glm::vec3(tri.b) - a;
+        glm::vec3 e1 = glm::vec3(tri.c) - a;
+        glm::vec3 cross01 = glm::cross(e0, e1);
+        float det = -glm::dot(ray.direction, cross01);
+
+        float invDet = 1.0f / det;
+        glm::vec3 ao = ray.origin - a;
+
+        glm::vec3 dirCrossAO = glm::cross(ray.direction, ao);
+        float u = -glm::dot(e1, dirCrossAO) * invDet;
+        float v = glm::dot(e0, dirCrossAO) * invDet;
+        float w = 1.0f - u - v;
+
+        glm::vec2 uv = tri.aTex * u + tri.bTex * v + tri.cTex * w;
+
+        if (textureIndex < 0 || (size_t)textureIndex >= textures.size())
+            return glm::vec3(0.0f, 0.0f, 0.0f);
+
+        return textures[textureIndex].sample(uv);
+    }
+
+    HitInfo calculateRayCollisionBVH(const Ray& ray, TraversalCounts* counts = nullptr) const
+    {
+        int stack[2 * MAX_DEPTH];
+        int stackIndex = 0;
+        stack[stackIndex++] = 0;
+
+        HitInfo result;
+        result.dst = 1e38f;
+        result.didHit = false;
+        if (counts)
+            counts->rays++;
+
+        while (stackIndex > 0)
+        {
+            stackIndex -= 1;
+
+            const Node& node = allNodes[stack[stackIndex]];
+            if (counts)
+                counts->nodeVisits++;
+
+            if (node.childIndex == -1)
+            {
+                if (counts)
+                    counts->triangleTests += node.triangleCount;
+                for (int i = node.triangleIndex; i < node.triangleIndex + node.triangleCount; i++)
+                {
+                    HitInfo hitInfo = rayTriangleIntersect(ray, triangles[i], i);
+                    if (hitInfo.didHit && hitInfo.dst < result.dst)
+                        result = hitInfo;
+                }
+            }
+            else
+            {
+                int childIndexA = node.childIndex;
+                int childIndexB = node.childIndex + 1;
+
+                float dstA = rayBoundsIntersect(ray, allNodes[childIndexA].bounds);
+                float dstB = rayBoundsIntersect(ray, allNodes[childIndexB].bounds);
+                if (counts)
+                    counts->nodeTests += 2;
+
+                bool isNearestA = dstA < dstB;
+                float dstNear = isNearestA ? dstA : dstB;
+                float dstFar  = isNearestA ? dstB : dstA;
+                int childIndexNear = isNearestA ? childIndexA : childIndexB;
+                int childIndexFar  = isNearestA ? childIndexB : childIndexA;
+
+                if (dstFar  < result.dst) stack[stackIndex++] = childIndexFar;
+                if (dstNear < result.dst) stack[stackIndex++] = childIndexNear;
+            }
+        }
+        return result;
+    }
+
+    // Occlusion query: whether any triangle but ignoreTriangle is hit closer than tMax. Unlike the closest hit it
+    // stops at the first one, and never opens nodes beyond tMax
+    bool calculateRayOcclusionBVH(const Ray& ray, float tMax, int ignoreTriangle = -1, TraversalCounts* counts = nullptr) const
+    {
+        int stack[2 * MAX_DEPTH];
+        int stackIndex = 0;
+        stack[stackIndex++] = 0;
+        if (counts)
+            counts->rays++;
+
+        while (stackIndex > 0)
+        {
+            stackIndex -= 1;
+
+            const Node& node = allNodes[stack[stackIndex]];
+            if (counts)
+                counts->nodeVisits++;
+
+            if (node.childIndex == -1)
+            {
+                for (int i = node.triangleIndex; i < node.triangleIndex + node.triangleCount; i++)
+                {
+                    if (counts)
+                        counts->triangleTests++;
+                    HitInfo hitInfo = rayTriangleIntersect(ray, triangles[i], i);
+                    if (hitInfo.didHit && hitInfo.dst < tMax && i != ignoreTriangle)
+                        return true;
+                }
+            }
+            else
+            {
+                int childIndexA = node.childIndex;
+                int childIndexB = node.childIndex + 1;
+
+                float dstA = rayBoundsIntersect(ray, allNodes[childIndexA].bounds);
+                float dstB = rayBoundsIntersect(ray, allNodes[childIndexB].bounds);
+                if (counts)
+                    counts->nodeTests += 2;
+
+                // The nearer child first still finds blockers sooner on average
+                bool isNearestA = dstA < dstB;
+                float dstNear = isNearestA ? dstA : dstB;
+                float dstFar  = isNearestA ? dstB : dstA;
+                int childIndexNear = isNearestA ? childIndexA : childIndexB;
+                int childIndexFar  = isNearestA ? childIndexB : childIndexA;
+
+                if (dstFar  < tMax) stack[stackIndex++] = childIndexFar;
+                if (dstNear < tMax) stack[stackIndex++] = childIndexNear;
+            }
+        }
+        return false;
+    }
+
+    HitInfo closestHit(const Ray& ray) const
+    {
+#ifdef TRAVERSAL_STATS
+        return calculateRayCollisionBVH(ray, &traversalStats);
+#else
+        return closestHitKernel ? closestHitKernel(*this, closestHitBVH, ray) : calculateRayCollisionBVH(ray);
+#endif
+    }
+
+    bool occluded(const Ray& ray, float tMax, int ignoreTriangle = -1) const
+    {
+#ifdef TRAVERSAL_STATS
+        return calculateRayOcclusionBVH(ray, tMax, ignoreTriangle, &traversalStats);
+#else
+        return occlusionKernel ? occlusionKernel(*this, closestHitBVH, ray, tMax, ignoreTriangle) : calculateRayOcclusionBVH(ray, tMax, ignoreTriangle);
+#endif
+    }
+
+    // The sampled light itself doesn't block, nor do surfaces right at the sampled point
+    bool isVisible(const ShadowRay& shadowRay) const
+    {
+        return !occluded(shadowRay.ray, shadowRay.maxDst * 0.999f, shadowRay.lightTriangle);
+    }
+
+    // Solid angle density of picking the point a ray hit on a light with sampleLight() from the ray's origin
+    float lightPdf(const Ray& ray, const HitInfo& lightHit, LightSampler sampler) const
+    {
+        const RTXTriangle& tri = triangles[lightHit.triangleIndex];
+        float cosLight = -glm::dot(ray.direction, lightHit.normal);
+        if (tri.lightIndex < 0 || cosLight <= 0.0f)
+            return 0.0f;
+        return lightProbability(*lights, sampler, ray.origin, tri.lightIndex) / triangleArea(tri) * lightHit.dst * lightHit.dst / cosLight;
+    }
+
+    // Next-event estimation at a diffuse hit: a shadow ray towards a random point of a light picked from the origin of
+    // the bounce ray (the hit point moved off the surface). Its contribution is weighted against the chance that the
+    // cosine weighted bounce finds the same point (power heuristic)
+    void sampleLight(const HitInfo& hitInfo, const glm::vec3& origin, LightSampler sampler, const glm::vec3& albedo, const glm::vec3& rayColor,
+                     PixelSampler& pixelSampler, ShadowRay& shadowRay) const
+    {
+        // Separate statements keep the order of the random numbers the same as in the shader
+        float lightChoice = pixelSampler.sample1D(DIMENSION_LIGHT_CHOICE);
+        glm::vec2 lightPoint = pixelSampler.sample2D(DIMENSION_LIGHT_POINT);
+        float u1 = lightPoint.x;
+        float u2 = lightPoint.y;
+
+        float probability;
+        int triangleIndex = lights->lights[pickLight(*lights, sampler, origin, lightChoice, probability)].triangleIndex;
+        const RTXTriangle& tri = triangles[triangleIndex];
+        glm::vec3 a = glm::vec3(tri.a);
+        glm::vec3 b = glm::vec3(tri.b);
+        glm::vec3 c = glm::vec3(tri.c);
+
+        float su = std::sqrt(u1);
+        glm::vec3 point = a * (1.0f - su) + b * (u2 * su) + c * (su - u2 * su);
+        glm::vec3 toLight = point - hitInfo.hitPoint;
+        float dst2 = glm::dot(toLight, toLight);
+        float dst = std::sqrt(dst2);
+        glm::vec3 direction = toLight / dst;
+
+        float cosSurface = glm::dot(hitInfo.normal, direction);
+        float cosLight = -glm::dot(direction, glm::normalize(glm::cross(b - a, c - a)));
+        if (cosSurface <= 0.0f || cosLight <= 0.0f)
+            return;
+
+        const Material& light = materials[tri.materialIndex];
+        float pdfLight = probability / triangleArea(tri) * dst2 / cosLight;
+        float pdfBounce = cosSurface / PI;
+        float weight = pdfLight * pdfLight / (pdfLight * pdfLight + pdfBounce * pdfBounce);
+
+        shadowRay.ray.origin = hitInfo.hitPoint + hitInfo.normal * 1e-4f;
+        shadowRay.ray.direction = direction;
+        shadowRay.ray.insideGlass = false;
+        shadowRay.maxDst = dst;
+        shadowRay.lightTriangle = triangleIndex;
+        shadowRay.contribution = glm::vec3(light.emissionColor) * light.emissionStrength * rayColor * albedo * (cosSurface / PI * weight / pdfLight);
+    }
+
+    // One bounce of trace(): moves the ray off the surface it hit and scatters it, rayColor takes the attenuation.
+    // Returns false when the path ends there (a light, russian roulette, an unknown material), incomingLight then
+    // holds what the path brought back. bouncePdf is the density of the direction the ray left its last diffuse hit
+    // with (0 after other bounces), for weighting lights it hits against next-event estimation. A diffuse hit before
+    // the last bounce may fill shadowRay, the caller adds its contribution if the light is visible
+    bool scatter(Ray& ray, const HitInfo& hitInfo, const GlobalUniforms& uniforms, int bounce, PixelSampler& pixelSampler, glm::vec3& rayColor, float& bouncePdf,
+                 glm::vec3& incomingLight, ShadowRay& shadowRay) const
+    {
+        const Material& material = materials[hitInfo.mtlIndex];
+        bool nextEvent = uniforms.nextEventEstimation && uniforms.numLights > 0 && lights;
+        // A light found by the last bounce would not be reached by the bounce rays either
+        bool sampleLights = nextEvent && bounce + 1 < uniforms.maxBounceCount;
+        LightSampler sampler = LightSampler(uniforms.lightSampler);
+        shadowRay.lightTriangle = -1;
+        pixelSampler.startBounce(bounce);
+
+        // Weighting a light hit needs the point the ray left
+        Ray incomingRay = ray;
+        if (material.materialType != GLASS)
+            ray.origin = hitInfo.hitPoint - ray.direction * hitInfo.dst * -1e-3f; // Offset intersection above the surface
+        else
+            ray.origin = hitInfo.hitPoint + ray.direction * hitInfo.dst * -1e-3f; // Offset intersection below the surface
+
+        glm::vec3 attenuation = glm::vec3(0.0f);
+
+        switch (material.materialType)
+        {
+            case DIFFUSE:
+            case TEXTURE:
+            {
+                if (sampleLights)
+                    sampleLight(hitInfo, ray.origin, sampler, material.materialType == DIFFUSE ? glm::vec3(material.color) : getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex),
+                        rayColor, pixelSampler, shadowRay);
+
+                ray.direction = cosineHemisphere(hitInfo.normal, pixelSampler.sample2D(DIMENSION_DIRECTION));
+                attenuation = material.materialType == DIFFUSE ? glm::vec3(material.color) : getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex);
+                bouncePdf = nextEvent ? std::max(glm::dot(hitInfo.normal, ray.direction), 0.0f) / PI : 0.0f;
+                break;
+            }
+            case SPECULAR:
+            {
+                glm::vec3 diffuseDirection = cosineHemisphere(hitInfo.normal, pixelSampler.sample2D(DIMENSION_DIRECTION));
+                glm::vec3 specularDirection = glm::reflect(ray.direction, hitInfo.normal);
+                bool isSpecularBounce = material.specularProbability > pixelSampler.sample1D(DIMENSION_LOBE);
+
+                ray.direction = glm::mix(diffuseDirection, specularDirection, isSpecularBounce ? material.smoothness : 0.0f);
+                attenuation = isSpecularBounce ? glm::vec3(1.0f) : glm::vec3(material.color);
+                bouncePdf = 0.0f;
+                break;
+            }
+            case LIGHT:
+            {
+                glm::vec3 emittedLight = glm::vec3(material.emissionColor) * material.emissionStrength;
+                float weight = 1.0f;
+                if (nextEvent && bouncePdf > 0.0f)
+                {
+                    float pdfLight = lightPdf(incomingRay, hitInfo, sampler);
+                    weight = bouncePdf * bouncePdf / (bouncePdf * bouncePdf + pdfLight * pdfLight);
+                }
+                incomingLight += emittedLight * rayColor * weight;
+                return false;
+            }
+            case CHECKER:
+            {
+                bool isBlackChecker = material.checkerScale > 0.0f
+                    && (std::fmod(std::floor(ray.origin.x * material.checkerScale)
+                    + std::floor(ray.origin.y * material.checkerScale)
+                    + std::floor(ray.origin.z * material.checkerScale), 2.0f) == 0);
+
+                if (sampleLights && !isBlackChecker)
+                    sampleLight(hitInfo, ray.origin, sampler, glm::vec3(1.0f), rayColor, pixelSampler, shadowRay);
+
+                ray.direction = cosineHemisphere(hitInfo.normal, pixelSampler.sample2D(DIMENSION_DIRECTION));
+                attenuation = isBlackChecker ? glm::vec3(0.0f) : glm::vec3(1.0f);
+                bouncePdf = nextEvent ? std::max(glm::dot(hitInfo.normal, ray.direction), 0.0f) / PI : 0.0f;
+                break;
+            }
+            case GLASS:
+            {
+                float refractiveIndex = ray.insideGlass ? material.refractiveIndex : 1.0f / material.refractiveIndex;
+                bool isRefracted;
+                ray.direction = refract_(ray.direction, hitInfo.normal, refractiveIndex, isRefracted);
+                ray.insideGlass = isRefracted != ray.insideGlass;
+                attenuation = glm::vec3(material.color);
+                bouncePdf = 0.0f;
+                break;
+            }
+            default:
+                incomingLight = glm::vec3(0.0f);
+                return false;
+        }
+        rayColor *= attenuation;
+        // A simple optimization
+        float p = std::max(rayColor.r, std::max(rayColor.g, rayColor.b));
+        if (pixelSampler.sample1D(DIMENSION_ROULETTE) > p)
+            return false;
+        rayColor *= 1.0f / p;
+        return true;
+    }
+
+    // The end of a path that left the scene
+    void miss(const Ray& ray, const GlobalUniforms& uniforms, const glm::vec3& rayColor, glm::vec3& incomingLight) const
+    {
+        if (uniforms.environmentalLight)
+            incomingLight += getEnvironmentalLight(ray) * rayColor;
+    }
+
+    // firstHit lets a caller that already intersected the camera ray (e.g. as part of a ray packet) skip the first traversal
+    glm::vec3 trace(Ray ray, PixelSampler& pixelSampler, const GlobalUniforms& uniforms, const HitInfo* firstHit = nullptr) const
+    {
+        glm::vec3 rayColor = glm::vec3(1.0f);
+        glm::vec3 incomingLight = glm::vec3(0.0f);
+        float bouncePdf = 0.0f;
+        ShadowRay shadowRay;
+
+        for (int i = 0; i < uniforms.maxBounceCount; i++)
+        {
+            HitInfo hitInfo = (i == 0 && firstHit) ? *firstHit : closestHit(ray);
+            if (hitInfo.didHit)
+            {
+                bool keepGoing = scatter(ray, hitInfo, uniforms, i, pixelSampler, rayColor, bouncePdf, incomingLight, shadowRay);
+                if (shadowRay.lightTriangle >= 0 && isVisible(shadowRay))
+                    incomingLight += shadowRay.contribution;
+                if (!keepGoing)
+                    break;
+            }
+            else
+            {
+                miss(ray, uniforms, rayColor, incomingLight);
+                break;
+            }
+        }
+
+        return incomingLight;
+    }
+
+    glm::vec3 traceBasic(Ray ray, const GlobalUniforms& uniforms, const HitInfo* firstHit = nullptr) const
+    {
+        glm::vec3 colorCumulative = glm::vec3(0.0f);
+        int bounceLimit = 20;
+        int bounceCount = 0;
+
+        for (int i = 0; i < bounceLimit; i++)
+        {
+            bounceCount++;
+            HitInfo hitInfo = (i == 0 && firstHit) ? *firstHit : closestHit(ray);
+
+            if (hitInfo.didHit)
+            {
+                ray.origin = hitInfo.hitPoint - hitInfo.normal * 1e-4f; // Offset intersection above the surface
+                const Material& material = materials[hitInfo.mtlIndex];
+                switch (material.materialType)
+                {
+                case SPECULAR:
+                    colorCumulative += glm::vec3(material.color);
+                    ray.direction = glm::reflect(ray.direction, hitInfo.normal);
+                    break;
+                case DIFFUSE:
+                case TEXTURE:
+                case CHECKER:
+                {
+                    glm::vec3 color;
+                    if (material.materialType == TEXTURE)
+                        color = getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex);
+                    else if (material.materialType == DIFFUSE)
+                        color = glm::vec3(material.color);
+                    else
+                    {
+                        bool isBlackChecker = material.checkerScale > 0.0f
+                            && (std::fmod(std::floor(ray.origin.x * material.checkerScale)
+                            + std::floor(ray.origin.y * material.checkerScale)
+                            + std::floor(ray.origin.z * material.checkerScale), 2.0f) == 0);
+                        color = isBlackChecker ? glm::vec3(0.0f) : glm::vec3(1.0f);
+                    }
+
+                    colorCumulative += color;
+
+                    if (uniforms.basicShadingShadow)
+                    {
+                        Ray rayToLight;
+                        rayToLight.origin = ray.origin;
+                        glm::vec3 toLight = glm::vec3(uniforms.basicShadingLightPosition) - hitInfo.hitPoint;
+                        rayToLight.direction = glm::normalize(toLight);
+                        bool inShadow = occluded(rayToLight, glm::length(toLight));
+                        return (inShadow ? colorCumulative / 5.0f : colorCumulative) / float(bounceCount);
+                    }
+                    else
+                        return colorCumulative / float(bounceCount);
+                }
+                case LIGHT:
+                    return glm::vec3(0.0f, 1.0f, 1.0f);
+                case GLASS:
+                {
+                    float refractiveIndex = ray.insideGlass ? material.refractiveIndex : 1.0f / material.refractiveIndex;
+                    bool isRefracted;
+                    ray.direction = refract_(ray.direction, hitInfo.normal, refractiveIndex, isRefracted);
+                    ray.insideGlass = isRefracted != ray.insideGlass;
+                    colorCumulative = glm::vec3(material.color);
+                    break;
+                }
+                default:
+                    return glm::vec3(1.0f, 0.0f, 1.0f);
+                }
+            }
+            else
+            {
+                colorCumulative += getEnvironmentalLight(ray);
+                break;
+            }
+        }
+
+        return colorCumulative / float(bounceCount);
+    }
+
+    // The samples of a texel for the frame, they continue where the previous frames stopped
+    PixelSampler pixelSampler(const GlobalUniforms& uniforms, int texelX, int texelY) const
+    {
+        uint32_t pixelIndex = texelX + texelY * static_cast<int>(uniforms.width);
+        PixelSampler sampler;
+        sampler.type = uniforms.samplerType;
+        sampler.seedHash = hashInt(uniforms.seed); // 0 for seed 0
+        sampler.rngState = pixelIndex + uniforms.frameIndex * 968824447u + sampler.seedHash;
+        sampler.pixelHash = hashInt(pixelIndex ^ sampler.seedHash);
+        sampler.pixelX = texelX;
+        sampler.pixelY = texelY;
+        sampler.nextSampleIndex = uniforms.frameIndex * uint32_t(uniforms.numRaysPerPixel);
+        return sampler;
+    }
+
+    // Ray through the center of the texel, used by basic shading
+    Ray generateCenterRay(const GlobalUniforms& uniforms, int texelX, int texelY) const
+    {
+        int width = static_cast<int>(uniforms.width);
+        int height = static_cast<int>(uniforms.height);
+        float x = float(texelX * 2 - width) / width;
+        float y = float(texelY * 2 - height) / height;
+
+        Ray ray;
+        ray.origin = glm::vec3(uniforms.cameraPos);
+        ray.direction = glm::normalize(glm::vec3(uniforms.viewportFront) + glm::vec3(uniforms.viewportRight) * x + glm::vec3(uniforms.viewportUp) * y);
+        return ray;
+    }
+
+    // Jittered ray through the texel, starting from a random point of the defocus disk. Starts the next sample of the
+    // texel
+    Ray generateCameraRay(const GlobalUniforms& uniforms, int texelX, int texelY, PixelSampler& pixelSampler) const
+    {
+        int width = static_cast<int>(uniforms.width);
+        int height = static_cast<int>(uniforms.height);
+        float x = float(texelX * 2 - width) / width;
+        float y = float(texelY * 2 - height) / height;
+
+        glm::vec3 cameraPos = glm::vec3(uniforms.cameraPos);
+        glm::vec3 endPoint = cameraPos + glm::vec3(uniforms.viewportFront) + glm::vec3(uniforms.viewportRight) * x + glm::vec3(uniforms.viewportUp) * y;
+
+        // Separate statements keep the order of the random numbers the same as in the shader
+        pixelSampler.startSample();
+        glm::vec2 jitter = pixelSampler.cameraSample2D(DIMENSION_PIXEL) - 0.5f;
+        glm::vec2 lensPoint = concentricDisk(pixelSampler.cameraSample2D(DIMENSION_LENS));
+        float jitterRight = jitter.x;
+        float jitterUp = jitter.y;
+
+        Ray rayJittered;
+        rayJittered.origin = cameraPos + glm::vec3(uniforms.defocusDiskRight) * lensPoint.x + glm::vec3(uniforms.defocusDiskUp) * lensPoint.y;
+        glm::vec3 endPointJittered = endPoint + glm::vec3(uniforms.pixelRight) * jitterRight + glm::vec3(uniforms.pixelUp) * jitterUp;
+        rayJittered.direction = glm::normalize(endPointJittered - rayJittered.origin);
+        rayJittered.insideGlass = false;
+        return rayJittered;
+    }
+
+    // Equivalent of main() in compute.glsl, texel coordinates have their origin at the bottom left like in OpenGL
+    glm::vec3 renderPixel(const GlobalUniforms& uniforms, int texelX, int texelY) const
+    {
+        if (uniforms.basicShading)
+            return traceBasic(generateCenterRay(uniforms, texelX, texelY), uniforms);
+
+        PixelSampler sampler = pixelSampler(uniforms, texelX, texelY);
+        glm::vec3 colorCumulative = glm::vec3(0.0f);
+
+        for (int i = 0; i < uniforms.numRaysPerPixel; i++)
+            colorCumulative += trace(generateCameraRay(uniforms, texelX, texelY, sampler), sampler, uniforms);
+
+        return colorCumulative / float(uniforms.numRaysPerPixel);
+    }
+
+    // Albedo, normal and distance of the first surface seen through the texel center, the guides of the denoiser.
+    // A miss has a zero normal and depth, lights have a white albedo so their color stays in the illumination
+    void firstHitFeatures(const GlobalUniforms& uniforms, int texelX, int texelY, glm::vec3& albedo, glm::vec3& normal, float& depth) const
+    {
+        Ray ray = generateCenterRay(uniforms, texelX, texelY);
+        HitInfo hitInfo = closestHit(ray);
+
+        albedo = glm::vec3(1.0f);
+        normal = glm::vec3(0.0f);
+        depth = 0.0f;
+        if (!hitInfo.didHit)
+            return;
+
+        normal = hitInfo.normal;
+        depth = hitInfo.dst;
+
+        const Material& material = materials[hitInfo.mtlIndex];
+        switch (material.materialType)
+        {
+            case DIFFUSE:
+            case SPECULAR:
+            case GLASS:
+                albedo = glm::vec3(material.color);
+                break;
+            case TEXTURE:
+                albedo = getTriangleTextureColor(ray, triangles[hitInfo.triangleIndex], material.textureIndex);
+                break;
+            case CHECKER:
+            {
+                bool isBlackChecker = material.checkerScale > 0.0f
+                    && (std::fmod(std::floor(hitInfo.hitPoint.x * material.checkerScale)
+                    + std::floor(hitInfo.hitPoint.y * material.checkerScale)
+                    + std::floor(hitInfo.hitPoint.z * material.checkerScale), 2.0f) == 0);
+                albedo = isBlackChecker ? glm::vec3(0.0f) : glm::vec3(1.0f);
+                break;
+            }
+        }
+    }
+};
+
+// Everything the CPU tracer reads, loaded the same way the interactive renderer loads its scene
+struct CPUScene
+{
+    std::vector<RTXTriangle> rtxTriangles;
+    std::vector<BVHTriangle> bvhTriangles;
+    std::vector<Material> materials;
+    std::vector<CPUTexture> textures;
+    std::vector<Node> nodes;
+    LightList lights;
+
+    CPUTracer tracer() const
+    {
+        CPUTracer tracer(rtxTriangles, nodes, materials, textures);
+        tracer.lights = &lights;
+        return tracer;
+    }
+};
+
+std::string resolveDataFolder(const RenderSettings& settings)
+{
+    return settings.dataFolder.empty() ? getPath("Data", 1) : toNativePath(settings.dataFolder);
+}
+
+// The model is looked up as a folder relative to the working directory first, then inside the data folder
+std::string resolveModelFolder(const RenderSettings& settings)
+{
+    fs::path modelPath = toNativePath(settings.model);
+    if (fs::is_directory(modelPath))
+        return modelPath.string();
+
+    return (fs::path(resolveDataFolder(settings)) / modelPath).string();
+}
+
+// Where the time of loadCPUScene() goes
+struct SceneLoadTimings
+{
+    float meshSeconds = 0.0f; // OBJ, materials and textures
+    float bvhSeconds = 0.0f;
+    float lightSeconds = 0.0f; // Alias table and light BVH
+};
+
+void loadCPUScene(const RenderSettings& settings, CPUScene& scene, SceneLoadTimings* timings = nullptr)
+{
+    auto lap = [](std::chrono::steady_clock::time_point& start)
+    {
+        auto now = std::chrono::steady_clock::now();
+        float seconds = std::chrono::duration<float>(now - start).count();
+        start = now;
+        return seconds;
+    };
+    auto start = std::chrono::steady_clock::now();
+    SceneLoadTimings ignored;
+    SceneLoadTimings& times = timings ? *timings : ignored;
+
+    std::vector<std::string> texturePaths;
+    getTrianglesData_(resolveModelFolder(settings), scene.rtxTriangles, scene.bvhTriangles, scene.materials, texturePaths);
+
+    for (const std::string& texturePath : texturePaths)
+        scene.textures.push_back(CPUTexture(texturePath));
+
+    if (settings.cornellBox || settings.skyLight)
+    {
+        Material mat;
+        mat.makeLight(glm::vec3(1.0f), settings.cornellLightBrightness);
+        scene.materials.push_back(mat);
+    }
+    if (settings.cornellBox)
+        addCornellBox(scene.rtxTriangles, scene.bvhTriangles, settings.cornellLightSize, settings.cornellPadding, scene.materials.size() - 1);
+    if (settings.skyLight)
+        addSkyLightPlane(scene.rtxTriangles, scene.bvhTriangles, scene.materials.size() - 1);
+    times.meshSeconds = lap(start);
+
+    BVH bvh(scene.bvhTriangles, scene.rtxTriangles);
+    scene.nodes = bvh.allNodes;
+    times.bvhSeconds = lap(start);
+
+    // After the BVH reordered the triangles, the list holds their indices
+    scene.lights = buildLightList(scene.rtxTriangles, scene.materials);
+    times.lightSeconds = lap(start);
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/simd.h>
+
+// Edge-avoiding à-trous wavelet denoiser (Dammertz et al. 2010). Every iteration blurs the image with a 5x5 B3 spline
+// kernel whose taps are spread 2^i pixels apart, so five iterations cover a 125 pixel wide footprint with only 25
+// taps each. A tap's weight falls off with the difference in brightness, normal and depth to the center pixel, which
+// keeps the blur from crossing edges. The color is divided by the first hit's albedo before filtering and multiplied
+// back at the end, so textures stay sharp while the lighting gets smoothed.
+//
+// The same filter, with the same weights, runs on the GPU in Assets/Shaders/denoise.glsl.
+
+struct FeatureBuffers
+{
+    std::vector<glm::vec3> albedo;
+    std::vector<glm::vec3> normal; // Zero where the camera ray missed
+    std::vector<float> depth;
+};
+
+struct DenoiseSettings
+{
+    int iterations = 5;
+    float colorSigma = 16.0f; // Brightness difference at which a tap's weight has dropped to about a third, halved every iteration
+    float depthSigma = 0.05f; // Relative depth difference per pixel of tap distance with the same falloff
+};
+
+// The normal weight is the dot product of the normals to this power
+const int DENOISE_NORMAL_POWER = 128;
+
+// Planes of one image, every channel on its own so SIMD loads take neighbouring pixels
+struct DenoisePlanes
+{
+    std::vector<float> r, g, b;
+
+    void resize(size_t size)
+    {
+        r.resize(size);
+        g.resize(size);
+        b.resize(size);
+    }
+};
+
+struct AtrousPass
+{
+    int width;
+    int height;
+    int step;
+    float colorSigma;
+    float depthSigma;
+
+    const DenoisePlanes* input;
+    DenoisePlanes* output;
+    const float* normalX;
+    const float* normalY;
+    const float* normalZ;
+    const float* depth;
+};
+
+// Falloff of the edge-stopping weights: 1 / (the Taylor series of exp(x) to x^4), for x >= 0. Positive and falling like
+// exp(-x) without calling exp(), though it falls slower (0.061 instead of 0.050 at 3). denoise.glsl uses the same one
+template <typename SimdT>
+SimdT expNegative(const SimdT& x)
+{
+    SimdT one(1.0f);
+    return one / (one + x * (one + x * (SimdT(0.5f) + x * (SimdT(1.0f / 6.0f) + x * SimdT(1.0f / 24.0f)))));
+}
+
+template <typename SimdT>
+SimdT absolute(const SimdT& x)
+{
+    return max(x, SimdT(0.0f) - x);
+}
+
+// Filters SimdT::width pixels of a row starting at x. Vectors must have all their taps inside the row, single pixels
+// skip the taps that fall outside
+template <typename SimdT>
+void atrousPixels(const AtrousPass& pass, int x, int y)
+{
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    const DenoisePlanes& in = *pass.input;
+    int center = y * pass.width + x;
+
+    SimdT r = SimdT::load(&in.r[center]);
+    SimdT g = SimdT::load(&in.g[center]);
+    SimdT b = SimdT::load(&in.b[center]);
+    SimdT luminance = r * SimdT(0.2126f) + g * SimdT(0.7152f) + b * SimdT(0.0722f);
+    SimdT nx = SimdT::load(pass.normalX + center);
+    SimdT ny = SimdT::load(pass.normalY + center);
+    SimdT nz = SimdT::load(pass.normalZ + center);
+    SimdT depth = SimdT::load(pass.depth + center);
+
+    SimdT invColorSigma(1.0f / pass.colorSigma);
+    SimdT invDepthScale = SimdT(1.0f) / (depth * SimdT(pass.depthSigma * pass.step) + SimdT(1e-4f));
+
+    SimdT sumR(0.0f), sumG(0.0f), sumB(0.0f), sumWeight(0.0f);
+    for (int dy = -2; dy <= 2; dy++)
+    {
+        int tapY = y + dy * pass.step;
+        if (tapY < 0 || tapY >= pass.height)
+            continue;
+
+        for (int dx = -2; dx <= 2; dx++)
+        {
+            int tapX = x + dx * pass.step;
+            if (SimdT::width == 1 && (tapX < 0 || tapX >= pass.width))
+                continue;
+
+            int tap = tapY * pass.width + tapX;
+            SimdT tapR = SimdT::load(&in.r[tap]);
+            SimdT tapG = SimdT::load(&in.g[tap]);
+            SimdT tapB = SimdT::load(&in.b[tap]);
+
+            SimdT weight(kernel[dx + 2] * kernel[dy + 2]);
+            if (dx != 0 || dy != 0)
+            {
+                SimdT tapLuminance = tapR * SimdT(0.2126f) + tapG * SimdT(0.7152f) + tapB * SimdT(0.0722f);
+                SimdT colorWeight = expNegative(absolute(luminance - tapLuminance) * invColorSigma);
+
+                SimdT cosine = max(SimdT(0.0f), nx * SimdT::load(pass.normalX + tap) + ny * SimdT::load(pass.normalY + tap) + nz * SimdT::load(pass.normalZ + tap));
+                SimdT normalWeight = cosine;
+                for (int power = 1; power < DENOISE_NORMAL_POWER; power *= 2)
+                    normalWeight = normalWeight * normalWeight;
+
+                SimdT depthWeight = expNegative(absolute(depth - SimdT::load(pass.depth + tap)) * invDepthScale);
+                weight = weight * colorWeight * normalWeight * depthWeight;
+            }
+
+            sumR = sumR + tapR * weight;
+            sumG = sumG + tapG * weight;
+            sumB = sumB + tapB * weight;
+            sumWeight = sumWeight + weight;
+        }
+    }
+
+    (sumR / sumWeight).store(&pass.output->r[center]);
+    (sumG / sumWeight).store(&pass.output->g[center]);
+    (sumB / sumWeight).store(&pass.output->b[center]);
+}
+
+template <typename SimdT>
+void atrousRowsSimd(const AtrousPass& pass, int rowBegin, int rowEnd)
+{
+    const int N = SimdT::width;
+    int border = 2 * pass.step;
+
+    for (int y = rowBegin; y < rowEnd; y++)
+    {
+        int x = 0;
+        for (; x < std::min(border, pass.width); x++)
+            atrousPixels<SimdFloat1>(pass, x, y);
+        for (; x + N - 1 < pass.width - border; x += N)
+            atrousPixels<SimdT>(pass, x, y);
+        for (; x < pass.width; x++)
+            atrousPixels<SimdFloat1>(pass, x, y);
+    }
+}
+
+void atrousRows1(const AtrousPass& pass, int rowBegin, int rowEnd) { atrousRowsSimd<SimdFloat1>(pass, rowBegin, rowEnd); }
+#ifdef SIMD_SSE
+void atrousRows4(const AtrousPass& pass, int rowBegin, int rowEnd) { atrousRowsSimd<SimdFloat4>(pass, rowBegin, rowEnd); }
+#endif
+#ifdef SIMD_AVX2
+SIMD_TARGET_AVX2 void atrousRows8(const AtrousPass& pass, int rowBegin, int rowEnd) { atrousRowsSimd<SimdFloat8>(pass, rowBegin, rowEnd); }
+#endif
+#ifdef SIMD_AVX512
+SIMD_TARGET_AVX512 void atrousRows16(const AtrousPass& pass, int rowBegin, int rowEnd) { atrousRowsSimd<SimdFloat16>(pass, rowBegin, rowEnd); }
+#endif
+
+// simdWidth has to be a width returned by supportedSimdWidth(), image is filtered in place
+void denoise(int simdWidth, int numThreads, int width, int height, const FeatureBuffers& features, const DenoiseSettings& settings, std::vector<glm::vec3>& image)
+{
+    void (*atrousRows)(const AtrousPass&, int, int) = atrousRows1;
+    switch (simdWidth)
+    {
+#ifdef SIMD_AVX512
+        case 16: atrousRows = atrousRows16; break;
+#endif
+#ifdef SIMD_AVX2
+        case 8: atrousRows = atrousRows8; break;
+#endif
+#ifdef SIMD_SSE
+        case 4: atrousRows = atrousRows4; break;
+#endif
+        default: break;
+    }
+
+    size_t size = static_cast<size_t>(width) * height;
+    std::vector<float> normalX(size), normalY(size), normalZ(size);
+    DenoisePlanes planes[2];
+    planes[0].resize(size);
+    planes[1].resize(size);
+
+    // Demodulate, only the lighting gets filtered
+    for (size_t i = 0; i < size; i++)
+    {
+        glm::vec3 illumination = image[i] / glm::max(features.albedo[i], glm::vec3(1e-3f));
+        planes[0].r[i] = illumination.r;
+        planes[0].g[i] = illumination.g;
+        planes[0].b[i] = illumination.b;
+        normalX[i] = features.normal[i].x;
+        normalY[i] = features.normal[i].y;
+        normalZ[i] = features.normal[i].z;
+    }
+
+    numThreads = std::max(1, std::min(numThreads, height));
+    for (int iteration = 0; iteration < settings.iterations; iteration++)
+    {
+        AtrousPass pass;
+        pass.width = width;
+        pass.height = height;
+        pass.step = 1 << iteration;
+        pass.colorSigma = settings.colorSigma / float(1 << iteration);
+        pass.depthSigma = settings.depthSigma;
+        pass.input = &planes[iteration % 2];
+        pass.output = &planes[(iteration + 1) % 2];
+        pass.normalX = normalX.data();
+        pass.normalY = normalY.data();
+        pass.normalZ = normalZ.data();
+        pass.depth = features.depth.data();
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; i++)
+            threads.push_back(std::thread(atrousRows, std::cref(pass), height * i / numThreads, height * (i + 1) / numThreads));
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    const DenoisePlanes& result = planes[settings.iterations % 2];
+    for (size_t i = 0; i < size; i++)
+        image[i] = glm::vec3(result.r[i], result.g[i], result.b[i]) * glm::max(features.albedo[i], glm::vec3(1e-3f));
+}
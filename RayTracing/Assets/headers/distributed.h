@@ -0,0 +1,524 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <tuple>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include <profiling/traceRecorder.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+#include <csignal>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+// Splits a render over worker processes, on this machine or others. The coordinator listens on a TCP port and sends
+// every worker that connects the scene file it renders, the worker loads the scene from its own data folder and then
+// renders one job (a rectangle of the image and a range of its frames) after another and sends the colors back, already
+// divided by the frame count of the whole render so the coordinator only has to add them to the image. A job whose
+// worker dies or stops answering goes back to the queue, and while no worker is connected the coordinator renders the
+// jobs itself. Messages are sent in the byte order of the machine, the hosts have to share it.
+//
+//   worker -> coordinator: magic, version
+//   coordinator -> worker: scene text (length, characters)
+//   worker -> coordinator: DISTRIBUTED_DONE once the scene is loaded, DISTRIBUTED_FAILED when it could not be loaded
+//   coordinator -> worker: job, a job of width 0 ends the worker
+//   worker -> coordinator: DISTRIBUTED_DONE, the same job, width * height colors
+//
+// While it loads the scene or renders a job the worker sends DISTRIBUTED_ALIVE every DISTRIBUTED_HEARTBEAT_SECONDS,
+// so the coordinator's timeout only has to cover the silence between two of them, not the longest job.
+
+const uint32_t DISTRIBUTED_MAGIC = 0x57545952; // "RYTW"
+const uint32_t DISTRIBUTED_VERSION = 2;
+const uint32_t DISTRIBUTED_FAILED = 0;
+const uint32_t DISTRIBUTED_DONE = 1;
+const uint32_t DISTRIBUTED_ALIVE = 2;
+const float DISTRIBUTED_HEARTBEAT_SECONDS = 1.0f;
+const uint32_t MAX_SCENE_TEXT_LENGTH = 1 << 24;
+
+struct RenderJob
+{
+    int32_t x = 0;
+    int32_t y = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t firstFrame = 0;
+    int32_t numFrames = 0;
+
+    bool operator==(const RenderJob& other) const
+    {
+        return x == other.x && y == other.y && width == other.width && height == other.height
+            && firstFrame == other.firstFrame && numFrames == other.numFrames;
+    }
+
+    // Whether the job covers pixels and frames of whole, the job of the entire render
+    bool isInside(const RenderJob& whole) const
+    {
+        return width > 0 && height > 0 && numFrames > 0 && x >= whole.x && y >= whole.y && firstFrame >= whole.firstFrame
+            && static_cast<int64_t>(x) + width <= static_cast<int64_t>(whole.x) + whole.width
+            && static_cast<int64_t>(y) + height <= static_cast<int64_t>(whole.y) + whole.height
+            && static_cast<int64_t>(firstFrame) + numFrames <= static_cast<int64_t>(whole.firstFrame) + whole.numFrames;
+    }
+};
+
+// Renders the job into colors, width * height of them, top row first
+typedef std::function<void(const RenderJob& job, std::vector<glm::vec3>& colors)> RenderJobFunction;
+
+struct DistributedStats
+{
+    int workers = 0;   // Workers that connected
+    int lostJobs = 0;  // Jobs handed out again after their worker died or timed out
+    int localJobs = 0; // Jobs the coordinator rendered itself while no worker was connected
+};
+
+bool initSockets()
+{
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    // A worker that disconnects makes send() fail instead of killing the coordinator
+    std::signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+void closeSocket(SocketHandle socketHandle)
+{
+#ifdef _WIN32
+    closesocket(socketHandle);
+#else
+    close(socketHandle);
+#endif
+}
+
+bool sendAll(SocketHandle socketHandle, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        int sent = send(socketHandle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool receiveAll(SocketHandle socketHandle, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        int received = recv(socketHandle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+// A receive that takes longer fails, 0 waits forever
+void setReceiveTimeout(SocketHandle socketHandle, float seconds)
+{
+#ifdef _WIN32
+    DWORD milliseconds = static_cast<DWORD>(seconds * 1000.0f);
+    setsockopt(socketHandle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&milliseconds), sizeof(milliseconds));
+#else
+    timeval timeout;
+    timeout.tv_sec = static_cast<long>(seconds);
+    timeout.tv_usec = static_cast<long>((seconds - timeout.tv_sec) * 1e6f);
+    setsockopt(socketHandle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+// Receives the next status of a worker, skipping its heartbeats, so the receive timeout applies to each of them
+bool receiveStatus(SocketHandle socketHandle, uint32_t& status)
+{
+    do
+    {
+        if (!receiveAll(socketHandle, &status, sizeof(status)))
+            return false;
+    } while (status == DISTRIBUTED_ALIVE);
+    return true;
+}
+
+// Sends DISTRIBUTED_ALIVE every DISTRIBUTED_HEARTBEAT_SECONDS until it is destroyed, which waits for the heartbeat
+// being sent so the connection is free again
+class Heartbeat
+{
+public:
+    explicit Heartbeat(SocketHandle socketHandle)
+    {
+        thread = std::thread([this, socketHandle]()
+        {
+            setTraceThreadName("heartbeat");
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!changed.wait_for(lock, std::chrono::duration<float>(DISTRIBUTED_HEARTBEAT_SECONDS), [&]() { return stopping; }))
+                if (!sendAll(socketHandle, &DISTRIBUTED_ALIVE, sizeof(DISTRIBUTED_ALIVE)))
+                    return;
+        });
+    }
+
+    ~Heartbeat()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+};
+
+// Jobs are small messages, they should not wait for more data to fill a packet
+void setNoDelay(SocketHandle socketHandle)
+{
+    int enable = 1;
+    setsockopt(socketHandle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+}
+
+bool waitReadable(SocketHandle socketHandle, int milliseconds)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(socketHandle, &readable);
+    timeval timeout;
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+    return select(static_cast<int>(socketHandle) + 1, &readable, nullptr, nullptr, &timeout) > 0;
+}
+
+SocketHandle listenOn(int port)
+{
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET_HANDLE)
+        return INVALID_SOCKET_HANDLE;
+
+    // Lets the coordinator be restarted right away on the same port
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        closeSocket(listener);
+        return INVALID_SOCKET_HANDLE;
+    }
+    return listener;
+}
+
+SocketHandle connectTo(const std::string& host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        return INVALID_SOCKET_HANDLE;
+
+    SocketHandle connection = INVALID_SOCKET_HANDLE;
+    for (addrinfo* address = addresses; address && connection == INVALID_SOCKET_HANDLE; address = address->ai_next)
+    {
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection != INVALID_SOCKET_HANDLE && connect(connection, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0)
+        {
+            closeSocket(connection);
+            connection = INVALID_SOCKET_HANDLE;
+        }
+    }
+    freeaddrinfo(addresses);
+    return connection;
+}
+
+// Hands the jobs to the workers that connect on port and adds their colors to image (imageWidth pixels wide), renders
+// jobs with renderLocal while no worker has been connected for workerWait seconds. A worker that sends nothing, not
+// even a heartbeat, for workerTimeout seconds counts as dead. Jobs of the same rectangle are added in the order they have in jobs,
+// whatever order they finish in, so the float sums and the image are the same every run.
+bool coordinateRender(int port, const std::string& sceneText, const std::vector<RenderJob>& jobs, int imageWidth,
+    float workerTimeout, float workerWait, const RenderJobFunction& renderLocal, std::vector<glm::vec3>& image, DistributedStats& stats)
+{
+    stats = DistributedStats();
+    if (!initSockets())
+        return false;
+    SocketHandle listener = listenOn(port);
+    if (listener == INVALID_SOCKET_HANDLE)
+    {
+        std::cerr << "Cannot listen on port " << port << std::endl;
+        return false;
+    }
+    std::cout << "Waiting for workers on port " << port << "..." << std::endl;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    int numJobs = static_cast<int>(jobs.size());
+    std::deque<int> pending; // Indices into jobs
+    for (int i = 0; i < numJobs; i++)
+        pending.push_back(i);
+    int numDone = 0;
+    int numLive = 0;
+    auto lastWorkerSeen = std::chrono::steady_clock::now();
+
+    // The next job of the same rectangle, -1 after the last one. A job's colors wait in results until the jobs of its
+    // rectangle before it have been added
+    std::vector<int> nextOfRectangle(numJobs, -1);
+    std::vector<bool> waitsForEarlier(numJobs, false);
+    std::map<std::tuple<int, int, int, int>, int> lastOfRectangle;
+    for (int i = 0; i < numJobs; i++)
+    {
+        auto inserted = lastOfRectangle.insert({ std::make_tuple(jobs[i].x, jobs[i].y, jobs[i].width, jobs[i].height), i });
+        if (!inserted.second)
+        {
+            nextOfRectangle[inserted.first->second] = i;
+            waitsForEarlier[i] = true;
+            inserted.first->second = i;
+        }
+    }
+    std::vector<std::vector<glm::vec3>> results(numJobs);
+    std::vector<bool> finished(numJobs, false);
+
+    // Called with the mutex held
+    auto merge = [&](int index, std::vector<glm::vec3>& colors)
+    {
+        results[index].swap(colors);
+        finished[index] = true;
+        for (int i = index; i >= 0 && finished[i] && !waitsForEarlier[i]; i = nextOfRectangle[i])
+        {
+            const RenderJob& job = jobs[i];
+            for (int y = 0; y < job.height; y++)
+                for (int x = 0; x < job.width; x++)
+                    image[(job.y + y) * imageWidth + job.x + x] += results[i][y * job.width + x];
+            std::vector<glm::vec3>().swap(results[i]);
+            if (nextOfRectangle[i] >= 0)
+                waitsForEarlier[nextOfRectangle[i]] = false;
+        }
+
+        numDone++;
+        if (numDone * 10 / numJobs != (numDone - 1) * 10 / numJobs)
+            std::cout << "Rendered " << numDone * 100 / numJobs << "%" << std::endl;
+        changed.notify_all();
+    };
+
+    auto serveWorker = [&](SocketHandle connection, int id)
+    {
+        setTraceThreadName("worker " + std::to_string(id));
+        setReceiveTimeout(connection, workerTimeout);
+        setNoDelay(connection);
+
+        uint32_t hello[2] = { 0, 0 };
+        uint32_t sceneLength = static_cast<uint32_t>(sceneText.size());
+        uint32_t loaded = DISTRIBUTED_FAILED;
+        bool alive = receiveAll(connection, hello, sizeof(hello)) && hello[0] == DISTRIBUTED_MAGIC && hello[1] == DISTRIBUTED_VERSION
+            && sendAll(connection, &sceneLength, sizeof(sceneLength)) && sendAll(connection, sceneText.data(), sceneText.size())
+            && receiveStatus(connection, loaded) && loaded == DISTRIBUTED_DONE;
+        if (!alive)
+            std::cerr << "Worker " << id << " failed to start" << std::endl;
+
+        std::vector<glm::vec3> colors;
+        while (alive)
+        {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Jobs of a worker that dies come back to the queue, so idle workers wait for the render to finish
+                changed.wait(lock, [&]() { return !pending.empty() || numDone == numJobs; });
+                if (pending.empty())
+                    break;
+                index = pending.front();
+                pending.pop_front();
+            }
+            const RenderJob& job = jobs[index];
+
+            TraceScope scope("job", "distributed", static_cast<long long>(job.width) * job.height * job.numFrames);
+            RenderJob answer;
+            uint32_t status = DISTRIBUTED_FAILED;
+            colors.resize(job.width * job.height);
+            alive = sendAll(connection, &job, sizeof(job)) && receiveStatus(connection, status) && status == DISTRIBUTED_DONE
+                && receiveAll(connection, &answer, sizeof(answer)) && answer == job
+                && receiveAll(connection, colors.data(), colors.size() * sizeof(glm::vec3));
+            scope.End();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (alive)
+                merge(index, colors);
+            else
+            {
+                std::cerr << "Lost worker " << id << ", its job goes back to the queue" << std::endl;
+                pending.push_front(index);
+                stats.lostJobs++;
+            }
+        }
+
+        if (alive)
+        {
+            RenderJob done;
+            sendAll(connection, &done, sizeof(done));
+        }
+        closeSocket(connection);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        numLive--;
+        lastWorkerSeen = std::chrono::steady_clock::now();
+        changed.notify_all();
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<glm::vec3> colors;
+    while (true)
+    {
+        if (waitReadable(listener, 100))
+        {
+            SocketHandle connection = accept(listener, nullptr, nullptr);
+            if (connection == INVALID_SOCKET_HANDLE)
+                continue;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            numLive++;
+            stats.workers++;
+            std::cout << "Worker " << stats.workers << " connected" << std::endl;
+            threads.push_back(std::thread(serveWorker, connection, stats.workers));
+            continue;
+        }
+
+        // Nobody to hand the jobs to, render them here one at a time so workers that still show up can take the rest
+        int index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (numDone == numJobs)
+                break;
+            float idleSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - lastWorkerSeen).count();
+            if (numLive > 0 || pending.empty() || idleSeconds < workerWait)
+                continue;
+            index = pending.front();
+            pending.pop_front();
+            stats.localJobs++;
+        }
+
+        colors.assign(jobs[index].width * jobs[index].height, glm::vec3(0.0f));
+        renderLocal(jobs[index], colors);
+        std::lock_guard<std::mutex> lock(mutex);
+        merge(index, colors);
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+    closeSocket(listener);
+    return true;
+}
+
+// Connects to the coordinator at host:port, trying for connectWait seconds, loads the scene it sends with loadScene,
+// which also gives the job of the entire render, and renders its jobs until it has no more. Jobs outside of the render
+// are refused before anything is allocated for them. Returns false when the scene could not be loaded, a job was
+// refused or the coordinator was lost.
+bool serveRenderJobs(const std::string& host, int port, float connectWait,
+    const std::function<bool(const std::string& sceneText, RenderJob& whole)>& loadScene, const RenderJobFunction& renderJob)
+{
+    if (!initSockets())
+        return false;
+
+    auto connectStart = std::chrono::steady_clock::now();
+    SocketHandle connection = connectTo(host, port);
+    while (connection == INVALID_SOCKET_HANDLE && std::chrono::duration<float>(std::chrono::steady_clock::now() - connectStart).count() < connectWait)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        connection = connectTo(host, port);
+    }
+    if (connection == INVALID_SOCKET_HANDLE)
+    {
+        std::cerr << "Cannot connect to the coordinator at " << host << ":" << port << std::endl;
+        return false;
+    }
+    setNoDelay(connection);
+
+    uint32_t hello[2] = { DISTRIBUTED_MAGIC, DISTRIBUTED_VERSION };
+    uint32_t sceneLength = 0;
+    std::string sceneText;
+    bool received = sendAll(connection, hello, sizeof(hello)) && receiveAll(connection, &sceneLength, sizeof(sceneLength))
+        && sceneLength <= MAX_SCENE_TEXT_LENGTH;
+    if (received)
+    {
+        sceneText.resize(sceneLength);
+        received = receiveAll(connection, &sceneText[0], sceneLength);
+    }
+
+    RenderJob whole;
+    bool loaded = false;
+    if (received)
+    {
+        Heartbeat heartbeat(connection);
+        loaded = loadScene(sceneText, whole);
+    }
+    bool connected = received && sendAll(connection, loaded ? &DISTRIBUTED_DONE : &DISTRIBUTED_FAILED, sizeof(uint32_t)) && loaded;
+
+    std::vector<glm::vec3> colors;
+    int numJobs = 0;
+    while (connected)
+    {
+        RenderJob job;
+        if (!receiveAll(connection, &job, sizeof(job)))
+            break;
+        if (job.width == 0)
+        {
+            std::cout << "Rendered " << numJobs << " jobs, the coordinator is done" << std::endl;
+            closeSocket(connection);
+            return true;
+        }
+        if (!job.isInside(whole))
+        {
+            std::cerr << "Refused a job outside of the render: " << job.width << "x" << job.height << " pixels at " << job.x << ", "
+                << job.y << ", frames " << job.firstFrame << " to " << job.firstFrame + job.numFrames << std::endl;
+            closeSocket(connection);
+            return false;
+        }
+
+        TraceScope scope("job", "distributed", static_cast<long long>(job.width) * job.height * job.numFrames);
+        colors.assign(static_cast<size_t>(job.width) * job.height, glm::vec3(0.0f));
+        {
+            Heartbeat heartbeat(connection);
+            renderJob(job, colors);
+        }
+        connected = sendAll(connection, &DISTRIBUTED_DONE, sizeof(DISTRIBUTED_DONE)) && sendAll(connection, &job, sizeof(job))
+            && sendAll(connection, colors.data(), colors.size() * sizeof(glm::vec3));
+        numJobs++;
+    }
+
+    std::cerr << (received && !loaded ? "Could not load the scene of the coordinator" : "Lost the coordinator") << std::endl;
+    closeSocket(connection);
+    return false;
+}
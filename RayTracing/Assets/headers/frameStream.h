@@ -0,0 +1,251 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include <filesUtil/myFile.h>
+#include <RayTracing/Assets/headers/imageOutput.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <csignal>
+#endif
+
+// Sends frames to a video encoder as they are rendered, to stdout ("-") or a file or named pipe (a fifo, or
+// \\.\pipe\<name> on Windows), in one of the formats ffmpeg reads without being told more than the size:
+//
+// - rgb and rgba: raw 8-bit pixels, top row first:  ffmpeg -f rawvideo -pix_fmt rgb24 -s 1000x1000 -r 30 -i - out.mp4
+// - y4m: YUV4MPEG2 with full resolution chroma:     ffmpeg -i - out.mp4
+//
+// Frames are converted into one of two buffers allocated by open(), and a writer thread writes the other one, so a
+// slow reader only makes addFrame() wait once both are full and a frame never allocates.
+
+enum class StreamFormat
+{
+    RGB,
+    RGBA,
+    Y4M
+};
+
+bool parseStreamFormat(const std::string& name, StreamFormat& format)
+{
+    if (name == "rgb")
+        format = StreamFormat::RGB;
+    else if (name == "rgba")
+        format = StreamFormat::RGBA;
+    else if (name == "y4m")
+        format = StreamFormat::Y4M;
+    else
+    {
+        std::cerr << "Unknown stream format: " << name << " (expected rgb, rgba or y4m)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+class FrameStream
+{
+public:
+    ~FrameStream()
+    {
+        close();
+    }
+
+    bool open(const std::string& path_, StreamFormat format_, int width_, int height_, int fps)
+    {
+        close();
+        path = path_;
+        format = format_;
+        width = width_;
+        height = height_;
+
+        if (path == "-")
+        {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            file = stdout;
+        }
+        else
+            file = std::fopen(toNativePath(path).c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Cannot open frame stream: " << path << std::endl;
+            return false;
+        }
+#ifndef _WIN32
+        // An encoder that quits makes the writes fail instead of killing the renderer
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+        if (format == StreamFormat::Y4M)
+        {
+            std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(fps)
+                + ":1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n";
+            std::fwrite(header.data(), 1, header.size(), file);
+            frameHeader = "FRAME\n";
+        }
+        else
+            frameHeader.clear();
+
+        size_t frameSize = frameHeader.size() + static_cast<size_t>(width) * height * (format == StreamFormat::RGBA ? 4 : 3);
+        for (Buffer& buffer : buffers)
+        {
+            buffer.bytes.assign(frameSize, 0);
+            std::memcpy(buffer.bytes.data(), frameHeader.data(), frameHeader.size());
+            buffer.full = false;
+        }
+        next = 0;
+        stopping = false;
+        failed = false;
+        writer = std::thread([this]() { work(); });
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    // 8-bit RGBA pixels, rows from the bottom up when bottomFirst (as OpenGL reads them back)
+    void addFrame(const unsigned char* rgba, bool bottomFirst)
+    {
+        convertFrame([&](int x, int y)
+        {
+            const unsigned char* pixel = rgba + 4 * (static_cast<size_t>(bottomFirst ? height - 1 - y : y) * width + x);
+            return glm::ivec4(pixel[0], pixel[1], pixel[2], pixel[3]);
+        });
+    }
+
+    // Float RGB pixels, top row first, rounded to 8 bits like a screenshot
+    void addFrame(const glm::vec3* pixels)
+    {
+        convertFrame([&](int x, int y)
+        {
+            const glm::vec3& pixel = pixels[static_cast<size_t>(y) * width + x];
+            return glm::ivec4(toByte(pixel.r), toByte(pixel.g), toByte(pixel.b), 255);
+        });
+    }
+
+    // Writes the frames still waiting, returns false if any write failed
+    bool close()
+    {
+        if (!file)
+            return true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        writer.join();
+
+        failed = std::fflush(file) != 0 || failed;
+        if (file != stdout)
+            failed = std::fclose(file) != 0 || failed;
+        file = nullptr;
+        if (failed)
+            std::cerr << "Failed to write frame stream: " << path << std::endl;
+        return !failed;
+    }
+
+private:
+    struct Buffer
+    {
+        std::vector<unsigned char> bytes; // Frame header, then the pixels
+        bool full = false;
+    };
+
+    std::string path;
+    StreamFormat format = StreamFormat::RGB;
+    int width = 0;
+    int height = 0;
+    FILE* file = nullptr;
+    std::string frameHeader;
+
+    Buffer buffers[2];
+    int next = 0; // Buffer the next frame goes to, the writer takes them in the same order
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+    bool failed = false;
+
+    // pixelAt(x, y) gives the 8-bit RGBA of a pixel, y from the top
+    template <typename PixelAt>
+    void convertFrame(const PixelAt& pixelAt)
+    {
+        if (!file)
+            return;
+
+        Buffer& buffer = buffers[next];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !buffer.full; });
+        }
+
+        unsigned char* out = buffer.bytes.data() + frameHeader.size();
+        size_t planeSize = static_cast<size_t>(width) * height;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                glm::ivec4 pixel = pixelAt(x, y);
+                size_t i = static_cast<size_t>(y) * width + x;
+                if (format == StreamFormat::Y4M)
+                {
+                    // BT.601 in the limited range, what players assume for Y4M
+                    float luma = 0.299f * pixel.r + 0.587f * pixel.g + 0.114f * pixel.b;
+                    out[i] = static_cast<unsigned char>(16.0f + luma * (219.0f / 255.0f) + 0.5f);
+                    out[planeSize + i] = static_cast<unsigned char>(128.0f + (pixel.b - luma) * (224.0f / 255.0f / 1.772f) + 0.5f);
+                    out[2 * planeSize + i] = static_cast<unsigned char>(128.0f + (pixel.r - luma) * (224.0f / 255.0f / 1.402f) + 0.5f);
+                }
+                else
+                {
+                    int comp = format == StreamFormat::RGBA ? 4 : 3;
+                    for (int channel = 0; channel < comp; channel++)
+                        out[comp * i + channel] = static_cast<unsigned char>(pixel[channel]);
+                }
+            }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.full = true;
+        next = 1 - next;
+        changed.notify_all();
+    }
+
+    void work()
+    {
+        setTraceThreadName("frame stream");
+        for (int current = 0; ; current = 1 - current)
+        {
+            Buffer& buffer = buffers[current];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return buffer.full || stopping; });
+                if (!buffer.full)
+                    return;
+            }
+
+            // After a failed write the frames are dropped, so a closed pipe doesn't stop the render
+            if (!failed)
+            {
+                TraceScope scope("stream frame", "output");
+                failed = std::fwrite(buffer.bytes.data(), 1, buffer.bytes.size(), file) != buffer.bytes.size() || std::fflush(file) != 0;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.full = false;
+            changed.notify_all();
+        }
+    }
+};
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+// Encoders writeImage() uses instead of stb_image_write where that is too slow or loses precision:
+//
+// - PNG whose rows are filtered and deflated in strips on several threads. Deflate uses the fixed Huffman codes like
+//   stb_image_write, every strip ends with an empty stored block so the next strip starts on a byte, and a strip's
+//   matches may reach back into the 32 KB before it, so the strips join into a single zlib stream.
+// - OpenEXR with 32-bit float channels, uncompressed, so renders keep their full range.
+//
+// Both take the image a band of rows at a time and write each band right away, so an image never has to be in memory
+// as a whole.
+
+// Calls body(index) for index 0 to count - 1 on numThreads threads
+template <typename Body>
+void parallelForEach(int count, int numThreads, const Body& body)
+{
+    numThreads = std::max(1, std::min(numThreads, count));
+    std::atomic<int> next(0);
+    auto worker = [&]()
+    {
+        for (int index = next++; index < count; index = next++)
+            body(index);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; i++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+class DeflateBitWriter
+{
+public:
+    std::vector<unsigned char> bytes;
+
+    // Deflate packs its bits starting at the least significant one
+    void write(uint32_t bits, int count)
+    {
+        buffer |= uint64_t(bits) << bitCount;
+        bitCount += count;
+        while (bitCount >= 8)
+        {
+            bytes.push_back(static_cast<unsigned char>(buffer & 0xff));
+            buffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    // Huffman codes are stored starting at their most significant bit
+    void writeCode(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= ((code >> i) & 1u) << (length - 1 - i);
+        write(reversed, length);
+    }
+
+    void alignToByte()
+    {
+        if (bitCount > 0)
+            write(0, 8 - bitCount);
+    }
+
+private:
+    uint64_t buffer = 0;
+    int bitCount = 0;
+};
+
+void writeFixedLiteral(DeflateBitWriter& out, int symbol)
+{
+    if (symbol < 144) out.writeCode(0x30 + symbol, 8);
+    else if (symbol < 256) out.writeCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) out.writeCode(symbol - 256, 7);
+    else out.writeCode(0xc0 + symbol - 280, 8);
+}
+
+void writeFixedMatch(DeflateBitWriter& out, int length, int distance)
+{
+    static const int lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259 };
+    static const int lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const int distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577, 32769 };
+    static const int distanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int lengthCode = 0;
+    while (lengthBase[lengthCode + 1] <= length)
+        lengthCode++;
+    writeFixedLiteral(out, 257 + lengthCode);
+    out.write(length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+    int distanceCode = 0;
+    while (distanceBase[distanceCode + 1] <= distance)
+        distanceCode++;
+    out.writeCode(distanceCode, 5);
+    out.write(distance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+}
+
+// Deflates data[start, end), matches may start anywhere from 32 KB before start. Ends on a byte with an empty stored
+// block, another strip can follow
+std::vector<unsigned char> deflateStrip(const unsigned char* data, size_t start, size_t end)
+{
+    const int HASH_BITS = 15;
+    const int MAX_CHAIN = 32;
+    const size_t WINDOW = 32768;
+
+    size_t windowStart = start > WINDOW ? start - WINDOW : 0;
+    // Positions relative to windowStart, -1 ends a chain
+    std::vector<int32_t> head(1 << HASH_BITS, -1);
+    std::vector<int32_t> previous(end - windowStart, -1);
+    auto hash = [&](size_t pos)
+    {
+        uint32_t value = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16;
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto insert = [&](size_t pos)
+    {
+        if (pos + 3 > end)
+            return;
+        uint32_t key = hash(pos);
+        previous[pos - windowStart] = head[key];
+        head[key] = static_cast<int32_t>(pos - windowStart);
+    };
+    for (size_t pos = windowStart; pos < start; pos++)
+        insert(pos);
+
+    DeflateBitWriter out;
+    out.bytes.reserve((end - start) / 2);
+    out.write(0, 1); // Not the last block
+    out.write(1, 2); // Fixed Huffman codes
+
+    size_t pos = start;
+    while (pos < end)
+    {
+        int bestLength = 0;
+        int bestDistance = 0;
+        if (pos + 3 <= end)
+        {
+            int maxLength = static_cast<int>(std::min<size_t>(258, end - pos));
+            int chain = MAX_CHAIN;
+            for (int32_t candidate = head[hash(pos)]; candidate >= 0 && chain-- > 0; candidate = previous[candidate])
+            {
+                size_t candidatePos = windowStart + candidate;
+                if (pos - candidatePos > WINDOW)
+                    break;
+                // Can't beat the best match unless it matches one byte further
+                if (data[candidatePos + bestLength] != data[pos + bestLength])
+                    continue;
+
+                int length = 0;
+                while (length < maxLength && data[candidatePos + length] == data[pos + length])
+                    length++;
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = static_cast<int>(pos - candidatePos);
+                    if (length == maxLength)
+                        break;
+                }
+            }
+        }
+
+        if (bestLength >= 3)
+        {
+            writeFixedMatch(out, bestLength, bestDistance);
+            for (int i = 0; i < bestLength; i++)
+                insert(pos + i);
+            pos += bestLength;
+        }
+        else
+        {
+            writeFixedLiteral(out, data[pos]);
+            insert(pos);
+            pos++;
+        }
+    }
+    writeFixedLiteral(out, 256);
+
+    out.write(0, 3); // Stored block
+    out.alignToByte();
+    out.write(0x0000, 16);
+    out.write(0xffff, 16);
+    return out.bytes;
+}
+
+uint32_t adler32(const unsigned char* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        // Sums stay below 2^32 for 5552 bytes
+        size_t count = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < count; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += count;
+        size -= count;
+    }
+    return b << 16 | a;
+}
+
+// Adler-32 of two byte ranges joined, from the checksum of each and the size of the second (as in zlib)
+uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondSize)
+{
+    const uint32_t BASE = 65521;
+    uint32_t remainder = static_cast<uint32_t>(secondSize % BASE);
+    uint32_t sum1 = first & 0xffff;
+    uint32_t sum2 = static_cast<uint32_t>((uint64_t(remainder) * sum1) % BASE);
+    sum1 += (second & 0xffff) + BASE - 1;
+    sum2 += (first >> 16) + (second >> 16) + BASE - remainder;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+    if (sum2 >= BASE) sum2 -= BASE;
+    return sum2 << 16 | sum1;
+}
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    static bool tableReady = [&]()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)tableReady;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<unsigned char>& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<unsigned char>(value >> shift));
+}
+
+void appendPNGChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size)
+{
+    appendBigEndian(out, static_cast<uint32_t>(size));
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    appendBigEndian(out, crc32(&out[typeStart], size + 4));
+}
+
+// Picks the PNG filter of a row that leaves the smallest sum of absolute differences, like most encoders do.
+// previousRow is null for the first row
+void filterPNGRow(const unsigned char* row, const unsigned char* previousRow, int rowBytes, int bytesPerPixel, unsigned char* out)
+{
+    std::vector<unsigned char> candidate(rowBytes);
+    long long bestSum = -1;
+    for (int filter = 0; filter < 5; filter++)
+    {
+        long long sum = 0;
+        for (int i = 0; i < rowBytes; i++)
+        {
+            int left = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+            int up = previousRow ? previousRow[i] : 0;
+            int upLeft = previousRow && i >= bytesPerPixel ? previousRow[i - bytesPerPixel] : 0;
+            int predicted = 0;
+            switch (filter)
+            {
+                case 1: predicted = left; break;
+                case 2: predicted = up; break;
+                case 3: predicted = (left + up) / 2; break;
+                case 4:
+                {
+                    int p = left + up - upLeft;
+                    int pa = std::abs(p - left), pb = std::abs(p - up), pc = std::abs(p - upLeft);
+                    predicted = pa <= pb && pa <= pc ? left : (pb <= pc ? up : upLeft);
+                    break;
+                }
+            }
+            candidate[i] = static_cast<unsigned char>(row[i] - predicted);
+            sum += std::abs(static_cast<signed char>(candidate[i]));
+        }
+
+        if (bestSum < 0 || sum < bestSum)
+        {
+            bestSum = sum;
+            out[0] = static_cast<unsigned char>(filter);
+            std::memcpy(out + 1, candidate.data(), rowBytes);
+        }
+    }
+}
+
+
+// PNG of 8-bit pixels (comp 1, 3 or 4 channels), written a band of rows at a time, top band first
+class PNGWriter
+{
+public:
+    PNGWriter(std::ostream& out_, int width_, int height_, int comp_, int numThreads_)
+        : out(out_), width(width_), height(height_), comp(comp_), numThreads(numThreads_)
+    {
+        static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        std::vector<unsigned char> start(signature, signature + 8);
+
+        std::vector<unsigned char> header;
+        appendBigEndian(header, width);
+        appendBigEndian(header, height);
+        unsigned char colorType = comp == 4 ? 6 : (comp == 3 ? 2 : 0);
+        header.insert(header.end(), { 8, colorType, 0, 0, 0 });
+        appendPNGChunk(start, "IHDR", header.data(), header.size());
+
+        // IDAT chunks only have to be joined to form the zlib stream, so the header gets a chunk of its own
+        const unsigned char zlibHeader[] = { 0x78, 0x01 };
+        appendPNGChunk(start, "IDAT", zlibHeader, 2);
+        write(start);
+    }
+
+    // Rows of width * comp bytes each
+    bool writeRows(const unsigned char* rows, int numRows)
+    {
+        int rowBytes = width * comp;
+        size_t filteredRowBytes = static_cast<size_t>(rowBytes) + 1;
+
+        // The tail of the bands before is the dictionary of this one's first strip
+        size_t dictionarySize = filtered.size();
+        filtered.resize(dictionarySize + filteredRowBytes * numRows);
+
+        // Strips of about 256 KB, small enough to keep every thread busy, large enough to compress well
+        int stripRows = std::max(1, static_cast<int>((1 << 18) / filteredRowBytes));
+        int numStrips = (numRows + stripRows - 1) / stripRows;
+
+        parallelForEach(numStrips, numThreads, [&](int strip)
+        {
+            for (int y = strip * stripRows; y < std::min(numRows, (strip + 1) * stripRows); y++)
+            {
+                const unsigned char* above = y > 0 ? rows + static_cast<size_t>(y - 1) * rowBytes : (previousRow.empty() ? nullptr : previousRow.data());
+                filterPNGRow(rows + static_cast<size_t>(y) * rowBytes, above, rowBytes, comp, &filtered[dictionarySize + y * filteredRowBytes]);
+            }
+        });
+
+        // A strip deflates with the filtered bytes before it as its dictionary, so all of them have to be filtered first
+        std::vector<std::vector<unsigned char>> chunks(numStrips);
+        std::vector<uint32_t> checksums(numStrips);
+        auto stripStart = [&](int strip) { return dictionarySize + std::min<size_t>(numRows, static_cast<size_t>(strip) * stripRows) * filteredRowBytes; };
+        parallelForEach(numStrips, numThreads, [&](int strip)
+        {
+            size_t start = stripStart(strip);
+            size_t end = stripStart(strip + 1);
+            std::vector<unsigned char> compressed = deflateStrip(filtered.data(), start, end);
+            appendPNGChunk(chunks[strip], "IDAT", compressed.data(), compressed.size());
+            checksums[strip] = adler32(&filtered[start], end - start);
+        });
+
+        for (int strip = 0; strip < numStrips; strip++)
+        {
+            checksum = adler32Combine(checksum, checksums[strip], stripStart(strip + 1) - stripStart(strip));
+            write(chunks[strip]);
+        }
+
+        previousRow.assign(rows + static_cast<size_t>(numRows - 1) * rowBytes, rows + static_cast<size_t>(numRows) * rowBytes);
+        size_t keep = std::min<size_t>(filtered.size(), 32768);
+        filtered.erase(filtered.begin(), filtered.end() - keep);
+        return static_cast<bool>(out);
+    }
+
+    // Ends the stream with an empty last block and the checksum
+    bool finish()
+    {
+        std::vector<unsigned char> end = { 0x01, 0x00, 0x00, 0xff, 0xff };
+        appendBigEndian(end, checksum);
+        std::vector<unsigned char> chunks;
+        appendPNGChunk(chunks, "IDAT", end.data(), end.size());
+        appendPNGChunk(chunks, "IEND", nullptr, 0);
+        write(chunks);
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::ostream& out;
+    int width;
+    int height;
+    int comp;
+    int numThreads;
+    uint32_t checksum = 1; // Adler-32 of nothing
+    std::vector<unsigned char> previousRow;
+    std::vector<unsigned char> filtered;
+
+    void write(const std::vector<unsigned char>& bytes)
+    {
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+};
+
+void appendLittleEndian(std::vector<unsigned char>& out, uint64_t value, int numBytes)
+{
+    for (int i = 0; i < numBytes; i++)
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+void appendEXRAttribute(std::vector<unsigned char>& out, const std::string& name, const std::string& type, const std::vector<unsigned char>& value)
+{
+    out.insert(out.end(), name.begin(), name.end());
+    out.push_back(0);
+    out.insert(out.end(), type.begin(), type.end());
+    out.push_back(0);
+    appendLittleEndian(out, value.size(), 4);
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Single part scanline OpenEXR with float R, G and B channels and no compression, written a band of rows at a time,
+// top band first. Every scanline has the same size, so the offset table is known before the first one
+class EXRWriter
+{
+public:
+    EXRWriter(std::ostream& out_, int width_, int height_) : out(out_), width(width_), nextRow(0)
+    {
+        std::vector<unsigned char> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+        // Channels are listed in alphabetical order, and stored in that order in every scanline
+        std::vector<unsigned char> channels;
+        for (const char* name : { "B", "G", "R" })
+        {
+            channels.push_back(name[0]);
+            channels.push_back(0);
+            appendLittleEndian(channels, 2, 4); // FLOAT
+            appendLittleEndian(channels, 0, 4); // pLinear and reserved
+            appendLittleEndian(channels, 1, 4); // x and y sampling
+            appendLittleEndian(channels, 1, 4);
+        }
+        channels.push_back(0);
+
+        std::vector<unsigned char> window;
+        for (int value : { 0, 0, width - 1, height_ - 1 })
+            appendLittleEndian(window, static_cast<uint32_t>(value), 4);
+        std::vector<unsigned char> one;
+        appendLittleEndian(one, floatBits(1.0f), 4);
+        std::vector<unsigned char> center(8, 0);
+
+        appendEXRAttribute(header, "channels", "chlist", channels);
+        appendEXRAttribute(header, "compression", "compression", { 0 });
+        appendEXRAttribute(header, "dataWindow", "box2i", window);
+        appendEXRAttribute(header, "displayWindow", "box2i", window);
+        appendEXRAttribute(header, "lineOrder", "lineOrder", { 0 });
+        appendEXRAttribute(header, "pixelAspectRatio", "float", one);
+        appendEXRAttribute(header, "screenWindowCenter", "v2f", center);
+        appendEXRAttribute(header, "screenWindowWidth", "float", one);
+        header.push_back(0);
+
+        // Offsets of the scanlines, each one is its y, its size and the three channels
+        size_t lineSize = 8 + 12 * static_cast<size_t>(width);
+        size_t firstLine = header.size() + 8 * static_cast<size_t>(height_);
+        for (int y = 0; y < height_; y++)
+            appendLittleEndian(header, firstLine + y * lineSize, 8);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    }
+
+    bool writeRows(const glm::vec3* rows, int numRows)
+    {
+        std::vector<unsigned char> lines;
+        lines.reserve(numRows * (8 + 12 * static_cast<size_t>(width)));
+        for (int y = 0; y < numRows; y++)
+        {
+            appendLittleEndian(lines, static_cast<uint32_t>(nextRow++), 4);
+            appendLittleEndian(lines, 12 * static_cast<uint32_t>(width), 4);
+            for (int channel = 2; channel >= 0; channel--)
+                for (int x = 0; x < width; x++)
+                    appendLittleEndian(lines, floatBits(rows[y * width + x][channel]), 4);
+        }
+        out.write(reinterpret_cast<const char*>(lines.data()), lines.size());
+        return static_cast<bool>(out);
+    }
+
+    bool finish()
+    {
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::ostream& out;
+    int width;
+    int nextRow;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <fstream>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include "stb/stb_image_write.h"
+
+#include <filesUtil/myFile.h>
+#include <profiling/traceRecorder.h>
+#include <RayTracing/Assets/headers/imageEncoders.h>
+
+// Converts a linear color to the 8-bit value the screen (and screenshot()) would show
+unsigned char toByte(float value)
+{
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// False color of a value from 0 to 1: dark blue over green to red
+glm::vec3 heatmapColor(float t)
+{
+    return t < 0.5f
+        ? glm::mix(glm::vec3(0.0f, 0.0f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f), t * 2.0f)
+        : glm::mix(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), t * 2.0f - 1.0f);
+}
+
+// Writes an image of float RGB pixels a band of rows at a time, top band first, so only a band has to be in memory.
+// Only exr and png (also used for unknown extensions) can be written like this, stb_image_write needs the whole image
+class ImageRowWriter
+{
+public:
+    static bool supports(const std::string& path)
+    {
+        std::string extension = lowerExtension(path);
+        return extension != ".hdr" && extension != ".jpg" && extension != ".jpeg" && extension != ".bmp" && extension != ".tga";
+    }
+
+    bool open(const std::string& path_, int width_, int height_, int numThreads = 0)
+    {
+        path = toNativePath(path_);
+        width = width_;
+        if (path.has_parent_path())
+            fs::create_directories(path.parent_path());
+        if (numThreads <= 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        file.open(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to write image: " << path.string() << std::endl;
+            return false;
+        }
+        if (lowerExtension(path.string()) == ".exr")
+            exr = std::make_unique<EXRWriter>(file, width, height_);
+        else
+            png = std::make_unique<PNGWriter>(file, width, height_, 3, numThreads);
+        return true;
+    }
+
+    bool writeRows(const glm::vec3* rows, int numRows)
+    {
+        if (exr)
+            return exr->writeRows(rows, numRows);
+
+        bytes.resize(3 * static_cast<size_t>(width) * numRows);
+        for (size_t i = 0; i < static_cast<size_t>(width) * numRows; i++)
+        {
+            bytes[3 * i    ] = toByte(rows[i].r);
+            bytes[3 * i + 1] = toByte(rows[i].g);
+            bytes[3 * i + 2] = toByte(rows[i].b);
+        }
+        return png->writeRows(bytes.data(), numRows);
+    }
+
+    bool close()
+    {
+        bool success = exr ? exr->finish() : png->finish();
+        file.close();
+        if (!success || file.fail())
+        {
+            std::cerr << "Failed to write image: " << path.string() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    fs::path path;
+    int width = 0;
+    std::ofstream file;
+    std::unique_ptr<PNGWriter> png;
+    std::unique_ptr<EXRWriter> exr;
+    std::vector<unsigned char> bytes;
+
+    static std::string lowerExtension(const std::string& path)
+    {
+        std::string extension = fs::path(toNativePath(path)).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension;
+    }
+};
+
+// Writes rows of float RGB pixels, top row first, the format is chosen by the file extension (png, jpg, bmp, tga, or
+// exr and hdr, which keep the float values as they are). PNGs are compressed on numThreads threads, 0 uses all of them
+bool writeImage(const std::string& path, const std::vector<glm::vec3>& pixels, int width, int height, int numThreads = 0)
+{
+    if (ImageRowWriter::supports(path))
+    {
+        ImageRowWriter writer;
+        return writer.open(path, width, height, numThreads) && writer.writeRows(pixels.data(), height) && writer.close();
+    }
+
+    fs::path filePath = toNativePath(path);
+    if (filePath.has_parent_path())
+        fs::create_directories(filePath.parent_path());
+
+    std::string extension = filePath.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    std::vector<unsigned char> bytes;
+    if (extension != ".hdr")
+    {
+        bytes.resize(3 * width * height);
+        for (int i = 0; i < width * height; i++)
+        {
+            bytes[3 * i    ] = toByte(pixels[i].r);
+            bytes[3 * i + 1] = toByte(pixels[i].g);
+            bytes[3 * i + 2] = toByte(pixels[i].b);
+        }
+    }
+
+    int success;
+    if (extension == ".hdr")
+        success = stbi_write_hdr(filePath.string().c_str(), width, height, 3, &pixels[0].x);
+    else if (extension == ".jpg" || extension == ".jpeg")
+        success = stbi_write_jpg(filePath.string().c_str(), width, height, 3, bytes.data(), 95);
+    else if (extension == ".bmp")
+        success = stbi_write_bmp(filePath.string().c_str(), width, height, 3, bytes.data());
+    else // .tga
+        success = stbi_write_tga(filePath.string().c_str(), width, height, 3, bytes.data());
+
+    if (!success)
+        std::cerr << "Failed to write image: " << filePath.string() << std::endl;
+    return success != 0;
+}
+
+// Encodes and writes images on background threads, so the next frame of a sequence renders while the last one is
+// compressed. At most maxPending images wait at once, add() blocks beyond that so a slow disk can't fill the memory,
+// addTexels() skips droppable images instead. The threads share the hardware threads for compressing PNG strips.
+class ImageWriterPool
+{
+public:
+    ImageWriterPool(int numThreads, int maxPending_) : maxPending(std::max(1, maxPending_))
+    {
+        encodeThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / std::max(1, numThreads));
+        for (int i = 0; i < std::max(1, numThreads); i++)
+            threads.push_back(std::thread([this, i]() { work(i); }));
+    }
+
+    ~ImageWriterPool()
+    {
+        finish();
+    }
+
+    void add(const std::string& path, std::vector<glm::vec3> pixels, int width, int height)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return static_cast<int>(pending.size()) < maxPending; });
+        pending.push_back({ path, std::move(pixels), {}, width, height });
+        changed.notify_all();
+    }
+
+    // Never waits, for a render loop: texels are RGBA rows bottom first as OpenGL reads them back, they are only copied
+    // here and flipped on a writer thread. With maxPending images already waiting a droppable image is skipped (returns
+    // false), any other one is queued anyway
+    bool addTexels(const std::string& path, const glm::vec4* texels, int width, int height, bool droppable)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (droppable && static_cast<int>(pending.size()) >= maxPending)
+            return false;
+        pending.push_back({ path, {}, std::vector<glm::vec4>(texels, texels + static_cast<size_t>(width) * height), width, height });
+        changed.notify_all();
+        return true;
+    }
+
+    // Waits for every image to be written and stops the threads, returns the number of images that failed
+    int finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        threads.clear();
+        return numFailed;
+    }
+
+private:
+    struct PendingImage
+    {
+        std::string path;
+        std::vector<glm::vec3> pixels;
+        std::vector<glm::vec4> texels; // Instead of pixels, bottom row first
+        int width;
+        int height;
+    };
+
+    int maxPending;
+    int encodeThreads;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<PendingImage> pending;
+    bool stopping = false;
+    int numFailed = 0;
+
+    void work(int index)
+    {
+        setTraceThreadName("image writer " + std::to_string(index));
+        while (true)
+        {
+            PendingImage image;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return !pending.empty() || stopping; });
+                if (pending.empty())
+                    return;
+                image = std::move(pending.front());
+                pending.pop_front();
+                changed.notify_all();
+            }
+
+            TraceScope scope("write image", "output", static_cast<long long>(image.width) * image.height);
+            if (!image.texels.empty())
+            {
+                image.pixels.resize(image.texels.size());
+                for (int y = 0; y < image.height; y++)
+                    for (int x = 0; x < image.width; x++)
+                        image.pixels[y * image.width + x] = glm::vec3(image.texels[(image.height - 1 - y) * image.width + x]);
+                std::vector<glm::vec4>().swap(image.texels);
+            }
+            bool written = writeImage(image.path, image.pixels, image.width, image.height, encodeThreads);
+            std::lock_guard<std::mutex> lock(mutex);
+            numFailed += !written;
+        }
+    }
+};
+
+// FNV-1a over the bits of the float pixels, two renders have the same hash only if they are bit for bit identical
+uint64_t imageHash(const std::vector<glm::vec3>& pixels)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const glm::vec3& pixel : pixels)
+        for (int channel = 0; channel < 3; channel++)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &pixel[channel], sizeof(bits));
+            for (int byte = 0; byte < 4; byte++)
+            {
+                hash ^= (bits >> (8 * byte)) & 0xffu;
+                hash *= 1099511628211ull;
+            }
+        }
+    return hash;
+}
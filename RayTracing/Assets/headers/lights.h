@@ -0,0 +1,281 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/mesh.h>
+
+// The emissive triangles of a scene, gathered at load time for next-event estimation, next to the geometry BVH.
+// A point is picked uniformly on the chosen light, the light itself by one of two samplers:
+//  - an alias table (Vose), every light in proportion to its power (area times emitted brightness) in constant
+//    time, whatever the number of lights
+//  - a light BVH, a binary tree over the lights whose nodes hold their bounds and total power. Going down from the
+//    root, a child is picked in proportion to its power over the squared distance to the shading point, so nearby
+//    lights get the samples in a scene with thousands of emitters spread around. Every light remembers its way down
+//    (bitTrail), the chance to pick it from a point is the product of the choices along it.
+// Both are uploaded for compute.glsl (LightsBlock, LightNodesBlock), triangles hit by a ray find their light through
+// RTXTriangle::lightIndex.
+
+enum LightSampler
+{
+    LIGHT_SAMPLER_ALIAS,
+    LIGHT_SAMPLER_BVH
+};
+
+bool parseLightSampler(const std::string& name, LightSampler& sampler)
+{
+    if (name == "alias") sampler = LIGHT_SAMPLER_ALIAS;
+    else if (name == "bvh") sampler = LIGHT_SAMPLER_BVH;
+    else
+    {
+        std::cerr << "Unknown light sampler: " << name << " (alias or bvh)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 20 bytes, the layout of LightsBlock
+struct LightEntry
+{
+    int triangleIndex;
+    float probability; // Power over the total power, the chance the alias table picks it
+    float threshold;   // Alias table: the part of this slot that keeps it, the rest goes to alias
+    int alias;
+    uint32_t bitTrail; // Light BVH: bit i set when the way down from the root takes the second child at depth i
+};
+
+// 48 bytes, the layout of LightNodesBlock
+struct LightNode
+{
+    glm::vec4 boundsMin; // w: total power of the lights below
+    glm::vec4 boundsMax;
+    int childIndex; // The children are next to each other, -1 for a leaf
+    int lightIndex; // The light of a leaf
+    int pad0;
+    int pad1;
+};
+
+struct LightList
+{
+    std::vector<LightEntry> lights;
+    std::vector<LightNode> nodes;
+    float totalPower = 0.0f;
+};
+
+float triangleArea(const RTXTriangle& tri)
+{
+    return 0.5f * glm::length(glm::cross(glm::vec3(tri.b) - glm::vec3(tri.a), glm::vec3(tri.c) - glm::vec3(tri.a)));
+}
+
+// Brightness of the light a material emits per unit area
+float emittedLuminance(const Material& material)
+{
+    return material.emissionStrength * glm::dot(glm::vec3(material.emissionColor), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+void buildAliasTable(std::vector<LightEntry>& lights)
+{
+    int numLights = static_cast<int>(lights.size());
+    std::vector<double> scaled(numLights);
+    std::vector<int> small, large;
+    for (int i = 0; i < numLights; i++)
+    {
+        scaled[i] = double(lights[i].probability) * numLights;
+        lights[i].alias = i;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        int less = small.back();
+        int more = large.back();
+        small.pop_back();
+
+        lights[less].threshold = float(scaled[less]);
+        lights[less].alias = more;
+        scaled[more] -= 1.0 - scaled[less];
+        if (scaled[more] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+    // What is left is 1 up to rounding
+    for (int i : small)
+        lights[i].threshold = 1.0f;
+    for (int i : large)
+        lights[i].threshold = 1.0f;
+}
+
+// Splits the lights in [begin, end) of order at the median centroid along the longest axis, returns the node index
+int buildLightNode(LightList& list, const std::vector<RTXTriangle>& triangles, const std::vector<glm::vec3>& centroids,
+                   std::vector<int>& order, int begin, int end, int nodeIndex, uint32_t bitTrail, int depth)
+{
+    LightNode& node = list.nodes[nodeIndex];
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f), centroidMin(1e30f), centroidMax(-1e30f);
+    float power = 0.0f;
+    for (int i = begin; i < end; i++)
+    {
+        const RTXTriangle& tri = triangles[list.lights[order[i]].triangleIndex];
+        for (const glm::vec4* vertex : { &tri.a, &tri.b, &tri.c })
+        {
+            boundsMin = glm::min(boundsMin, glm::vec3(*vertex));
+            boundsMax = glm::max(boundsMax, glm::vec3(*vertex));
+        }
+        centroidMin = glm::min(centroidMin, centroids[order[i]]);
+        centroidMax = glm::max(centroidMax, centroids[order[i]]);
+        power += list.lights[order[i]].probability;
+    }
+    node.boundsMin = glm::vec4(boundsMin, power);
+    node.boundsMax = glm::vec4(boundsMax, 0.0f);
+    node.childIndex = -1;
+    node.lightIndex = -1;
+
+    if (end - begin == 1)
+    {
+        node.lightIndex = order[begin];
+        list.lights[order[begin]].bitTrail = bitTrail;
+        return nodeIndex;
+    }
+
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int middle = (begin + end) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+        [&](int left, int right) { return centroids[left][axis] < centroids[right][axis]; });
+
+    int childIndex = static_cast<int>(list.nodes.size());
+    list.nodes[nodeIndex].childIndex = childIndex;
+    list.nodes.resize(list.nodes.size() + 2);
+    buildLightNode(list, triangles, centroids, order, begin, middle, childIndex, bitTrail, depth + 1);
+    buildLightNode(list, triangles, centroids, order, middle, end, childIndex + 1, bitTrail | (1u << depth), depth + 1);
+    return nodeIndex;
+}
+
+// Call after the geometry BVH has reordered the triangles, their lightIndex gets set
+LightList buildLightList(std::vector<RTXTriangle>& triangles, const std::vector<Material>& materials)
+{
+    LightList list;
+    std::vector<double> powers;
+    double totalPower = 0.0;
+
+    for (int i = 0; i < static_cast<int>(triangles.size()); i++)
+    {
+        triangles[i].lightIndex = -1;
+        const Material& material = materials[triangles[i].materialIndex];
+        if (material.materialType != LIGHT)
+            continue;
+
+        double power = double(triangleArea(triangles[i])) * emittedLuminance(material);
+        if (power <= 0.0)
+            continue;
+
+        triangles[i].lightIndex = static_cast<int>(list.lights.size());
+        list.lights.push_back({ i, 0.0f, 1.0f, 0, 0u });
+        powers.push_back(power);
+        totalPower += power;
+    }
+    if (list.lights.empty())
+        return list;
+
+    for (size_t i = 0; i < list.lights.size(); i++)
+        list.lights[i].probability = float(powers[i] / totalPower);
+    list.totalPower = float(totalPower);
+    buildAliasTable(list.lights);
+
+    // A median split keeps the tree within the 32 levels bitTrail can hold
+    std::vector<glm::vec3> centroids(list.lights.size());
+    std::vector<int> order(list.lights.size());
+    for (size_t i = 0; i < list.lights.size(); i++)
+    {
+        const RTXTriangle& tri = triangles[list.lights[i].triangleIndex];
+        centroids[i] = glm::vec3(tri.a + tri.b + tri.c) / 3.0f;
+        order[i] = static_cast<int>(i);
+    }
+    list.nodes.reserve(2 * list.lights.size());
+    list.nodes.resize(1);
+    buildLightNode(list, triangles, centroids, order, 0, static_cast<int>(order.size()), 0, 0u, 0);
+    return list;
+}
+
+// How much a light BVH node is worth to a shading point: its power over the squared distance to its center, no
+// closer than half its diagonal so points inside or next to it don't blow up
+float lightNodeImportance(const LightNode& node, const glm::vec3& point)
+{
+    glm::vec3 boundsMin = glm::vec3(node.boundsMin);
+    glm::vec3 boundsMax = glm::vec3(node.boundsMax);
+    glm::vec3 toCenter = (boundsMin + boundsMax) * 0.5f - point;
+    glm::vec3 diagonal = boundsMax - boundsMin;
+    return node.boundsMin.w / std::max(glm::dot(toCenter, toCenter), glm::dot(diagonal, diagonal) * 0.25f);
+}
+
+// Chance to pick the first child of an inner node from point
+float lightFirstChildProbability(const LightList& list, const LightNode& node, const glm::vec3& point)
+{
+    float first = lightNodeImportance(list.nodes[node.childIndex], point);
+    float second = lightNodeImportance(list.nodes[node.childIndex + 1], point);
+    return first + second > 0.0f ? first / (first + second) : 0.5f;
+}
+
+// Index of the light picked with u in [0, 1), probability gets the chance it had
+int pickLight(const LightList& list, LightSampler sampler, const glm::vec3& point, float u, float& probability)
+{
+    if (sampler == LIGHT_SAMPLER_ALIAS)
+    {
+        int numLights = static_cast<int>(list.lights.size());
+        float scaled = u * numLights;
+        int slot = std::min(int(scaled), numLights - 1);
+        int index = scaled - slot < list.lights[slot].threshold ? slot : list.lights[slot].alias;
+        probability = list.lights[index].probability;
+        return index;
+    }
+
+    // Every choice rescales u back to [0, 1) for the next one
+    int nodeIndex = 0;
+    probability = 1.0f;
+    while (list.nodes[nodeIndex].childIndex >= 0)
+    {
+        const LightNode& node = list.nodes[nodeIndex];
+        float first = lightFirstChildProbability(list, node, point);
+        if (u < first)
+        {
+            u = u / first;
+            probability *= first;
+            nodeIndex = node.childIndex;
+        }
+        else
+        {
+            u = (u - first) / (1.0f - first);
+            probability *= 1.0f - first;
+            nodeIndex = node.childIndex + 1;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    return list.nodes[nodeIndex].lightIndex;
+}
+
+// The chance pickLight() picks a light from point
+float lightProbability(const LightList& list, LightSampler sampler, const glm::vec3& point, int lightIndex)
+{
+    if (sampler == LIGHT_SAMPLER_ALIAS)
+        return list.lights[lightIndex].probability;
+
+    uint32_t bitTrail = list.lights[lightIndex].bitTrail;
+    int nodeIndex = 0;
+    float probability = 1.0f;
+    while (list.nodes[nodeIndex].childIndex >= 0)
+    {
+        const LightNode& node = list.nodes[nodeIndex];
+        float first = lightFirstChildProbability(list, node, point);
+        bool second = bitTrail & 1u;
+        probability *= second ? 1.0f - first : first;
+        nodeIndex = node.childIndex + second;
+        bitTrail >>= 1;
+    }
+    return probability;
+}
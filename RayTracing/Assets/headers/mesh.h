@@ -10,8 +10,8 @@
 #include <cstring>
 #include <map>
 
-#include <textureClass.h>
 #include <filesUtil/myFile.h>
+#include <profiling/traceRecorder.h>
 
 const int DIFFUSE = 0;
 const int SPECULAR = 1;
@@ -98,7 +98,7 @@ struct RTXTriangle
     glm::vec2 bTex;
     glm::vec2 cTex;
     int materialIndex;
-    float pad; // 80 bytes
+    int lightIndex = -1; // Its entry in LightList::lights, -1 for triangles that emit nothing. 80 bytes
 
     RTXTriangle(int matIndex, const glm::vec4& a_, const glm::vec4& b_, const glm::vec4& c_,
             const glm::vec2& aTex_, const glm::vec2& bTex_, const glm::vec2& cTex_) 
@@ -197,16 +197,15 @@ int find(const std::string& str, int startPos, char chr)
     return -1;
 }
 
-void getTrianglesData_(const std::string& folderRelativePath, int dirUpTraversal,
+// Parses the OBJ/MTL files of a model folder, the model's textures are only located (not decoded) so that
+// both the OpenGL renderer and the CPU renderer can load them the way they need
+void getTrianglesData_(const std::string& folderPath,
                         std::vector<RTXTriangle>& rtxTriangles, std::vector<BVHTriangle>& bvhTriangles,
-                        std::vector<Material>& materials, std::vector<Texture2D>& textures)
+                        std::vector<Material>& materials, std::vector<std::string>& texturePaths)
 {
-    size_t namePosStart = folderRelativePath.find_last_of('\\') + 1;
-    size_t namePosEnd = folderRelativePath.find_last_of('.');
-    std::string fileName = folderRelativePath.substr(namePosStart, namePosEnd);
-
-    std::string folderPath = getPath(folderRelativePath, dirUpTraversal);
-    std::string objFilePath = folderPath + "\\" + fileName + ".obj";
+    fs::path folder = toNativePath(folderPath);
+    std::string fileName = folder.filename().string();
+    std::string objFilePath = (folder / (fileName + ".obj")).string();
 
     std::ifstream objFileStream(objFilePath);
 
@@ -218,23 +217,24 @@ void getTrianglesData_(const std::string& folderRelativePath, int dirUpTraversal
     }
 
     std::cout << "Loading model, please wait..." << std::endl;
+    TraceScope loadScope("load model", "load");
 
     // Texture files
     std::map<std::string, int> texFileToIndex;
-    std::vector<std::string> textureNames = getFilenamesInFolder(folderPath + "\\textures");
+    std::vector<std::string> textureNames = getFilenamesInFolder((folder / "textures").string());
     for (int i = 0; i < textureNames.size(); i++)
     {
         texFileToIndex[textureNames[i]] = i;
-        Texture2D texture(folderPath + "\\textures\\" + textureNames[i], GL_TEXTURE0 + i);
-        textures.push_back(texture);
+        texturePaths.push_back((folder / "textures" / textureNames[i]).string());
     }
 
     // MTL files
+    TraceScope mtlScope("parse MTL", "load");
     std::map<std::string, std::map<std::string, Material>> libToMtlMaps;
     Material defaultMtl = Material();
     defaultMtl.index = 0;
     libToMtlMaps["_default_"]["_default_"] = defaultMtl ;
-    std::vector<std::string> mtlFileNames = getFilenamesInFolder(folderPath);
+    std::vector<std::string> mtlFileNames = getFilenamesInFolder(folder.string());
     int matIndex = 0;
 
     for (const std::string& name : mtlFileNames)
@@ -250,7 +250,7 @@ void getTrianglesData_(const std::string& folderRelativePath, int dirUpTraversal
         if (name.substr(dotPos + 1) != "mtl")
             continue;
 
-        std::ifstream mtlFileStream(folderPath + "\\" + name);
+        std::ifstream mtlFileStream((folder / name).string());
 
         std::string mtlName;
 
@@ -311,7 +311,10 @@ void getTrianglesData_(const std::string& folderRelativePath, int dirUpTraversal
         }
     }
 
+    mtlScope.End();
+
     // OBJ file
+    TraceScope objScope("parse OBJ", "load");
     std::vector<glm::vec3> verts;
     std::vector<glm::vec2> texCoords;
 
@@ -425,5 +428,6 @@ void getTrianglesData_(const std::string& folderRelativePath, int dirUpTraversal
             bvhTriangles.push_back(BVHTriangle(trianglePoints[0], trianglePoints[1], trianglePoints[2]));
         }
     }
+    objScope.End();
     std::cout << bvhTriangles.size() << " triangles loaded" << std::endl;
 }
\ No newline at end of file
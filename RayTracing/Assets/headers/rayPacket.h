@@ -0,0 +1,375 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/simd.h>
+#include <RayTracing/Assets/headers/cpuTracer.h>
+
+// Ray packets: camera rays of neighbouring pixels are traversed through the BVH together, one ray per SIMD lane,
+// so every node is fetched and tested once for the whole packet instead of once per ray. Only the first hit of
+// each camera ray is found this way, the bounces after it diverge and continue as single rays in CPUTracer::trace.
+
+template <typename SimdT>
+struct RayPacket
+{
+    static const int size = SimdT::width;
+
+    float originX[size];
+    float originY[size];
+    float originZ[size];
+    float directionX[size];
+    float directionY[size];
+    float directionZ[size];
+    float tMax[size];
+    int triangleIndex[size];
+    int activeBits = 0;
+
+    // When every ray starts at the same point (no defocus blur) the packet is bounded by 4 planes through that
+    // point, nodes outside of them are skipped without testing any ray
+    bool hasFrustum = false;
+    glm::vec3 frustumOrigin;
+    glm::vec3 frustumNormals[4];
+
+    void setRay(int lane, const Ray& ray)
+    {
+        originX[lane] = ray.origin.x;
+        originY[lane] = ray.origin.y;
+        originZ[lane] = ray.origin.z;
+        directionX[lane] = ray.direction.x;
+        directionY[lane] = ray.direction.y;
+        directionZ[lane] = ray.direction.z;
+        tMax[lane] = 1e38f;
+        triangleIndex[lane] = -1;
+        activeBits |= 1 << lane;
+    }
+
+    // Lanes past the last ray repeat the first one, they stay inactive but never feed garbage into the math
+    void padInactiveLanes()
+    {
+        for (int lane = 0; lane < size; lane++)
+        {
+            if ((activeBits >> lane) & 1)
+                continue;
+            originX[lane] = originX[0];
+            originY[lane] = originY[0];
+            originZ[lane] = originZ[0];
+            directionX[lane] = directionX[0];
+            directionY[lane] = directionY[0];
+            directionZ[lane] = directionZ[0];
+            tMax[lane] = 1e38f;
+            triangleIndex[lane] = -1;
+        }
+    }
+
+    Ray getRay(int lane) const
+    {
+        Ray ray;
+        ray.origin = glm::vec3(originX[lane], originY[lane], originZ[lane]);
+        ray.direction = glm::vec3(directionX[lane], directionY[lane], directionZ[lane]);
+        ray.insideGlass = false;
+        return ray;
+    }
+};
+
+// front, right and up span the camera, rays are written as front + a * right + b * up and the planes go through
+// the smallest and largest a and b of the packet
+template <typename SimdT>
+void buildPacketFrustum(RayPacket<SimdT>& packet, const glm::vec3& front, const glm::vec3& right, const glm::vec3& up)
+{
+    packet.hasFrustum = false;
+    if (packet.activeBits == 0)
+        return;
+
+    float aMin = 1e30f, aMax = -1e30f, bMin = 1e30f, bMax = -1e30f;
+    int firstLane = -1;
+    for (int lane = 0; lane < packet.size; lane++)
+    {
+        if (!((packet.activeBits >> lane) & 1))
+            continue;
+
+        glm::vec3 origin = glm::vec3(packet.originX[lane], packet.originY[lane], packet.originZ[lane]);
+        if (firstLane == -1)
+        {
+            firstLane = lane;
+            packet.frustumOrigin = origin;
+        }
+        else if (origin != packet.frustumOrigin)
+            return;
+
+        glm::vec3 direction = glm::vec3(packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane]);
+        float forward = glm::dot(direction, front);
+        if (forward <= 1e-6f)
+            return;
+        float a = glm::dot(direction, right) / forward;
+        float b = glm::dot(direction, up) / forward;
+        aMin = std::min(aMin, a);
+        aMax = std::max(aMax, a);
+        bMin = std::min(bMin, b);
+        bMax = std::max(bMax, b);
+    }
+
+    // Slightly widened so rounding can never cull a node one of the rays would hit
+    float epsilon = 1e-4f;
+    aMin -= epsilon * (1.0f + std::fabs(aMin));
+    aMax += epsilon * (1.0f + std::fabs(aMax));
+    bMin -= epsilon * (1.0f + std::fabs(bMin));
+    bMax += epsilon * (1.0f + std::fabs(bMax));
+
+    glm::vec3 inside = front + right * ((aMin + aMax) * 0.5f) + up * ((bMin + bMax) * 0.5f);
+    glm::vec3 normals[4] =
+    {
+        glm::cross(up, front + right * aMin),
+        glm::cross(up, front + right * aMax),
+        glm::cross(right, front + up * bMin),
+        glm::cross(right, front + up * bMax)
+    };
+    for (int i = 0; i < 4; i++)
+        packet.frustumNormals[i] = glm::dot(normals[i], inside) < 0.0f ? -normals[i] : normals[i];
+
+    packet.hasFrustum = true;
+}
+
+template <typename SimdT>
+bool isOutsideFrustum(const RayPacket<SimdT>& packet, const BoundingBox& bounds)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        const glm::vec3& n = packet.frustumNormals[i];
+        // Corner of the box the furthest along the plane's normal
+        glm::vec3 corner = glm::vec3(n.x >= 0.0f ? bounds.max.x : bounds.min.x,
+                                     n.y >= 0.0f ? bounds.max.y : bounds.min.y,
+                                     n.z >= 0.0f ? bounds.max.z : bounds.min.z);
+        if (glm::dot(n, corner - packet.frustumOrigin) < 0.0f)
+            return true;
+    }
+    return false;
+}
+
+// Packet version of CPUTracer::calculateRayCollisionBVH, leaves the closest triangle of every lane in triangleIndex
+template <typename SimdT>
+void intersectPacketSimd(const CPUTracer& tracer, RayPacket<SimdT>& packet)
+{
+    typedef typename SimdT::Mask Mask;
+
+    SimdT ox = SimdT::load(packet.originX);
+    SimdT oy = SimdT::load(packet.originY);
+    SimdT oz = SimdT::load(packet.originZ);
+    SimdT dx = SimdT::load(packet.directionX);
+    SimdT dy = SimdT::load(packet.directionY);
+    SimdT dz = SimdT::load(packet.directionZ);
+    SimdT tMax = SimdT::load(packet.tMax);
+
+    // Axis parallel directions get a huge but finite inverse so the slab test never computes 0 * inf
+    float invDirection[3][SimdT::width];
+    for (int lane = 0; lane < SimdT::width; lane++)
+    {
+        float direction[3] = { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+        for (int axis = 0; axis < 3; axis++)
+            invDirection[axis][lane] = 1.0f / (isCloseToZero(direction[axis]) ? std::copysign(1e-30f, direction[axis]) : direction[axis]);
+    }
+    SimdT ix = SimdT::load(invDirection[0]);
+    SimdT iy = SimdT::load(invDirection[1]);
+    SimdT iz = SimdT::load(invDirection[2]);
+
+    const SimdT zero = SimdT(0.0f);
+    const SimdT one = SimdT(1.0f);
+    const SimdT detEpsilon = SimdT(1e-10f);
+    const Mask active = Mask::fromBits(packet.activeBits);
+
+    int stack[2 * MAX_DEPTH];
+    int stackIndex = 0;
+    stack[stackIndex++] = 0;
+
+    while (stackIndex > 0)
+    {
+        const Node& node = tracer.allNodes[stack[--stackIndex]];
+        const BoundingBox& bounds = node.bounds;
+
+        if (packet.hasFrustum && isOutsideFrustum(packet, bounds))
+            continue;
+
+        SimdT t0x = (SimdT(bounds.min.x) - ox) * ix;
+        SimdT t1x = (SimdT(bounds.max.x) - ox) * ix;
+        SimdT t0y = (SimdT(bounds.min.y) - oy) * iy;
+        SimdT t1y = (SimdT(bounds.max.y) - oy) * iy;
+        SimdT t0z = (SimdT(bounds.min.z) - oz) * iz;
+        SimdT t1z = (SimdT(bounds.max.z) - oz) * iz;
+        SimdT tNear = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), zero));
+        SimdT tFar = min(min(max(t0x, t1x), max(t0y, t1y)), max(t0z, t1z));
+        Mask hitBounds = active & (tNear <= tFar) & (tNear < tMax);
+
+        if (!hitBounds.any())
+            continue;
+
+        if (node.childIndex == -1)
+        {
+            for (int i = node.triangleIndex; i < node.triangleIndex + node.triangleCount; i++)
+            {
+                const RTXTriangle& tri = tracer.triangles[i];
+                glm::vec3 a = glm::vec3(tri.a);
+                glm::vec3 e0 = glm::vec3(tri.b) - a;
+                glm::vec3 e1 = glm::vec3(tri.c) - a;
+                glm::vec3 n = glm::cross(e0, e1);
+
+                SimdT det = zero - (dx * SimdT(n.x) + dy * SimdT(n.y) + dz * SimdT(n.z));
+                SimdT invDet = one / det;
+                SimdT aox = ox - SimdT(a.x);
+                SimdT aoy = oy - SimdT(a.y);
+                SimdT aoz = oz - SimdT(a.z);
+                SimdT dst = (aox * SimdT(n.x) + aoy * SimdT(n.y) + aoz * SimdT(n.z)) * invDet;
+
+                SimdT cx = dy * aoz - dz * aoy;
+                SimdT cy = dz * aox - dx * aoz;
+                SimdT cz = dx * aoy - dy * aox;
+                SimdT u = zero - (SimdT(e1.x) * cx + SimdT(e1.y) * cy + SimdT(e1.z) * cz) * invDet;
+                SimdT v = (SimdT(e0.x) * cx + SimdT(e0.y) * cy + SimdT(e0.z) * cz) * invDet;
+
+                Mask hitTriangle = hitBounds & (det >= detEpsilon) & (dst > zero) & (dst < tMax)
+                    & (u >= zero) & (v >= zero) & ((one - u - v) >= zero);
+
+                int bits = hitTriangle.bits();
+                if (bits == 0)
+                    continue;
+
+                tMax = select(hitTriangle, dst, tMax);
+                for (int lane = 0; lane < SimdT::width; lane++)
+                    if ((bits >> lane) & 1)
+                        packet.triangleIndex[lane] = i;
+            }
+        }
+        else
+        {
+            // Visit the child closer to the packet first so tMax shrinks early, the farther one is pushed first
+            const Node& childA = tracer.allNodes[node.childIndex];
+            const Node& childB = tracer.allNodes[node.childIndex + 1];
+            glm::vec3 origin = glm::vec3(packet.originX[0], packet.originY[0], packet.originZ[0]);
+            glm::vec3 direction = glm::vec3(packet.directionX[0], packet.directionY[0], packet.directionZ[0]);
+            bool isNearestA = glm::dot(childA.bounds.center() - origin, direction) < glm::dot(childB.bounds.center() - origin, direction);
+
+            stack[stackIndex++] = isNearestA ? node.childIndex + 1 : node.childIndex;
+            stack[stackIndex++] = isNearestA ? node.childIndex : node.childIndex + 1;
+        }
+    }
+
+    tMax.store(packet.tMax);
+}
+
+// One entry per instruction set, compiled for it
+#ifdef SIMD_SSE
+void intersectPacket(const CPUTracer& tracer, RayPacket<SimdFloat4>& packet) { intersectPacketSimd(tracer, packet); }
+#endif
+#ifdef SIMD_AVX2
+SIMD_TARGET_AVX2 void intersectPacket(const CPUTracer& tracer, RayPacket<SimdFloat8>& packet) { intersectPacketSimd(tracer, packet); }
+#endif
+#ifdef SIMD_AVX512
+SIMD_TARGET_AVX512 void intersectPacket(const CPUTracer& tracer, RayPacket<SimdFloat16>& packet) { intersectPacketSimd(tracer, packet); }
+#endif
+
+// Same HitInfo the single ray traversal would have returned for a lane of an intersected packet
+template <typename SimdT>
+HitInfo packetHitInfo(const CPUTracer& tracer, const RayPacket<SimdT>& packet, int lane)
+{
+    int index = packet.triangleIndex[lane];
+    if (index < 0)
+        return HitInfo();
+
+    HitInfo hitInfo = rayTriangleIntersect(packet.getRay(lane), tracer.triangles[index], index);
+    // The SIMD and scalar tests round differently, for the rare ray on the edge of a triangle trust the scalar traversal
+    return hitInfo.didHit ? hitInfo : tracer.calculateRayCollisionBVH(packet.getRay(lane));
+}
+
+// Renders count (up to SimdT::width) pixels the way CPUTracer::renderPixel does, but with the camera rays of all
+// pixels traced as one packet per sample
+template <typename SimdT>
+void renderPacket(const CPUTracer& tracer, const GlobalUniforms& uniforms, const int* texelX, const int* texelY, int count, glm::vec3* colors)
+{
+    const int N = SimdT::width;
+    glm::vec3 front = glm::normalize(glm::vec3(uniforms.viewportFront));
+    glm::vec3 right = glm::normalize(glm::vec3(uniforms.viewportRight));
+    glm::vec3 up = glm::normalize(glm::vec3(uniforms.viewportUp));
+
+    RayPacket<SimdT> packet;
+    Ray rays[N];
+
+    if (uniforms.basicShading)
+    {
+        for (int lane = 0; lane < count; lane++)
+        {
+            rays[lane] = tracer.generateCenterRay(uniforms, texelX[lane], texelY[lane]);
+            packet.setRay(lane, rays[lane]);
+        }
+        packet.padInactiveLanes();
+        buildPacketFrustum(packet, front, right, up);
+        intersectPacket(tracer, packet);
+
+        for (int lane = 0; lane < count; lane++)
+        {
+            HitInfo firstHit = packetHitInfo(tracer, packet, lane);
+            colors[lane] = tracer.traceBasic(rays[lane], uniforms, &firstHit);
+        }
+        return;
+    }
+
+    PixelSampler samplers[N];
+    for (int lane = 0; lane < count; lane++)
+    {
+        samplers[lane] = tracer.pixelSampler(uniforms, texelX[lane], texelY[lane]);
+        colors[lane] = glm::vec3(0.0f);
+    }
+
+    for (int i = 0; i < uniforms.numRaysPerPixel; i++)
+    {
+        packet.activeBits = 0;
+        for (int lane = 0; lane < count; lane++)
+        {
+            rays[lane] = tracer.generateCameraRay(uniforms, texelX[lane], texelY[lane], samplers[lane]);
+            packet.setRay(lane, rays[lane]);
+        }
+        packet.padInactiveLanes();
+        buildPacketFrustum(packet, front, right, up);
+        intersectPacket(tracer, packet);
+
+        for (int lane = 0; lane < count; lane++)
+        {
+            HitInfo firstHit = packetHitInfo(tracer, packet, lane);
+            colors[lane] += tracer.trace(rays[lane], samplers[lane], uniforms, &firstHit);
+        }
+    }
+
+    for (int lane = 0; lane < count; lane++)
+        colors[lane] /= float(uniforms.numRaysPerPixel);
+}
+
+// Packets cover a small block of pixels, as square as the width allows
+void packetBlockSize(int packetWidth, int& blockWidth, int& blockHeight)
+{
+    switch (packetWidth)
+    {
+        case 16: blockWidth = 4; blockHeight = 4; break;
+        case 8: blockWidth = 4; blockHeight = 2; break;
+        case 4: blockWidth = 2; blockHeight = 2; break;
+        default: blockWidth = 1; blockHeight = 1; break;
+    }
+}
+
+// packetWidth has to be a width returned by supportedSimdWidth(), 1 traces every ray on its own
+void renderPixels(int packetWidth, const CPUTracer& tracer, const GlobalUniforms& uniforms, const int* texelX, const int* texelY, int count, glm::vec3* colors)
+{
+    switch (packetWidth)
+    {
+#ifdef SIMD_AVX512
+        case 16: renderPacket<SimdFloat16>(tracer, uniforms, texelX, texelY, count, colors); return;
+#endif
+#ifdef SIMD_AVX2
+        case 8: renderPacket<SimdFloat8>(tracer, uniforms, texelX, texelY, count, colors); return;
+#endif
+#ifdef SIMD_SSE
+        case 4: renderPacket<SimdFloat4>(tracer, uniforms, texelX, texelY, count, colors); return;
+#endif
+        default:
+            for (int i = 0; i < count; i++)
+                colors[i] = tracer.renderPixel(uniforms, texelX[i], texelY[i]);
+    }
+}
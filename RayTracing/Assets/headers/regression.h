@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "stb/stb_image.h"
+
+#include <filesUtil/myFile.h>
+#include <RayTracing/Assets/headers/imageOutput.h>
+
+// Golden image checks of the headless renderer. A render is compared with a stored reference image in the 8-bit values
+// both were written with, the root mean square difference (0 to 1) has to stay within a tolerance. Deterministic
+// renders of the same build match their reference exactly, the tolerance leaves room for other compilers and CPUs.
+// A missing reference is an error, unless the caller asks for it to be recorded from the render.
+
+struct ImageDifference
+{
+    bool created = false; // There was no reference yet, the render became it
+    float rootMeanSquare = 0.0f;
+    int maxDifference = 0; // In 8-bit steps
+    int numDifferent = 0;  // Channels that are not the same byte
+};
+
+bool compareWithReference(const std::string& referencePath, const std::vector<glm::vec3>& image, int width, int height, bool createMissing,
+    ImageDifference& difference)
+{
+    difference = ImageDifference();
+    fs::path path = toNativePath(referencePath);
+    if (!fs::exists(path))
+    {
+        if (!createMissing)
+        {
+            std::cerr << "Missing reference image: " << path.string() << " (--set createReferences=1 records it from the render)" << std::endl;
+            return false;
+        }
+        difference.created = true;
+        return writeImage(referencePath, image, width, height);
+    }
+
+    int referenceWidth, referenceHeight, numColCh;
+    unsigned char* reference = stbi_load(path.string().c_str(), &referenceWidth, &referenceHeight, &numColCh, 3);
+    if (!reference)
+    {
+        std::cerr << "Failed to load reference image: " << path.string() << std::endl;
+        return false;
+    }
+    if (referenceWidth != width || referenceHeight != height)
+    {
+        std::cerr << "Reference image is " << referenceWidth << "x" << referenceHeight << ", the render " << width << "x" << height
+            << ": " << path.string() << std::endl;
+        stbi_image_free(reference);
+        return false;
+    }
+
+    double sumSquares = 0.0;
+    for (int i = 0; i < width * height; i++)
+        for (int channel = 0; channel < 3; channel++)
+        {
+            int delta = std::abs(int(toByte(image[i][channel])) - int(reference[3 * i + channel]));
+            sumSquares += double(delta) * delta;
+            difference.maxDifference = std::max(difference.maxDifference, delta);
+            difference.numDifferent += delta != 0;
+        }
+    stbi_image_free(reference);
+
+    difference.rootMeanSquare = float(std::sqrt(sumSquares / (3.0 * width * height)) / 255.0);
+    return true;
+}
+
+// One line per comparison, e.g. "toonHouse_cornell: 0.0012 RMS, 3 max, 41 channels differ"
+std::string describeImageDifference(const std::string& name, const ImageDifference& difference, float tolerance)
+{
+    if (difference.created)
+        return name + ": reference created";
+
+    std::stringstream line;
+    line << name << ": " << difference.rootMeanSquare << " RMS, " << difference.maxDifference << " max, "
+        << difference.numDifferent << " channels differ" << (difference.rootMeanSquare > tolerance ? " - FAILED" : "");
+    return line.str();
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include <math/math_util.h>
+#include <filesUtil/myFile.h>
+#include <RayTracing/Assets/headers/camera.h>
+
+// Everything the interactive renderer keeps in compile-time constants, loaded from a scene file instead.
+// A scene file has one "key value" pair per line, '#' starts a comment, e.g.
+//
+//     model toonHouse
+//     width 1920
+//     height 1080
+//     raysPerPixel 20
+//     cameraPosition 0 5 10
+//
+// Angles are in radians, just like the Camera class uses them.
+struct RenderSettings
+{
+    // Scene
+    std::string model = "toonHouse";
+    std::string dataFolder = ""; // Empty means RayTracing/Data next to the executable
+    bool cornellBox = true;
+    float cornellLightBrightness = 10.0f;
+    float cornellPadding = 0.25f;
+    float cornellLightSize = 0.3f;
+    bool skyLight = false;
+
+    // Output
+    int width = 1000;
+    int height = 1000;
+    std::string output = "test.png";
+    std::string reference = ""; // Golden image the render is compared with, empty to skip it
+    float referenceTolerance = 0.01f; // Root mean square difference (0 to 1) to the reference that still passes
+    bool createReferences = false; // Missing references (of reference and --regression) are recorded from the render instead of failing
+
+    // Tracing
+    bool basicShading = false;
+    bool basicShadingShadow = false;
+    glm::vec3 lightPosition = glm::vec3(10.0f, 10.0f, 1.0f);
+    bool environmentalLight = false;
+    int maxBounceCount = 20;
+    bool nextEventEstimation = true; // Shadow rays towards the emissive triangles at every diffuse hit
+    bool occlusionStats = false; // Compares occlusion queries to closest hit traversals for the shadow rays of the first hits
+    std::string traversalHeatmap = ""; // Writes heatmaps <name>_primary_*.png of the BVH work per pixel and prints histograms, <name>_path_*.png with -DTRAVERSAL_STATS
+    std::string lightSampler = "alias"; // How the light of a shadow ray is picked: alias (by power) or bvh (by power and distance)
+    std::string sampler = "sobol"; // Random numbers of the paths: sobol, bluenoise or pcg
+    int seed = 0; // Every seed gives its own noise, the same seed always the same image
+    bool deterministic = false; // Scalar kernels only and a hash of the image, see README
+    int raysPerPixel = 20;
+    int frames = 20;
+    int threads = 0; // 0 means one per hardware thread
+    int tileSize = 32; // Pixels, tiles are the unit of work the render threads take and steal
+    std::string tileOrder = "morton"; // morton, hilbert or scanline
+    std::string tileTimings = ""; // CSV file with the render time of every tile, empty to skip it
+    std::string trace = ""; // Chrome trace of the scene loading, every tile and the denoiser, empty to skip it
+    int packetWidth = 0; // Camera rays traced together: 4 (SSE), 8 (AVX2), 16 (AVX-512), 1 for single rays, 0 for the widest available
+    int kernelWidth = 0; // BVH children tested at once by a single ray: 4 (SSE), 8 (AVX2), 1 for the binary BVH, 0 for the widest available
+    bool wavefront = false; // Traces the paths of a tile stage by stage instead of one path at a time
+    std::string raySort = "none"; // Wavefront bounce ray order: none, octant or morton
+    int raySortBatch = 0; // Bounce rays sorted together, 0 sorts all the paths of a tile at once
+    bool adaptive = false; // Frames become passes that only go to pixels whose noise is still above adaptiveThreshold
+    float adaptiveThreshold = 0.01f; // Standard error of a pixel's brightness (0 to 1) at which it stops getting samples
+    int adaptiveMinPasses = 4; // Passes every pixel gets before its variance estimate is trusted
+    std::string sampleHeatmap = ""; // Image of the passes every pixel got with adaptive sampling, empty to skip it
+
+    // Denoising
+    bool denoise = false; // Filters the finished image guided by the albedo, normal and depth of the first hits
+    int denoiseIterations = 5;
+    float denoiseColorSigma = 16.0f; // Illumination is compared after dividing by the albedo, so it easily goes past 1
+    float denoiseDepthSigma = 0.05f;
+    std::string featureOutput = ""; // Writes <featureOutput>_albedo.png, _normal.png and _depth.png, empty to skip them
+
+    // Sequences, see cameraPath.h
+    std::string cameraPath = ""; // Keyframe file, renders sequenceFrames images <output>_0000.png and on instead of one
+    int sequenceFrames = 60;
+    int writerThreads = 2; // Background threads encoding the images of a sequence
+    std::string stream = ""; // Sends the frames to stdout (-), a file or a named pipe instead of writing images, see frameStream.h
+    std::string streamFormat = "y4m"; // rgb, rgba or y4m
+    int streamFps = 30;
+
+    // Large prints
+    int bandHeight = 0; // Rows rendered and written to a png or exr output at once, so only they are in memory, 0 keeps the whole image
+
+    // Distributed rendering, see distributed.h
+    int coordinatorPort = 0; // Hands the render out to workers connecting on this port, 0 renders locally
+    int jobSize = 128; // Pixels, a job is the square of the image a worker renders at once
+    int jobFrames = 0; // Frames of a job, 0 gives every job all the frames (always with deterministic)
+    float workerTimeout = 30.0f; // Seconds a worker may send nothing, not even the heartbeat it sends while busy, before it counts as dead
+    float workerWait = 10.0f; // Seconds without any worker after which the coordinator renders jobs itself, also how long a worker tries to connect
+
+    // Camera
+    glm::vec3 cameraPosition = glm::vec3(0.0f, 5.0f, 10.0f);
+    float hfov = PI / 6;
+    float pitch = 0.0f;
+    float yaw = PI / 2.0f;
+    float focusDistance = 20.0f;
+    float defocusAngle = 0.0f;
+    float zoom = 1.0f;
+};
+
+bool parseSettingValue(std::istream& in, bool& value)
+{
+    std::string token;
+    in >> token;
+    if (token == "1" || token == "true" || token == "on")
+        value = true;
+    else if (token == "0" || token == "false" || token == "off")
+        value = false;
+    else
+        return false;
+    return true;
+}
+
+bool parseSettingValue(std::istream& in, int& value)
+{
+    return static_cast<bool>(in >> value);
+}
+
+bool parseSettingValue(std::istream& in, float& value)
+{
+    return static_cast<bool>(in >> value);
+}
+
+bool parseSettingValue(std::istream& in, std::string& value)
+{
+    return static_cast<bool>(in >> value);
+}
+
+bool parseSettingValue(std::istream& in, glm::vec3& value)
+{
+    return static_cast<bool>(in >> value.x >> value.y >> value.z);
+}
+
+// Sets a single setting from its textual value, used for both scene files and command line overrides
+bool applySetting(RenderSettings& settings, const std::string& key, std::istream& in)
+{
+    if (key == "model") return parseSettingValue(in, settings.model);
+    if (key == "dataFolder") return parseSettingValue(in, settings.dataFolder);
+    if (key == "cornellBox") return parseSettingValue(in, settings.cornellBox);
+    if (key == "cornellLightBrightness") return parseSettingValue(in, settings.cornellLightBrightness);
+    if (key == "cornellPadding") return parseSettingValue(in, settings.cornellPadding);
+    if (key == "cornellLightSize") return parseSettingValue(in, settings.cornellLightSize);
+    if (key == "skyLight") return parseSettingValue(in, settings.skyLight);
+
+    if (key == "width") return parseSettingValue(in, settings.width);
+    if (key == "height") return parseSettingValue(in, settings.height);
+    if (key == "output") return parseSettingValue(in, settings.output);
+    if (key == "reference") return parseSettingValue(in, settings.reference);
+    if (key == "referenceTolerance") return parseSettingValue(in, settings.referenceTolerance);
+    if (key == "createReferences") return parseSettingValue(in, settings.createReferences);
+
+    if (key == "basicShading") return parseSettingValue(in, settings.basicShading);
+    if (key == "basicShadingShadow") return parseSettingValue(in, settings.basicShadingShadow);
+    if (key == "lightPosition") return parseSettingValue(in, settings.lightPosition);
+    if (key == "environmentalLight") return parseSettingValue(in, settings.environmentalLight);
+    if (key == "maxBounceCount") return parseSettingValue(in, settings.maxBounceCount);
+    if (key == "nextEventEstimation") return parseSettingValue(in, settings.nextEventEstimation);
+    if (key == "occlusionStats") return parseSettingValue(in, settings.occlusionStats);
+    if (key == "traversalHeatmap") return parseSettingValue(in, settings.traversalHeatmap);
+    if (key == "trace") return parseSettingValue(in, settings.trace);
+    if (key == "lightSampler") return parseSettingValue(in, settings.lightSampler);
+    if (key == "sampler") return parseSettingValue(in, settings.sampler);
+    if (key == "seed") return parseSettingValue(in, settings.seed);
+    if (key == "deterministic") return parseSettingValue(in, settings.deterministic);
+    if (key == "raysPerPixel") return parseSettingValue(in, settings.raysPerPixel);
+    if (key == "frames") return parseSettingValue(in, settings.frames);
+    if (key == "threads") return parseSettingValue(in, settings.threads);
+    if (key == "tileSize") return parseSettingValue(in, settings.tileSize);
+    if (key == "tileOrder") return parseSettingValue(in, settings.tileOrder);
+    if (key == "tileTimings") return parseSettingValue(in, settings.tileTimings);
+    if (key == "packetWidth") return parseSettingValue(in, settings.packetWidth);
+    if (key == "kernelWidth") return parseSettingValue(in, settings.kernelWidth);
+    if (key == "wavefront") return parseSettingValue(in, settings.wavefront);
+    if (key == "raySort") return parseSettingValue(in, settings.raySort);
+    if (key == "raySortBatch") return parseSettingValue(in, settings.raySortBatch);
+    if (key == "adaptive") return parseSettingValue(in, settings.adaptive);
+    if (key == "adaptiveThreshold") return parseSettingValue(in, settings.adaptiveThreshold);
+    if (key == "adaptiveMinPasses") return parseSettingValue(in, settings.adaptiveMinPasses);
+    if (key == "sampleHeatmap") return parseSettingValue(in, settings.sampleHeatmap);
+    if (key == "denoise") return parseSettingValue(in, settings.denoise);
+    if (key == "denoiseIterations") return parseSettingValue(in, settings.denoiseIterations);
+    if (key == "denoiseColorSigma") return parseSettingValue(in, settings.denoiseColorSigma);
+    if (key == "denoiseDepthSigma") return parseSettingValue(in, settings.denoiseDepthSigma);
+    if (key == "featureOutput") return parseSettingValue(in, settings.featureOutput);
+
+    if (key == "cameraPath") return parseSettingValue(in, settings.cameraPath);
+    if (key == "sequenceFrames") return parseSettingValue(in, settings.sequenceFrames);
+    if (key == "writerThreads") return parseSettingValue(in, settings.writerThreads);
+    if (key == "stream") return parseSettingValue(in, settings.stream);
+    if (key == "streamFormat") return parseSettingValue(in, settings.streamFormat);
+    if (key == "streamFps") return parseSettingValue(in, settings.streamFps);
+
+    if (key == "bandHeight") return parseSettingValue(in, settings.bandHeight);
+
+    if (key == "coordinatorPort") return parseSettingValue(in, settings.coordinatorPort);
+    if (key == "jobSize") return parseSettingValue(in, settings.jobSize);
+    if (key == "jobFrames") return parseSettingValue(in, settings.jobFrames);
+    if (key == "workerTimeout") return parseSettingValue(in, settings.workerTimeout);
+    if (key == "workerWait") return parseSettingValue(in, settings.workerWait);
+
+    if (key == "cameraPosition") return parseSettingValue(in, settings.cameraPosition);
+    if (key == "hfov") return parseSettingValue(in, settings.hfov);
+    if (key == "pitch") return parseSettingValue(in, settings.pitch);
+    if (key == "yaw") return parseSettingValue(in, settings.yaw);
+    if (key == "focusDistance") return parseSettingValue(in, settings.focusDistance);
+    if (key == "defocusAngle") return parseSettingValue(in, settings.defocusAngle);
+    if (key == "zoom") return parseSettingValue(in, settings.zoom);
+
+    std::cerr << "Unknown setting: " << key << std::endl;
+    return false;
+}
+
+// Parses "key=value" as given on the command line
+bool applySetting(RenderSettings& settings, const std::string& assignment)
+{
+    size_t equalPos = assignment.find('=');
+    if (equalPos == std::string::npos)
+    {
+        std::cerr << "Expected key=value, got: " << assignment << std::endl;
+        return false;
+    }
+
+    std::string key = assignment.substr(0, equalPos);
+    std::stringstream valueStream(assignment.substr(equalPos + 1));
+    if (!applySetting(settings, key, valueStream))
+    {
+        std::cerr << "Invalid value for setting " << key << ": " << assignment.substr(equalPos + 1) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Scene file contents, name is only used in error messages
+bool loadRenderSettings(std::istream& in, const std::string& name, RenderSettings& settings)
+{
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::stringstream strStream(line);
+        std::string key;
+        if (!(strStream >> key))
+            continue;
+
+        if (!applySetting(settings, key, strStream))
+        {
+            std::cerr << name << ":" << lineNumber << ": invalid line: " << line << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool loadRenderSettings(const std::string& path, RenderSettings& settings)
+{
+    std::ifstream fileStream(toNativePath(path));
+    if (!fileStream.is_open())
+    {
+        std::cerr << "Cannot open scene file: " << path << std::endl;
+        return false;
+    }
+    return loadRenderSettings(fileStream, path, settings);
+}
+
+Camera makeCamera(const RenderSettings& settings)
+{
+    return Camera(settings.width, settings.height, 10.0f, settings.cameraPosition, settings.hfov, settings.pitch, settings.yaw,
+                  settings.focusDistance, settings.defocusAngle, settings.zoom);
+}
+
+// Same uniforms the interactive renderer sends for a screenshot
+GlobalUniforms makeUniforms(const RenderSettings& settings, Camera& camera, int numTriangles, int numTextures)
+{
+    GlobalUniforms uniforms{};
+    uniforms.numTextures = numTextures;
+    uniforms.width = settings.width;
+    uniforms.height = settings.height;
+    uniforms.numSpheres = 0;
+    uniforms.numTriangles = numTriangles;
+    uniforms.basicShading = settings.basicShading;
+    uniforms.basicShadingShadow = settings.basicShadingShadow;
+    uniforms.basicShadingLightPosition = glm::vec4(settings.lightPosition, 0.0f);
+    uniforms.environmentalLight = settings.environmentalLight;
+    uniforms.maxBounceCount = settings.maxBounceCount;
+    uniforms.numRaysPerPixel = settings.raysPerPixel;
+    uniforms.frameIndex = 0;
+    uniforms.nextEventEstimation = settings.nextEventEstimation;
+    uniforms.seed = settings.seed;
+    camera.updateUniforms(uniforms);
+    return uniforms;
+}
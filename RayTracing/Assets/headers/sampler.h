@@ -0,0 +1,250 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <math/math_util.h>
+
+// Sample generation shared by the CPU tracer and compute.glsl. A path asks for its numbers by dimension: the camera
+// sample takes the pixel jitter and the lens point, every bounce a fixed slot for each decision (light choice, point
+// on the light, bounce direction, lobe, russian roulette) whether it needs it or not, so the same dimension always
+// drives the same decision across the samples of a pixel. The samplers:
+//  - SAMPLER_SOBOL: the first two Sobol dimensions with hash based Owen scrambling (Burley 2020). Every dimension
+//    pair shuffles the sample index and scrambles the points with its own seed, so the padded dimensions stay
+//    stratified without correlating with each other
+//  - SAMPLER_BLUE_NOISE: a rank-1 lattice (golden ratio and R2 generators) shifted per pixel by interleaved gradient
+//    noise, neighbouring pixels get different offsets so the error of low sample counts looks like blue noise. The
+//    lattice points are visited in a different order in every dimension, the same order would tie the decisions of a
+//    bounce together
+//  - SAMPLER_PCG: the PCG hash stream every number used to come from, in the order they are drawn
+// The points are stepped in 32 bit fixed point, so the CPU and the GPU agree on them. Nothing depends on the thread or
+// the order a pixel is rendered in, only on the pixel, its sample index and the seed of the render.
+
+enum SamplerType
+{
+    SAMPLER_PCG,
+    SAMPLER_SOBOL,
+    SAMPLER_BLUE_NOISE
+};
+
+bool parseSamplerType(const std::string& name, SamplerType& type)
+{
+    if (name == "pcg") type = SAMPLER_PCG;
+    else if (name == "sobol") type = SAMPLER_SOBOL;
+    else if (name == "bluenoise") type = SAMPLER_BLUE_NOISE;
+    else
+    {
+        std::cerr << "Unknown sampler: " << name << " (pcg, sobol or bluenoise)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Slots of the numbers a path draws, 1D or 2D each
+enum SampleDimension
+{
+    DIMENSION_PIXEL,
+    DIMENSION_LENS,
+    NUM_CAMERA_DIMENSIONS,
+
+    // Per bounce, after the camera dimensions
+    DIMENSION_LIGHT_CHOICE = 0,
+    DIMENSION_LIGHT_POINT,
+    DIMENSION_DIRECTION,
+    DIMENSION_LOBE,
+    DIMENSION_ROULETTE,
+    NUM_BOUNCE_DIMENSIONS
+};
+
+float random(uint32_t& state)
+{
+    state = state * 747796405u + 2891336453u;
+    uint32_t result = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    result = (result >> 22u) ^ result;
+    return result / 4294967295.0f; // 2^32 - 1
+}
+
+float random(float left, float right, uint32_t& state)
+{
+    return left + (right - left) * random(state);
+}
+
+uint32_t hashInt(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras style hash that only lets every bit depend on the bits below it
+uint32_t laineKarrasPermutation(uint32_t x, uint32_t key)
+{
+    x += key;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling of a 0.32 fixed point number: every bit is flipped depending on the bits above it
+uint32_t nestedUniformScramble(uint32_t x, uint32_t key)
+{
+    return reverseBits(laineKarrasPermutation(reverseBits(x), key));
+}
+
+// Top 24 bits, so the float stays below 1
+float toUnitFloat(uint32_t x)
+{
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Interleaved gradient noise (Jimenez 2014), in [0, 1)
+float interleavedGradientNoise(float x, float y)
+{
+    float value = 0.06711056f * x + 0.00583715f * y;
+    value = 52.9829189f * (value - std::floor(value));
+    return value - std::floor(value);
+}
+
+struct PixelSampler
+{
+    int type = SAMPLER_PCG;
+    uint32_t rngState = 0;  // The PCG stream
+    uint32_t pixelHash = 0; // Seeds the scrambling of the Sobol points
+    uint32_t seedHash = 0;  // Hash of the render's seed, shifts the blue noise lattice
+    int pixelX = 0;         // Position in the blue noise
+    int pixelY = 0;
+    uint32_t sampleIndex = 0;
+    uint32_t nextSampleIndex = 0; // frameIndex * numRaysPerPixel at the start of a frame
+    int bounceDimension = 0;      // First dimension of the current bounce
+
+    // Called for every camera ray
+    void startSample()
+    {
+        sampleIndex = nextSampleIndex++;
+        bounceDimension = NUM_CAMERA_DIMENSIONS;
+    }
+
+    void startBounce(int bounce)
+    {
+        bounceDimension = NUM_CAMERA_DIMENSIONS + bounce * NUM_BOUNCE_DIMENSIONS;
+    }
+
+    float get1D(int dimension)
+    {
+        switch (type)
+        {
+            case SAMPLER_SOBOL:
+            {
+                uint32_t dimensionSeed = hashInt(pixelHash ^ hashInt(uint32_t(dimension)));
+                uint32_t index = nestedUniformScramble(sampleIndex, dimensionSeed);
+                return toUnitFloat(nestedUniformScramble(reverseBits(index), hashInt(dimensionSeed)));
+            }
+            case SAMPLER_BLUE_NOISE:
+            {
+                uint32_t index = nestedUniformScramble(sampleIndex, hashInt(uint32_t(dimension)));
+                float offset = interleavedGradientNoise(pixelX + 5.588238f * dimension, pixelY + 3.7f * dimension);
+                return toUnitFloat((uint32_t(offset * 16777216.0f) << 8) + index * 2654435769u + seedHash);
+            }
+            default:
+                return random(rngState);
+        }
+    }
+
+    glm::vec2 get2D(int dimension)
+    {
+        switch (type)
+        {
+            case SAMPLER_SOBOL:
+            {
+                uint32_t dimensionSeed = hashInt(pixelHash ^ hashInt(uint32_t(dimension)));
+                uint32_t index = nestedUniformScramble(sampleIndex, dimensionSeed);
+
+                // The second Sobol dimension, the first is the index with its bits reversed
+                uint32_t y = 0;
+                for (uint32_t v = 1u << 31, i = index; i != 0; i >>= 1, v ^= v >> 1)
+                    if (i & 1u)
+                        y ^= v;
+
+                return glm::vec2(toUnitFloat(nestedUniformScramble(reverseBits(index), hashInt(dimensionSeed))),
+                                 toUnitFloat(nestedUniformScramble(y, hashInt(dimensionSeed ^ 0x5bd1e995u))));
+            }
+            case SAMPLER_BLUE_NOISE:
+            {
+                // R2 sequence, the generalization of the golden ratio to two dimensions
+                uint32_t index = nestedUniformScramble(sampleIndex, hashInt(uint32_t(dimension)));
+                float offsetX = interleavedGradientNoise(pixelX + 5.588238f * dimension, pixelY + 3.7f * dimension);
+                float offsetY = interleavedGradientNoise(pixelX + 17.0f + 5.588238f * dimension, pixelY + 29.0f + 3.7f * dimension);
+                return glm::vec2(toUnitFloat((uint32_t(offsetX * 16777216.0f) << 8) + index * 3242174889u + seedHash),
+                                 toUnitFloat((uint32_t(offsetY * 16777216.0f) << 8) + index * 2447445413u + hashInt(seedHash)));
+            }
+            default:
+            {
+                // Separate statements keep the order of the random numbers the same as in the shader
+                float x = random(rngState);
+                float y = random(rngState);
+                return glm::vec2(x, y);
+            }
+        }
+    }
+
+    // Slots of the current bounce
+    float sample1D(int slot) { return get1D(bounceDimension + slot); }
+    glm::vec2 sample2D(int slot) { return get2D(bounceDimension + slot); }
+
+    glm::vec2 cameraSample2D(int slot) { return get2D(slot); }
+};
+
+// Uniform square to uniform disk, keeping the strata of the square together (Shirley and Chiu)
+glm::vec2 concentricDisk(const glm::vec2& u)
+{
+    glm::vec2 offset = u * 2.0f - 1.0f;
+    if (offset.x == 0.0f && offset.y == 0.0f)
+        return glm::vec2(0.0f);
+
+    float radius, angle;
+    if (std::abs(offset.x) > std::abs(offset.y))
+    {
+        radius = offset.x;
+        angle = PI / 4.0f * (offset.y / offset.x);
+    }
+    else
+    {
+        radius = offset.y;
+        angle = PI / 2.0f - PI / 4.0f * (offset.x / offset.y);
+    }
+    return radius * glm::vec2(std::cos(angle), std::sin(angle));
+}
+
+// Direction around normal with a density of cos / PI, the disk point lifted onto the hemisphere (Malley)
+glm::vec3 cosineHemisphere(const glm::vec3& normal, const glm::vec2& u)
+{
+    glm::vec2 disk = concentricDisk(u);
+    float z = std::sqrt(std::max(0.0f, 1.0f - disk.x * disk.x - disk.y * disk.y));
+
+    // Orthonormal basis without branches on the normal's direction (Duff et al. 2017)
+    float sign = std::copysign(1.0f, normal.z);
+    float a = -1.0f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    glm::vec3 tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    glm::vec3 bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+    return glm::normalize(tangent * disk.x + bitangent * disk.y + normal * z);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/mesh.h>
+#include <RayTracing/Assets/headers/BVH.h>
+
+// Extra geometry that is added around a loaded model, shared by the interactive and the headless renderer
+
+void addSkyLightPlane(std::vector<RTXTriangle>& rtxTriangles, std::vector<BVHTriangle>& bvhTriangles, int lightMtlIndex)
+{
+	BoundingBox sceneBounds;
+	for (const BVHTriangle& tri : bvhTriangles)
+		sceneBounds.growToInclude(tri);
+
+	glm::vec3 sceneSize = sceneBounds.size();
+	float minX = sceneBounds.min.x;
+	float maxX = sceneBounds.max.x;
+	float maxY = sceneBounds.max.y;
+	float minZ = sceneBounds.min.z;
+	float maxZ = sceneBounds.max.z;
+	
+	float planeY = maxY + sceneSize.y * 0.1f;
+
+	std::vector<glm::vec3> skyCorners = 
+	{
+		glm::vec3(minX, planeY, maxZ),
+		glm::vec3(maxX, planeY, maxZ),
+		glm::vec3(minX, planeY, minZ),
+		glm::vec3(maxX, planeY, minZ),
+	};
+
+	int skyCornersIndicies[2][3] =
+	{
+		{0, 3, 1},
+		{0, 2, 3}
+	};
+
+	std::vector<RTXTriangle> skyTrianglesRTX;
+	for (int i = 0 ; i < 2; i++)
+		skyTrianglesRTX.push_back(RTXTriangle(lightMtlIndex, glm::vec4(skyCorners[skyCornersIndicies[i][0]], 0.0f),  glm::vec4(skyCorners[skyCornersIndicies[i][1]], 0.0f),
+							 glm::vec4(skyCorners[skyCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
+	std::vector<BVHTriangle> skyTrianglesBVH;
+	for (int i = 0 ; i < 2; i++)
+		skyTrianglesBVH.push_back(BVHTriangle(skyCorners[skyCornersIndicies[i][0]], skyCorners[skyCornersIndicies[i][1]], skyCorners[skyCornersIndicies[i][2]]));
+
+	rtxTriangles.insert(rtxTriangles.end(), skyTrianglesRTX.begin(), skyTrianglesRTX.end());
+	bvhTriangles.insert(bvhTriangles.end(), skyTrianglesBVH.begin(), skyTrianglesBVH.end());
+	rtxTriangles.insert(rtxTriangles.end(), skyTrianglesRTX.begin(), skyTrianglesRTX.end());
+	bvhTriangles.insert(bvhTriangles.end(), skyTrianglesBVH.begin(), skyTrianglesBVH.end());
+}
+
+void addCornellBox(std::vector<RTXTriangle>& rtxTriangles, std::vector<BVHTriangle>& bvhTriangles, float lightSize, float padPercentage, int lightMtlIndex)
+{
+	BoundingBox sceneBounds;
+	for (const BVHTriangle& tri : bvhTriangles)
+		sceneBounds.growToInclude(tri);
+
+	glm::vec3 sceneSize = sceneBounds.size();
+	float minX = sceneBounds.min.x - sceneSize.x * padPercentage;
+	float maxX = sceneBounds.max.x + sceneSize.x * padPercentage;
+	float minY = sceneBounds.min.y - sceneSize.y * padPercentage * 0.1f;
+	float maxY = sceneBounds.max.y + sceneSize.y * padPercentage;
+	float minZ = sceneBounds.min.z - sceneSize.z * padPercentage;
+	float maxZ = sceneBounds.max.z + sceneSize.z * padPercentage;
+
+	std::vector<glm::vec3> corners = 
+	{
+		glm::vec3(minX, minY, maxZ),
+		glm::vec3(maxX, minY, maxZ),
+		glm::vec3(minX, maxY, maxZ),
+		glm::vec3(maxX, maxY, maxZ),
+		glm::vec3(minX, minY, minZ),
+		glm::vec3(maxX, minY, minZ),
+		glm::vec3(minX, maxY, minZ),
+		glm::vec3(maxX, maxY, minZ),
+	};
+
+	glm::vec3 boxSize = glm::vec3(maxX, maxY, maxZ) - glm::vec3(minX, minY, minZ);
+	float centerX = (maxX + minX) / 2.0f;
+	float centerZ = (maxZ + minZ) / 2.0f;
+	float lightMinX = centerX - lightSize * boxSize.x / 2.0f;
+	float lightMaxX = centerX + lightSize * boxSize.x / 2.0f;
+	float lightMinZ = centerZ - lightSize * boxSize.z / 2.0f;
+	float lightMaxZ = centerZ + lightSize * boxSize.z / 2.0f;
+	float lightY = maxY - 1e-3f;
+
+	std::vector<glm::vec3> lightCorners =
+	{
+		glm::vec3(lightMinX, lightY, lightMaxZ),
+		glm::vec3(lightMaxX, lightY, lightMaxZ),
+		glm::vec3(lightMinX, lightY, lightMinZ),
+		glm::vec3(lightMaxX, lightY, lightMinZ),
+	};
+
+	int triCornersIndicies[12][3] =
+	{
+		{0, 3, 1},
+		{0, 2, 3},
+		{0, 5, 4},
+		{0, 1, 5},
+		{0, 6, 2},
+		{0, 4, 6},
+		{7, 1, 3},
+		{7, 5, 1},
+		{7, 2, 6},
+		{7, 3, 2},
+		{7, 4, 5},
+		{7, 6, 4}
+	};
+
+	int lightCornersIndicies[4][3] =
+	{
+		{0, 3, 1},
+		{0, 2, 3},
+		{0, 1, 3},
+		{0, 3, 2}
+	};
+
+	std::vector<RTXTriangle> cornellCornersRTX;
+	for (int i = 0 ; i < 12; i++)
+	{
+		cornellCornersRTX.push_back(RTXTriangle(0, glm::vec4(corners[triCornersIndicies[i][0]], 0.0f),  glm::vec4(corners[triCornersIndicies[i][1]], 0.0f),
+							 glm::vec4(corners[triCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
+	}
+	std::vector<BVHTriangle> cornellCornersBVH;
+	for (int i = 0 ; i < 12; i++)
+		cornellCornersBVH.push_back(BVHTriangle(corners[triCornersIndicies[i][0]], corners[triCornersIndicies[i][1]], corners[triCornersIndicies[i][2]]));
+
+	std::vector<RTXTriangle> cornellLightRTX;
+	for (int i = 0 ; i < 4; i++)
+		cornellLightRTX.push_back(RTXTriangle(lightMtlIndex, glm::vec4(lightCorners[lightCornersIndicies[i][0]], 0.0f),  glm::vec4(lightCorners[lightCornersIndicies[i][1]], 0.0f),
+							 glm::vec4(lightCorners[lightCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
+	std::vector<BVHTriangle> cornellLightBVH;
+	for (int i = 0 ; i < 4; i++)
+		cornellLightBVH.push_back(BVHTriangle(lightCorners[lightCornersIndicies[i][0]], lightCorners[lightCornersIndicies[i][1]], lightCorners[lightCornersIndicies[i][2]]));
+
+	rtxTriangles.insert(rtxTriangles.end(), cornellCornersRTX.begin(), cornellCornersRTX.end());
+	bvhTriangles.insert(bvhTriangles.end(), cornellCornersBVH.begin(), cornellCornersBVH.end());
+	rtxTriangles.insert(rtxTriangles.end(), cornellLightRTX.begin(), cornellLightRTX.end());
+	bvhTriangles.insert(bvhTriangles.end(), cornellLightBVH.begin(), cornellLightBVH.end());
+}
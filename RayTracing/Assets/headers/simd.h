@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SIMD_SSE 1
+#include <immintrin.h>
+#endif
+
+// The AVX2 and AVX-512 types are always compiled on x86-64, GCC and Clang build them with a per function target
+// when the flags don't already enable the instruction set. Code using them goes through an entry function marked
+// SIMD_TARGET_AVX2 / SIMD_TARGET_AVX512 (which also inlines everything it calls so the whole kernel is compiled
+// for that instruction set) and is only called when cpuSupportsSimdWidth() says the CPU running it has it.
+#if defined(SIMD_SSE) && (defined(__GNUC__) || defined(_MSC_VER))
+#define SIMD_AVX2 1
+#define SIMD_AVX512 1
+#endif
+
+#if defined(__GNUC__)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2"), flatten))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx2"), flatten))
+#else
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Thin wrappers around the float registers of each instruction set, all with the same interface so the ray
+// kernels can be written once as templates. SimdFloat4 uses SSE2 (always there on x86-64), SimdFloat8 AVX2,
+// SimdFloat16 AVX-512 and SimdFloat1 is the portable fallback.
+//
+//     SimdFloatN a = SimdFloatN::load(ptr);
+//     SimdMaskN m = a < SimdFloatN(1.0f);
+//     a = select(m, a, SimdFloatN(0.0f));
+//     if (m.any()) ...
+
+struct SimdMask1
+{
+    bool m;
+
+    SimdMask1() = default;
+    SimdMask1(bool m_) : m(m_) {}
+
+    int bits() const { return m ? 1 : 0; }
+    bool any() const { return m; }
+    bool lane(int /*i*/) const { return m; }
+
+    SimdMask1 operator&(const SimdMask1& o) const { return m && o.m; }
+    SimdMask1 operator|(const SimdMask1& o) const { return m || o.m; }
+    SimdMask1 andNot(const SimdMask1& o) const { return m && !o.m; }
+
+    static SimdMask1 fromBits(int bits) { return (bits & 1) != 0; }
+};
+
+struct SimdFloat1
+{
+    static const int width = 1;
+    typedef SimdMask1 Mask;
+
+    float v;
+
+    SimdFloat1() = default;
+    explicit SimdFloat1(float s) : v(s) {}
+
+    static SimdFloat1 load(const float* p) { return SimdFloat1(p[0]); }
+    void store(float* p) const { p[0] = v; }
+    float lane(int /*i*/) const { return v; }
+
+    SimdFloat1 operator+(const SimdFloat1& o) const { return SimdFloat1(v + o.v); }
+    SimdFloat1 operator-(const SimdFloat1& o) const { return SimdFloat1(v - o.v); }
+    SimdFloat1 operator*(const SimdFloat1& o) const { return SimdFloat1(v * o.v); }
+    SimdFloat1 operator/(const SimdFloat1& o) const { return SimdFloat1(v / o.v); }
+
+    SimdMask1 operator<(const SimdFloat1& o) const { return v < o.v; }
+    SimdMask1 operator<=(const SimdFloat1& o) const { return v <= o.v; }
+    SimdMask1 operator>(const SimdFloat1& o) const { return v > o.v; }
+    SimdMask1 operator>=(const SimdFloat1& o) const { return v >= o.v; }
+};
+
+inline SimdFloat1 min(const SimdFloat1& a, const SimdFloat1& b) { return SimdFloat1(std::min(a.v, b.v)); }
+inline SimdFloat1 max(const SimdFloat1& a, const SimdFloat1& b) { return SimdFloat1(std::max(a.v, b.v)); }
+inline SimdFloat1 select(const SimdMask1& m, const SimdFloat1& a, const SimdFloat1& b) { return m.m ? a : b; }
+
+#ifdef SIMD_SSE
+struct SimdMask4
+{
+    __m128 m;
+
+    SimdMask4() = default;
+    SimdMask4(__m128 m_) : m(m_) {}
+
+    int bits() const { return _mm_movemask_ps(m); }
+    bool any() const { return bits() != 0; }
+    bool lane(int i) const { return (bits() >> i) & 1; }
+
+    SimdMask4 operator&(const SimdMask4& o) const { return _mm_and_ps(m, o.m); }
+    SimdMask4 operator|(const SimdMask4& o) const { return _mm_or_ps(m, o.m); }
+    SimdMask4 andNot(const SimdMask4& o) const { return _mm_andnot_ps(o.m, m); }
+
+    static SimdMask4 fromBits(int bits)
+    {
+        __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+        __m128i set = _mm_and_si128(_mm_set1_epi32(bits), laneBits);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(set, laneBits));
+    }
+};
+
+struct SimdFloat4
+{
+    static const int width = 4;
+    typedef SimdMask4 Mask;
+
+    __m128 v;
+
+    SimdFloat4() = default;
+    SimdFloat4(__m128 v_) : v(v_) {}
+    explicit SimdFloat4(float s) : v(_mm_set1_ps(s)) {}
+
+    static SimdFloat4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    float lane(int i) const { alignas(16) float lanes[4]; _mm_store_ps(lanes, v); return lanes[i]; }
+
+    SimdFloat4 operator+(const SimdFloat4& o) const { return _mm_add_ps(v, o.v); }
+    SimdFloat4 operator-(const SimdFloat4& o) const { return _mm_sub_ps(v, o.v); }
+    SimdFloat4 operator*(const SimdFloat4& o) const { return _mm_mul_ps(v, o.v); }
+    SimdFloat4 operator/(const SimdFloat4& o) const { return _mm_div_ps(v, o.v); }
+
+    SimdMask4 operator<(const SimdFloat4& o) const { return _mm_cmplt_ps(v, o.v); }
+    SimdMask4 operator<=(const SimdFloat4& o) const { return _mm_cmple_ps(v, o.v); }
+    SimdMask4 operator>(const SimdFloat4& o) const { return _mm_cmpgt_ps(v, o.v); }
+    SimdMask4 operator>=(const SimdFloat4& o) const { return _mm_cmpge_ps(v, o.v); }
+};
+
+inline SimdFloat4 min(const SimdFloat4& a, const SimdFloat4& b) { return _mm_min_ps(a.v, b.v); }
+inline SimdFloat4 max(const SimdFloat4& a, const SimdFloat4& b) { return _mm_max_ps(a.v, b.v); }
+inline SimdFloat4 select(const SimdMask4& m, const SimdFloat4& a, const SimdFloat4& b)
+{
+    return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+#endif
+
+#ifdef SIMD_AVX2
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define SIMD_POP_TARGET
+#endif
+
+struct SimdMask8
+{
+    __m256 m;
+
+    SimdMask8() = default;
+    SimdMask8(__m256 m_) : m(m_) {}
+
+    int bits() const { return _mm256_movemask_ps(m); }
+    bool any() const { return bits() != 0; }
+    bool lane(int i) const { return (bits() >> i) & 1; }
+
+    SimdMask8 operator&(const SimdMask8& o) const { return _mm256_and_ps(m, o.m); }
+    SimdMask8 operator|(const SimdMask8& o) const { return _mm256_or_ps(m, o.m); }
+    SimdMask8 andNot(const SimdMask8& o) const { return _mm256_andnot_ps(o.m, m); }
+
+    static SimdMask8 fromBits(int bits)
+    {
+        __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        __m256i set = _mm256_and_si256(_mm256_set1_epi32(bits), laneBits);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, laneBits));
+    }
+};
+
+struct SimdFloat8
+{
+    static const int width = 8;
+    typedef SimdMask8 Mask;
+
+    __m256 v;
+
+    SimdFloat8() = default;
+    SimdFloat8(__m256 v_) : v(v_) {}
+    explicit SimdFloat8(float s) : v(_mm256_set1_ps(s)) {}
+
+    static SimdFloat8 load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    float lane(int i) const { alignas(32) float lanes[8]; _mm256_store_ps(lanes, v); return lanes[i]; }
+
+    SimdFloat8 operator+(const SimdFloat8& o) const { return _mm256_add_ps(v, o.v); }
+    SimdFloat8 operator-(const SimdFloat8& o) const { return _mm256_sub_ps(v, o.v); }
+    SimdFloat8 operator*(const SimdFloat8& o) const { return _mm256_mul_ps(v, o.v); }
+    SimdFloat8 operator/(const SimdFloat8& o) const { return _mm256_div_ps(v, o.v); }
+
+    SimdMask8 operator<(const SimdFloat8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+    SimdMask8 operator<=(const SimdFloat8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ); }
+    SimdMask8 operator>(const SimdFloat8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_GT_OQ); }
+    SimdMask8 operator>=(const SimdFloat8& o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+};
+
+inline SimdFloat8 min(const SimdFloat8& a, const SimdFloat8& b) { return _mm256_min_ps(a.v, b.v); }
+inline SimdFloat8 max(const SimdFloat8& a, const SimdFloat8& b) { return _mm256_max_ps(a.v, b.v); }
+inline SimdFloat8 select(const SimdMask8& m, const SimdFloat8& a, const SimdFloat8& b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+#ifdef SIMD_POP_TARGET
+#pragma GCC pop_options
+#undef SIMD_POP_TARGET
+#endif
+#endif
+
+#ifdef SIMD_AVX512
+#if defined(__GNUC__) && !defined(__AVX512F__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2")
+#define SIMD_POP_TARGET
+#endif
+
+struct SimdMask16
+{
+    __mmask16 m;
+
+    SimdMask16() = default;
+    SimdMask16(__mmask16 m_) : m(m_) {}
+
+    int bits() const { return m; }
+    bool any() const { return m != 0; }
+    bool lane(int i) const { return (m >> i) & 1; }
+
+    SimdMask16 operator&(const SimdMask16& o) const { return static_cast<__mmask16>(m & o.m); }
+    SimdMask16 operator|(const SimdMask16& o) const { return static_cast<__mmask16>(m | o.m); }
+    SimdMask16 andNot(const SimdMask16& o) const { return static_cast<__mmask16>(m & ~o.m); }
+
+    static SimdMask16 fromBits(int bits) { return static_cast<__mmask16>(bits); }
+};
+
+struct SimdFloat16
+{
+    static const int width = 16;
+    typedef SimdMask16 Mask;
+
+    __m512 v;
+
+    SimdFloat16() = default;
+    SimdFloat16(__m512 v_) : v(v_) {}
+    explicit SimdFloat16(float s) : v(_mm512_set1_ps(s)) {}
+
+    static SimdFloat16 load(const float* p) { return _mm512_loadu_ps(p); }
+    void store(float* p) const { _mm512_storeu_ps(p, v); }
+    float lane(int i) const { alignas(64) float lanes[16]; _mm512_store_ps(lanes, v); return lanes[i]; }
+
+    SimdFloat16 operator+(const SimdFloat16& o) const { return _mm512_add_ps(v, o.v); }
+    SimdFloat16 operator-(const SimdFloat16& o) const { return _mm512_sub_ps(v, o.v); }
+    SimdFloat16 operator*(const SimdFloat16& o) const { return _mm512_mul_ps(v, o.v); }
+    SimdFloat16 operator/(const SimdFloat16& o) const { return _mm512_div_ps(v, o.v); }
+
+    SimdMask16 operator<(const SimdFloat16& o) const { return _mm512_cmp_ps_mask(v, o.v, _CMP_LT_OQ); }
+    SimdMask16 operator<=(const SimdFloat16& o) const { return _mm512_cmp_ps_mask(v, o.v, _CMP_LE_OQ); }
+    SimdMask16 operator>(const SimdFloat16& o) const { return _mm512_cmp_ps_mask(v, o.v, _CMP_GT_OQ); }
+    SimdMask16 operator>=(const SimdFloat16& o) const { return _mm512_cmp_ps_mask(v, o.v, _CMP_GE_OQ); }
+};
+
+inline SimdFloat16 min(const SimdFloat16& a, const SimdFloat16& b) { return _mm512_min_ps(a.v, b.v); }
+inline SimdFloat16 max(const SimdFloat16& a, const SimdFloat16& b) { return _mm512_max_ps(a.v, b.v); }
+inline SimdFloat16 select(const SimdMask16& m, const SimdFloat16& a, const SimdFloat16& b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+
+#ifdef SIMD_POP_TARGET
+#pragma GCC pop_options
+#undef SIMD_POP_TARGET
+#endif
+#endif
+
+// Widest register the binary was compiled for
+#if defined(SIMD_AVX512)
+const int SIMD_MAX_WIDTH = 16;
+#elif defined(SIMD_AVX2)
+const int SIMD_MAX_WIDTH = 8;
+#elif defined(SIMD_SSE)
+const int SIMD_MAX_WIDTH = 4;
+#else
+const int SIMD_MAX_WIDTH = 1;
+#endif
+
+// Asks the CPU running the program whether it has the instruction set behind a register width
+bool cpuSupportsSimdWidth(int width)
+{
+    if (width <= 1)
+        return true;
+    if (width > SIMD_MAX_WIDTH)
+        return false;
+#if defined(__GNUC__) && defined(SIMD_SSE)
+    if (width >= 16) return __builtin_cpu_supports("avx512f");
+    if (width >= 8) return __builtin_cpu_supports("avx2");
+    return true;
+#elif defined(_MSC_VER) && defined(SIMD_SSE)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+    if (!osSavesAvx)
+        return width <= 4;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if (width >= 16) return (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16));
+    if (width >= 8) return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5));
+    return true;
+#else
+    return true;
+#endif
+}
+
+// Returns the closest width that was compiled in and that the CPU supports, 0 asks for the widest
+int supportedSimdWidth(int requestedWidth)
+{
+    int width = requestedWidth <= 0 || requestedWidth > SIMD_MAX_WIDTH ? SIMD_MAX_WIDTH : requestedWidth;
+    if (width >= 16) width = 16;
+    else if (width >= 8) width = 8;
+    else if (width >= 4) width = 4;
+    else width = 1;
+
+    while (width > 1 && !cpuSupportsSimdWidth(width))
+        width = width == 4 ? 1 : width / 2;
+    return width;
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include <filesUtil/myFile.h>
+#include <profiling/traceRecorder.h>
+
+// Splits the image into tiles and hands them to the render threads. The tiles are walked along a Morton or Hilbert
+// curve so tiles rendered one after another are neighbours and keep reusing the same BVH nodes, every thread starts
+// with its own stretch of the curve and, once it runs out, steals tiles from the far end of another thread's stretch.
+// That keeps the threads busy when some tiles (glass, the ceiling light) cost far more than others.
+
+struct Tile
+{
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+struct TileTiming
+{
+    Tile tile;
+    int thread = 0;
+    float seconds = 0.0f;
+};
+
+enum class TileOrder
+{
+    Scanline,
+    Morton,
+    Hilbert
+};
+
+bool parseTileOrder(const std::string& name, TileOrder& order)
+{
+    if (name == "scanline") order = TileOrder::Scanline;
+    else if (name == "morton") order = TileOrder::Morton;
+    else if (name == "hilbert") order = TileOrder::Hilbert;
+    else
+    {
+        std::cerr << "Unknown tile order: " << name << " (scanline, morton or hilbert)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Interleaves the bits of x and y
+uint32_t mortonIndex(uint32_t x, uint32_t y)
+{
+    uint32_t index = 0;
+    for (int bit = 0; bit < 16; bit++)
+        index |= ((x >> bit) & 1u) << (2 * bit) | ((y >> bit) & 1u) << (2 * bit + 1);
+    return index;
+}
+
+// Distance along the Hilbert curve filling a size x size grid, size a power of two
+uint32_t hilbertIndex(uint32_t size, uint32_t x, uint32_t y)
+{
+    uint32_t index = 0;
+    for (uint32_t s = size / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        index += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve inside it is continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+std::vector<Tile> makeTiles(int width, int height, int tileSize, TileOrder order)
+{
+    tileSize = std::max(1, tileSize);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+
+    uint32_t gridSize = 1;
+    while (gridSize < static_cast<uint32_t>(std::max(tilesX, tilesY)))
+        gridSize *= 2;
+
+    std::vector<std::pair<uint32_t, Tile>> keyed;
+    for (int ty = 0; ty < tilesY; ty++)
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            Tile tile;
+            tile.x = tx * tileSize;
+            tile.y = ty * tileSize;
+            tile.width = std::min(tileSize, width - tile.x);
+            tile.height = std::min(tileSize, height - tile.y);
+
+            uint32_t key = ty * tilesX + tx;
+            if (order == TileOrder::Morton)
+                key = mortonIndex(tx, ty);
+            else if (order == TileOrder::Hilbert)
+                key = hilbertIndex(gridSize, tx, ty);
+            keyed.push_back({ key, tile });
+        }
+
+    std::stable_sort(keyed.begin(), keyed.end(), [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b) { return a.first < b.first; });
+
+    std::vector<Tile> tiles;
+    for (const std::pair<uint32_t, Tile>& entry : keyed)
+        tiles.push_back(entry.second);
+    return tiles;
+}
+
+class TileScheduler
+{
+public:
+    TileScheduler(const std::vector<Tile>& tiles_, int numThreads) : tiles(tiles_), numSteals(0)
+    {
+        numThreads = std::max(1, numThreads);
+        for (int i = 0; i < numThreads; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+
+        // Contiguous stretches of the curve, so each thread starts in its own region of the image
+        for (int i = 0; i < static_cast<int>(tiles.size()); i++)
+            queues[static_cast<size_t>(i) * numThreads / tiles.size()]->tiles.push_back(i);
+    }
+
+    // Next tile for a thread, its own first, then stolen from the back of the fullest other queue
+    bool next(int thread, Tile& tile)
+    {
+        int index;
+        if (popFront(*queues[thread], index))
+        {
+            tile = tiles[index];
+            return true;
+        }
+
+        while (true)
+        {
+            int victim = -1;
+            size_t victimSize = 0;
+            for (size_t i = 0; i < queues.size(); i++)
+            {
+                // Only a hint, the victim's lock is taken again when stealing
+                size_t size = queues[i]->size.load(std::memory_order_relaxed);
+                if (static_cast<int>(i) != thread && size > victimSize)
+                {
+                    victim = static_cast<int>(i);
+                    victimSize = size;
+                }
+            }
+            if (victim == -1)
+                return false;
+
+            if (popBack(*queues[victim], index))
+            {
+                numSteals++;
+                tile = tiles[index];
+                return true;
+            }
+        }
+    }
+
+    int steals() const
+    {
+        return numSteals.load();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<int> tiles;
+        std::atomic<size_t> size{ 0 };
+    };
+
+    std::vector<Tile> tiles;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<int> numSteals;
+
+    static bool popFront(Queue& queue, int& index)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tiles.empty())
+            return false;
+        index = queue.tiles.front();
+        queue.tiles.pop_front();
+        queue.size = queue.tiles.size();
+        return true;
+    }
+
+    static bool popBack(Queue& queue, int& index)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tiles.empty())
+            return false;
+        index = queue.tiles.back();
+        queue.tiles.pop_back();
+        queue.size = queue.tiles.size();
+        return true;
+    }
+};
+
+// Calls renderTile(thread, tile) for every tile on numThreads threads and returns how long each tile took
+std::vector<TileTiming> renderTiles(const std::vector<Tile>& tiles, int numThreads, const std::function<void(int, const Tile&)>& renderTile,
+    int* numSteals = nullptr, bool printProgress = true)
+{
+    numThreads = std::max(1, numThreads);
+    TileScheduler scheduler(tiles, numThreads);
+
+    std::vector<std::vector<TileTiming>> threadTimings(numThreads);
+    std::atomic<int> tilesDone(0);
+    int numTiles = static_cast<int>(tiles.size());
+
+    auto worker = [&](int thread)
+    {
+        setTraceThreadName("render " + std::to_string(thread));
+        Tile tile;
+        while (scheduler.next(thread, tile))
+        {
+            auto start = std::chrono::steady_clock::now();
+            TraceScope scope("tile", "render", static_cast<long long>(tile.width) * tile.height);
+            renderTile(thread, tile);
+            scope.End();
+
+            TileTiming timing;
+            timing.tile = tile;
+            timing.thread = thread;
+            timing.seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+            threadTimings[thread].push_back(timing);
+
+            int done = ++tilesDone;
+            if (printProgress && done * 10 / numTiles != (done - 1) * 10 / numTiles)
+                std::cout << "Rendered " << done * 100 / numTiles << "%" << std::endl;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++)
+        threads.push_back(std::thread(worker, i));
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (numSteals)
+        *numSteals = scheduler.steals();
+
+    std::vector<TileTiming> timings;
+    for (const std::vector<TileTiming>& perThread : threadTimings)
+        timings.insert(timings.end(), perThread.begin(), perThread.end());
+    return timings;
+}
+
+// Slowest and fastest tile and how evenly the work ended up spread over the threads
+void printTileStats(const std::vector<TileTiming>& timings, int numThreads, int numSteals)
+{
+    if (timings.empty())
+        return;
+
+    std::vector<float> threadSeconds(std::max(1, numThreads), 0.0f);
+    float total = 0.0f;
+    const TileTiming* slowest = &timings[0];
+    const TileTiming* fastest = &timings[0];
+    for (const TileTiming& timing : timings)
+    {
+        threadSeconds[timing.thread] += timing.seconds;
+        total += timing.seconds;
+        if (timing.seconds > slowest->seconds) slowest = &timing;
+        if (timing.seconds < fastest->seconds) fastest = &timing;
+    }
+    float busiest = *std::max_element(threadSeconds.begin(), threadSeconds.end());
+
+    std::cout << timings.size() << " tiles, " << numSteals << " stolen, mean " << total / timings.size() * 1000.0f << " ms, "
+        << "fastest " << fastest->seconds * 1000.0f << " ms, slowest " << slowest->seconds * 1000.0f << " ms at ("
+        << slowest->tile.x << ", " << slowest->tile.y << "), thread balance " << (busiest > 0.0f ? total / (busiest * threadSeconds.size()) * 100.0f : 100.0f) << "%" << std::endl;
+}
+
+// One line per tile: x, y, width, height, thread, milliseconds
+bool writeTileTimings(const std::string& path, const std::vector<TileTiming>& timings)
+{
+    std::ofstream file(toNativePath(path));
+    if (!file)
+    {
+        std::cerr << "Failed to write tile timings: " << path << std::endl;
+        return false;
+    }
+
+    file << "x,y,width,height,thread,ms" << std::endl;
+    for (const TileTiming& timing : timings)
+        file << timing.tile.x << "," << timing.tile.y << "," << timing.tile.width << "," << timing.tile.height << ","
+            << timing.thread << "," << timing.seconds * 1000.0f << std::endl;
+    return true;
+}
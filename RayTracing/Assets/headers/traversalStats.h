@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/cpuTracer.h>
+#include <RayTracing/Assets/headers/imageOutput.h>
+
+// Where the binary BVH of BVH.h makes rays work hard: nodes visited, bounding box tests and triangle tests per pixel,
+// as false color heatmaps (blue for the least work, red for the most) and histograms over the pixels.
+//  - primary: the ray through the pixel center, shows the BVH's structure without noise
+//  - path: one sample of the pixel's path with all its bounces and shadow rays, the work a render really does. Only
+//    counted when the tracer is compiled with TRAVERSAL_STATS
+
+struct TraversalStatsImage
+{
+    int width = 0;
+    int height = 0;
+    bool hasPaths = false;
+    std::vector<TraversalCounts> primary; // Top row first, like the rendered image
+    std::vector<TraversalCounts> paths;
+};
+
+void collectTraversalStats(const CPUTracer& tracer, const GlobalUniforms& uniforms, int numThreads, TraversalStatsImage& stats)
+{
+    stats.width = uniforms.width;
+    stats.height = uniforms.height;
+    stats.primary.assign(stats.width * stats.height, TraversalCounts());
+#ifdef TRAVERSAL_STATS
+    stats.hasPaths = true;
+    stats.paths.assign(stats.width * stats.height, TraversalCounts());
+#endif
+
+    GlobalUniforms statsUniforms = uniforms;
+    statsUniforms.numRaysPerPixel = 1;
+    statsUniforms.frameIndex = 0;
+
+    std::atomic<int> nextRow(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+        threads.push_back(std::thread([&]()
+        {
+            for (int y = nextRow++; y < stats.height; y = nextRow++)
+                for (int x = 0; x < stats.width; x++)
+                {
+                    int pixel = y * stats.width + x;
+                    tracer.calculateRayCollisionBVH(tracer.generateCenterRay(statsUniforms, x, stats.height - 1 - y), &stats.primary[pixel]);
+#ifdef TRAVERSAL_STATS
+                    traversalStats = TraversalCounts();
+                    tracer.renderPixel(statsUniforms, x, stats.height - 1 - y);
+                    stats.paths[pixel] = traversalStats;
+#endif
+                }
+        }));
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Kinds of work the heatmaps and histograms are made for
+const int NUM_TRAVERSAL_METRICS = 3;
+const char* const TRAVERSAL_METRIC_NAMES[NUM_TRAVERSAL_METRICS] = { "nodes", "boxes", "triangles" };
+
+long long traversalMetric(const TraversalCounts& counts, int metric)
+{
+    return metric == 0 ? counts.nodeVisits : metric == 1 ? counts.nodeTests : counts.triangleTests;
+}
+
+// <stem>_<kind>_nodes.png, _boxes.png and _triangles.png, for kind primary and path. The scale ends at the 99th
+// percentile, so a few extreme pixels don't leave the rest of the map dark
+bool writeTraversalHeatmaps(const std::string& stem, const std::string& kind, const std::vector<TraversalCounts>& pixels, int width, int height)
+{
+    for (int metric = 0; metric < NUM_TRAVERSAL_METRICS; metric++)
+    {
+        std::vector<long long> values(pixels.size());
+        for (size_t i = 0; i < values.size(); i++)
+            values[i] = traversalMetric(pixels[i], metric);
+
+        std::vector<long long> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        long long fewest = sorted.front();
+        long long most = std::max(fewest + 1, sorted[sorted.size() * 99 / 100]);
+
+        std::vector<glm::vec3> colors(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            colors[i] = heatmapColor(std::min(1.0f, float(values[i] - fewest) / float(most - fewest)));
+
+        if (!writeImage(stem + "_" + kind + "_" + TRAVERSAL_METRIC_NAMES[metric] + ".png", colors, width, height))
+            return false;
+    }
+    return true;
+}
+
+bool writeTraversalHeatmaps(const std::string& stem, const TraversalStatsImage& stats)
+{
+    return writeTraversalHeatmaps(stem, "primary", stats.primary, stats.width, stats.height)
+        && (!stats.hasPaths || writeTraversalHeatmaps(stem, "path", stats.paths, stats.width, stats.height));
+}
+
+// Mean, percentiles and a histogram with power of two buckets for each kind of work per pixel
+void printTraversalHistograms(const std::string& kind, const std::vector<TraversalCounts>& pixels)
+{
+    if (pixels.empty())
+        return;
+
+    long long numRays = 0;
+    for (const TraversalCounts& counts : pixels)
+        numRays += counts.rays;
+    std::cout << "Traversal statistics of the " << kind << " rays: " << pixels.size() << " pixels, "
+        << double(numRays) / pixels.size() << " rays per pixel" << std::endl;
+
+    for (int metric = 0; metric < NUM_TRAVERSAL_METRICS; metric++)
+    {
+        std::vector<long long> values(pixels.size());
+        long long total = 0;
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            values[i] = traversalMetric(pixels[i], metric);
+            total += values[i];
+        }
+        std::sort(values.begin(), values.end());
+
+        std::cout << "  " << TRAVERSAL_METRIC_NAMES[metric] << " per pixel: mean " << double(total) / values.size()
+            << ", per ray " << double(total) / std::max(1LL, numRays)
+            << ", median " << values[values.size() / 2] << ", 99th percentile " << values[values.size() * 99 / 100]
+            << ", max " << values.back() << std::endl;
+
+        // Bucket 0 holds 0, bucket b holds [2^(b-1), 2^b)
+        std::vector<long long> buckets;
+        for (long long value : values)
+        {
+            int bucket = 0;
+            while (value >> bucket)
+                bucket++;
+            if (bucket >= int(buckets.size()))
+                buckets.resize(bucket + 1, 0);
+            buckets[bucket]++;
+        }
+        long long largest = *std::max_element(buckets.begin(), buckets.end());
+        size_t firstBucket = 0;
+        while (buckets[firstBucket] == 0)
+            firstBucket++;
+        for (size_t bucket = firstBucket; bucket < buckets.size(); bucket++)
+        {
+            long long low = bucket == 0 ? 0 : 1LL << (bucket - 1);
+            long long high = bucket == 0 ? 0 : (1LL << bucket) - 1;
+            std::cout << "    " << std::setw(7) << low << " - " << std::setw(7) << high << " " << std::setw(6) << std::fixed << std::setprecision(2)
+                << buckets[bucket] * 100.0 / values.size() << "% " << std::string(size_t(40 * buckets[bucket] / largest), '#')
+                << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+    }
+}
+
+void printTraversalHistograms(const TraversalStatsImage& stats)
+{
+    printTraversalHistograms("primary", stats.primary);
+    if (stats.hasPaths)
+        printTraversalHistograms("path", stats.paths);
+    else
+        std::cout << "Compile with -DTRAVERSAL_STATS to count the work of whole paths as well" << std::endl;
+}
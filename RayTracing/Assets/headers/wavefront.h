@@ -0,0 +1,356 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/cpuTracer.h>
+#include <RayTracing/Assets/headers/tileScheduler.h>
+
+// Wavefront path tracing: instead of following one path at a time through CPUTracer::trace(), all paths of a tile
+// go through one stage at a time. Camera rays are generated, extended (intersected) together, sorted by the material
+// they hit, shaded, and the paths that keep bouncing are compacted into the queue of the next bounce. Every stage is
+// a tight loop over one kind of work, so the traversal and each material's code stay hot instead of alternating.
+// Paths keep the random number generator of their pixel, the image is the same as the one trace() renders.
+//
+// Diffuse bounces send the rays of neighbouring pixels all over the scene. Before the bounce rays are extended they
+// can be reordered, by direction octant and origin cell or by a Morton key of origin and direction, so rays that are
+// traced one after another walk the same BVH nodes. The reorder stage and the bounce traversal are timed separately
+// from the camera rays, raySortBatch sets how many rays are sorted together.
+//
+// With next-event estimation the shade stage queues a shadow ray for every diffuse hit, the shadow stage traces the
+// queue after it and adds the contributions of the lights that turned out visible.
+
+enum WavefrontStage
+{
+    STAGE_GENERATE,
+    STAGE_EXTEND,
+    STAGE_REORDER,
+    STAGE_EXTEND_BOUNCE,
+    STAGE_SORT,
+    STAGE_SHADE,
+    STAGE_SHADOW,
+    STAGE_COMPACT,
+    NUM_WAVEFRONT_STAGES
+};
+
+const char* wavefrontStageName(int stage)
+{
+    static const char* names[NUM_WAVEFRONT_STAGES] = { "generate", "extend", "reorder", "extend 2+", "sort", "shade", "shadow", "compact" };
+    return names[stage];
+}
+
+struct WavefrontTimings
+{
+    double seconds[NUM_WAVEFRONT_STAGES] = {};
+    long long rays[NUM_WAVEFRONT_STAGES] = {};
+
+    void add(const WavefrontTimings& other)
+    {
+        for (int i = 0; i < NUM_WAVEFRONT_STAGES; i++)
+        {
+            seconds[i] += other.seconds[i];
+            rays[i] += other.rays[i];
+        }
+    }
+
+    void print() const
+    {
+        double total = 0.0;
+        for (int i = 0; i < NUM_WAVEFRONT_STAGES; i++)
+            total += seconds[i];
+
+        std::cout << "Wavefront stages (summed over threads):" << std::endl;
+        for (int i = 0; i < NUM_WAVEFRONT_STAGES; i++)
+            std::cout << "  " << std::left << std::setw(10) << wavefrontStageName(i) << std::right
+                << std::fixed << std::setprecision(3) << seconds[i] << " s  "
+                << std::setprecision(1) << (total > 0.0 ? seconds[i] / total * 100.0 : 0.0) << "%  "
+                << std::setprecision(2) << (seconds[i] > 0.0 ? rays[i] / seconds[i] / 1e6 : 0.0) << " Mrays/s" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    }
+};
+
+enum class RaySort
+{
+    None,
+    Octant,
+    Morton
+};
+
+bool parseRaySort(const std::string& name, RaySort& raySort)
+{
+    if (name == "none") raySort = RaySort::None;
+    else if (name == "octant") raySort = RaySort::Octant;
+    else if (name == "morton") raySort = RaySort::Morton;
+    else
+    {
+        std::cerr << "Unknown ray sort: " << name << " (none, octant or morton)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Puts the lowest bits of value every stride bits apart
+uint32_t spreadBits(uint32_t value, int bits, int stride)
+{
+    uint32_t spread = 0;
+    for (int bit = 0; bit < bits; bit++)
+        spread |= ((value >> bit) & 1u) << (bit * stride);
+    return spread;
+}
+
+// spreadBits() of every value, the key of every ray needs six of them
+struct SpreadTable
+{
+    uint32_t values[128];
+
+    SpreadTable(int bits, int stride)
+    {
+        for (uint32_t i = 0; i < (1u << bits); i++)
+            values[i] = spreadBits(i, bits, stride);
+    }
+};
+
+// Position of the value inside [min, max] as an integer of the given number of bits
+uint32_t quantize(float value, float min, float max, int bits)
+{
+    float scale = float((1u << bits) - 1);
+    float t = max > min ? (value - min) / (max - min) : 0.0f;
+    return static_cast<uint32_t>(std::min(std::max(t, 0.0f), 1.0f) * scale + 0.5f);
+}
+
+// Rays with close keys start close to each other and head the same way
+uint32_t raySortKey(RaySort raySort, const Ray& ray, const BoundingBox& sceneBounds)
+{
+    static const SpreadTable spread3(7, 3);
+    static const SpreadTable spread6(5, 6);
+
+    if (raySort == RaySort::Octant)
+    {
+        // Octant first, then a Morton curve over 128^3 origin cells
+        uint32_t octant = (ray.direction.x < 0.0f) | (ray.direction.y < 0.0f) << 1 | (ray.direction.z < 0.0f) << 2;
+        uint32_t key = octant << 21;
+        for (int axis = 0; axis < 3; axis++)
+            key |= spread3.values[quantize(ray.origin[axis], sceneBounds.min[axis], sceneBounds.max[axis], 7)] << (2 - axis);
+        return key;
+    }
+
+    // 6D Morton key, 5 bits for every axis of the origin and the direction, the origin bits lead on every level
+    uint32_t key = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        key |= spread6.values[quantize(ray.origin[axis], sceneBounds.min[axis], sceneBounds.max[axis], 5)] << (5 - axis);
+        key |= spread6.values[quantize(ray.direction[axis], -1.0f, 1.0f, 5)] << (2 - axis);
+    }
+    return key;
+}
+
+struct WavefrontPath
+{
+    Ray ray;
+    glm::vec3 rayColor;
+    float bouncePdf;
+    int pixel;
+};
+
+// Holds the queues of one thread, reused from tile to tile
+class WavefrontRenderer
+{
+public:
+    // raySortBatch is the number of bounce rays sorted together, 0 sorts the whole queue
+    WavefrontRenderer(const CPUTracer& tracer_, RaySort raySort_ = RaySort::None, int raySortBatch_ = 0)
+        : tracer(tracer_), raySort(raySort_), raySortBatch(raySortBatch_)
+    {
+        if (!tracer.allNodes.empty())
+            sceneBounds = tracer.allNodes[0].bounds;
+    }
+
+    // Renders one frame of the tile, colors gets tile.width * tile.height pixels, top row first
+    void renderTile(const GlobalUniforms& uniforms, const Tile& tile, std::vector<glm::vec3>& colors, WavefrontTimings& timings)
+    {
+        int numPixels = tile.width * tile.height;
+        int height = static_cast<int>(uniforms.height);
+
+        samplers.resize(numPixels);
+        incomingLight.resize(numPixels);
+        colors.assign(numPixels, glm::vec3(0.0f));
+        for (int i = 0; i < numPixels; i++)
+            samplers[i] = tracer.pixelSampler(uniforms, tile.x + i % tile.width, height - 1 - (tile.y + i / tile.width));
+
+        for (int sample = 0; sample < uniforms.numRaysPerPixel; sample++)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            paths.clear();
+            for (int i = 0; i < numPixels; i++)
+            {
+                // Image rows are top first, texel rows start at the bottom like in OpenGL
+                int texelX = tile.x + i % tile.width;
+                int texelY = height - 1 - (tile.y + i / tile.width);
+
+                WavefrontPath path;
+                path.ray = tracer.generateCameraRay(uniforms, texelX, texelY, samplers[i]);
+                path.rayColor = glm::vec3(1.0f);
+                path.bouncePdf = 0.0f;
+                path.pixel = i;
+                paths.push_back(path);
+                incomingLight[i] = glm::vec3(0.0f);
+            }
+            lap(timings, STAGE_GENERATE, numPixels, start);
+
+            for (int bounce = 0; bounce < uniforms.maxBounceCount && !paths.empty(); bounce++)
+            {
+                int numPaths = static_cast<int>(paths.size());
+
+                hits.resize(numPaths);
+                if (bounce == 0 || raySort == RaySort::None)
+                {
+                    for (int i = 0; i < numPaths; i++)
+                        hits[i] = tracer.closestHit(paths[i].ray);
+                    lap(timings, bounce == 0 ? STAGE_EXTEND : STAGE_EXTEND_BOUNCE, numPaths, start);
+                }
+                else
+                {
+                    reorderRays();
+                    lap(timings, STAGE_REORDER, numPaths, start);
+
+                    // Only the order of the traversals changes, every path still gets its own hit
+                    for (int i = 0; i < numPaths; i++)
+                        hits[sortedRays[i] & 0xffffffffu] = tracer.closestHit(paths[sortedRays[i] & 0xffffffffu].ray);
+                    lap(timings, STAGE_EXTEND_BOUNCE, numPaths, start);
+                }
+
+                sortByMaterial();
+                lap(timings, STAGE_SORT, numPaths, start);
+
+                alive.assign(numPaths, 0);
+                shadowRays.clear();
+                for (int i : order)
+                {
+                    WavefrontPath& path = paths[i];
+                    if (!hits[i].didHit)
+                        tracer.miss(path.ray, uniforms, path.rayColor, incomingLight[path.pixel]);
+                    else
+                    {
+                        ShadowRay shadowRay;
+                        alive[i] = tracer.scatter(path.ray, hits[i], uniforms, bounce, samplers[path.pixel], path.rayColor, path.bouncePdf, incomingLight[path.pixel], shadowRay);
+                        if (shadowRay.lightTriangle >= 0)
+                            shadowRays.push_back({ shadowRay, path.pixel });
+                    }
+                }
+                lap(timings, STAGE_SHADE, numPaths, start);
+
+                if (!shadowRays.empty())
+                {
+                    for (const QueuedShadowRay& queued : shadowRays)
+                        if (tracer.isVisible(queued.shadowRay))
+                            incomingLight[queued.pixel] += queued.shadowRay.contribution;
+                    lap(timings, STAGE_SHADOW, static_cast<int>(shadowRays.size()), start);
+                }
+
+                // Survivors stay in pixel order, neighbouring rays keep being traced one after another
+                nextPaths.clear();
+                for (int i = 0; i < numPaths; i++)
+                    if (alive[i])
+                        nextPaths.push_back(paths[i]);
+                std::swap(paths, nextPaths);
+                lap(timings, STAGE_COMPACT, numPaths, start);
+            }
+
+            for (int i = 0; i < numPixels; i++)
+                colors[i] += incomingLight[i];
+        }
+
+        for (glm::vec3& color : colors)
+            color /= float(uniforms.numRaysPerPixel);
+    }
+
+private:
+    struct QueuedShadowRay
+    {
+        ShadowRay shadowRay;
+        int pixel;
+    };
+
+    const CPUTracer& tracer;
+    RaySort raySort;
+    int raySortBatch;
+    BoundingBox sceneBounds;
+
+    std::vector<WavefrontPath> paths;
+    std::vector<WavefrontPath> nextPaths;
+    std::vector<HitInfo> hits;
+    std::vector<int> order;
+    std::vector<uint64_t> sortedRays;
+    std::vector<uint64_t> sortScratch;
+    std::vector<int> counts;
+    std::vector<char> alive;
+    std::vector<QueuedShadowRay> shadowRays;
+    std::vector<PixelSampler> samplers;
+    std::vector<glm::vec3> incomingLight;
+
+    // Sorts the path indices by key in batches of raySortBatch, the key sits above the index in sortedRays
+    void reorderRays()
+    {
+        int numPaths = static_cast<int>(paths.size());
+        sortedRays.resize(numPaths);
+        sortScratch.resize(numPaths);
+        for (int i = 0; i < numPaths; i++)
+            sortedRays[i] = static_cast<uint64_t>(raySortKey(raySort, paths[i].ray, sceneBounds)) << 32 | static_cast<uint32_t>(i);
+
+        // Radix sort of the 24 (octant) or 30 (morton) key bits, 3 passes of 10 bits
+        int batch = raySortBatch > 0 ? raySortBatch : numPaths;
+        for (int first = 0; first < numPaths; first += batch)
+        {
+            int last = std::min(numPaths, first + batch);
+            for (int shift = 32; shift < 62; shift += 10)
+            {
+                counts.assign(1025, 0);
+                for (int i = first; i < last; i++)
+                    counts[(sortedRays[i] >> shift & 1023) + 1]++;
+                for (int k = 1; k <= 1024; k++)
+                    counts[k] += counts[k - 1];
+                for (int i = first; i < last; i++)
+                    sortScratch[first + counts[sortedRays[i] >> shift & 1023]++] = sortedRays[i];
+                std::copy(sortScratch.begin() + first, sortScratch.begin() + last, sortedRays.begin() + first);
+            }
+        }
+    }
+
+    // Counting sort of the paths by the type of material they hit, misses first
+    void sortByMaterial()
+    {
+        const int numKeys = TEXTURE + 2;
+        counts.assign(numKeys + 1, 0);
+
+        auto key = [&](int i)
+        {
+            if (!hits[i].didHit)
+                return 0;
+            int type = tracer.materials[hits[i].mtlIndex].materialType;
+            return type >= 0 && type <= TEXTURE ? type + 1 : 0;
+        };
+
+        int numPaths = static_cast<int>(paths.size());
+        for (int i = 0; i < numPaths; i++)
+            counts[key(i) + 1]++;
+        for (int k = 1; k <= numKeys; k++)
+            counts[k] += counts[k - 1];
+
+        order.resize(numPaths);
+        for (int i = 0; i < numPaths; i++)
+            order[counts[key(i)]++] = i;
+    }
+
+    static void lap(WavefrontTimings& timings, WavefrontStage stage, int numRays, std::chrono::steady_clock::time_point& start)
+    {
+        auto now = std::chrono::steady_clock::now();
+        timings.seconds[stage] += std::chrono::duration<double>(now - start).count();
+        timings.rays[stage] += numRays;
+        start = now;
+    }
+};
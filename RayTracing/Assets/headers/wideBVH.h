@@ -0,0 +1,382 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <RayTracing/Assets/headers/simd.h>
+#include <RayTracing/Assets/headers/BVH.h>
+#include <RayTracing/Assets/headers/cpuTracer.h>
+
+// Wide BVH for single rays: the binary BVH is collapsed so every node holds the boxes of up to N children side by
+// side and one ray is tested against all of them with a single SIMD slab test, leaf triangles are packed in blocks
+// of N and tested the same way. This is what speeds up the incoherent bounces, where ray packets don't help.
+
+template <int N>
+struct WideNode
+{
+    float minX[N], minY[N], minZ[N];
+    float maxX[N], maxY[N], maxZ[N];
+    int childIndex[N];  // Wide node of an inner child, first triangle block of a leaf
+    int blockCount[N];  // 0 for inner children, number of triangle blocks of a leaf
+    int numChildren;    // Slots past it are unused
+};
+
+// Triangles in the same precomputed form rayTriangleIntersect() uses, padding lanes are all zero and never hit
+template <int N>
+struct TriangleBlock
+{
+    float aX[N], aY[N], aZ[N];
+    float e0X[N], e0Y[N], e0Z[N];
+    float e1X[N], e1Y[N], e1Z[N];
+    float nX[N], nY[N], nZ[N];
+    int triangleIndex[N];
+};
+
+template <int N>
+class WideBVH
+{
+public:
+    std::vector<WideNode<N>> nodes;
+    std::vector<TriangleBlock<N>> blocks;
+
+    WideBVH() = default;
+
+    WideBVH(const std::vector<Node>& binaryNodes, const std::vector<RTXTriangle>& triangles)
+    {
+        if (binaryNodes.empty())
+            return;
+
+        // A root without children still needs one wide node to hold it
+        if (binaryNodes[0].childIndex == -1)
+        {
+            nodes.push_back(emptyNode());
+            if (binaryNodes[0].triangleCount > 0)
+                setChild(0, 0, binaryNodes[0], triangles);
+        }
+        else
+            collapse(0, binaryNodes, triangles);
+    }
+
+private:
+    static float surfaceArea(const BoundingBox& bounds)
+    {
+        glm::vec3 size = bounds.max - bounds.min;
+        return size.x * (size.y + size.z) + size.y * size.z;
+    }
+
+    static WideNode<N> emptyNode()
+    {
+        WideNode<N> node;
+        for (int i = 0; i < N; i++)
+        {
+            node.minX[i] = node.minY[i] = node.minZ[i] = 0.0f;
+            node.maxX[i] = node.maxY[i] = node.maxZ[i] = 0.0f;
+            node.childIndex[i] = 0;
+            node.blockCount[i] = 0;
+        }
+        node.numChildren = 0;
+        return node;
+    }
+
+    void setChild(int wideIndex, int slot, const Node& child, const std::vector<RTXTriangle>& triangles)
+    {
+        WideNode<N>& node = nodes[wideIndex];
+        node.numChildren = std::max(node.numChildren, slot + 1);
+        node.minX[slot] = child.bounds.min.x;
+        node.minY[slot] = child.bounds.min.y;
+        node.minZ[slot] = child.bounds.min.z;
+        node.maxX[slot] = child.bounds.max.x;
+        node.maxY[slot] = child.bounds.max.y;
+        node.maxZ[slot] = child.bounds.max.z;
+
+        if (child.childIndex != -1)
+            return;
+
+        node.childIndex[slot] = static_cast<int>(blocks.size());
+        node.blockCount[slot] = (child.triangleCount + N - 1) / N;
+
+        for (int first = 0; first < child.triangleCount; first += N)
+        {
+            TriangleBlock<N> block = {};
+            for (int lane = 0; lane < N; lane++)
+            {
+                block.triangleIndex[lane] = -1;
+                if (first + lane >= child.triangleCount)
+                    continue;
+
+                int index = child.triangleIndex + first + lane;
+                const RTXTriangle& tri = triangles[index];
+                glm::vec3 a = glm::vec3(tri.a);
+                glm::vec3 e0 = glm::vec3(tri.b) - a;
+                glm::vec3 e1 = glm::vec3(tri.c) - a;
+                glm::vec3 n = glm::cross(e0, e1);
+
+                block.aX[lane] = a.x;   block.aY[lane] = a.y;   block.aZ[lane] = a.z;
+                block.e0X[lane] = e0.x; block.e0Y[lane] = e0.y; block.e0Z[lane] = e0.z;
+                block.e1X[lane] = e1.x; block.e1Y[lane] = e1.y; block.e1Z[lane] = e1.z;
+                block.nX[lane] = n.x;   block.nY[lane] = n.y;   block.nZ[lane] = n.z;
+                block.triangleIndex[lane] = index;
+            }
+            blocks.push_back(block);
+        }
+    }
+
+    // Pulls the grandchildren of the largest inner children up until the node has N children, then recurses
+    int collapse(int binaryIndex, const std::vector<Node>& binaryNodes, const std::vector<RTXTriangle>& triangles)
+    {
+        std::vector<int> children = { binaryNodes[binaryIndex].childIndex, binaryNodes[binaryIndex].childIndex + 1 };
+        while (static_cast<int>(children.size()) < N)
+        {
+            int largest = -1;
+            for (int i = 0; i < static_cast<int>(children.size()); i++)
+            {
+                const Node& child = binaryNodes[children[i]];
+                if (child.childIndex != -1 && (largest == -1 || surfaceArea(child.bounds) > surfaceArea(binaryNodes[children[largest]].bounds)))
+                    largest = i;
+            }
+            if (largest == -1)
+                break;
+
+            int grandChild = binaryNodes[children[largest]].childIndex;
+            children[largest] = grandChild;
+            children.push_back(grandChild + 1);
+        }
+
+        int wideIndex = static_cast<int>(nodes.size());
+        nodes.push_back(emptyNode());
+
+        int slot = 0;
+        for (int childIndex : children)
+        {
+            const Node& child = binaryNodes[childIndex];
+            // Leaves without triangles have never been grown and would only waste a slot
+            if (child.childIndex == -1 && child.triangleCount <= 0)
+                continue;
+
+            setChild(wideIndex, slot, child, triangles);
+            if (child.childIndex != -1)
+            {
+                int grandIndex = collapse(childIndex, binaryNodes, triangles);
+                nodes[wideIndex].childIndex[slot] = grandIndex;
+            }
+            slot++;
+        }
+        return wideIndex;
+    }
+};
+
+// Single ray traversal of a wide BVH, SimdT::width has to be N. Returns the closest triangle hit before maxDst, or
+// with AnyHit the first one found that isn't ignoreTriangle, -1 for none
+template <typename SimdT, bool AnyHit>
+int traverseWideBVH(const CPUTracer& tracer, const WideBVH<SimdT::width>& bvh, const Ray& ray, float maxDst, int ignoreTriangle)
+{
+    typedef typename SimdT::Mask Mask;
+    const int N = SimdT::width;
+
+    if (bvh.nodes.empty())
+        return -1;
+
+    // Axis parallel directions get a huge but finite inverse so the slab test never computes 0 * inf
+    float invDirection[3];
+    for (int axis = 0; axis < 3; axis++)
+        invDirection[axis] = 1.0f / (isCloseToZero(ray.direction[axis]) ? std::copysign(1e-30f, ray.direction[axis]) : ray.direction[axis]);
+
+    const SimdT ox = SimdT(ray.origin.x), oy = SimdT(ray.origin.y), oz = SimdT(ray.origin.z);
+    const SimdT dx = SimdT(ray.direction.x), dy = SimdT(ray.direction.y), dz = SimdT(ray.direction.z);
+    const SimdT ix = SimdT(invDirection[0]), iy = SimdT(invDirection[1]), iz = SimdT(invDirection[2]);
+    const SimdT zero = SimdT(0.0f);
+    const SimdT one = SimdT(1.0f);
+    const SimdT detEpsilon = SimdT(1e-10f);
+
+    float closestDst = maxDst;
+    int closestTriangle = -1;
+
+    struct Entry
+    {
+        int childIndex;
+        int blockCount;
+        float dst;
+    };
+    Entry stack[MAX_DEPTH * N];
+    int stackIndex = 0;
+    stack[stackIndex++] = { 0, 0, 0.0f };
+
+    while (stackIndex > 0)
+    {
+        Entry entry = stack[--stackIndex];
+        if (entry.dst >= closestDst)
+            continue;
+
+        if (entry.blockCount > 0)
+        {
+            for (int b = entry.childIndex; b < entry.childIndex + entry.blockCount; b++)
+            {
+                const TriangleBlock<N>& block = bvh.blocks[b];
+                SimdT nx = SimdT::load(block.nX), ny = SimdT::load(block.nY), nz = SimdT::load(block.nZ);
+
+                SimdT det = zero - (dx * nx + dy * ny + dz * nz);
+                SimdT invDet = one / det;
+                SimdT aox = ox - SimdT::load(block.aX);
+                SimdT aoy = oy - SimdT::load(block.aY);
+                SimdT aoz = oz - SimdT::load(block.aZ);
+                SimdT dst = (aox * nx + aoy * ny + aoz * nz) * invDet;
+
+                SimdT cx = dy * aoz - dz * aoy;
+                SimdT cy = dz * aox - dx * aoz;
+                SimdT cz = dx * aoy - dy * aox;
+                SimdT u = zero - (SimdT::load(block.e1X) * cx + SimdT::load(block.e1Y) * cy + SimdT::load(block.e1Z) * cz) * invDet;
+                SimdT v = (SimdT::load(block.e0X) * cx + SimdT::load(block.e0Y) * cy + SimdT::load(block.e0Z) * cz) * invDet;
+
+                Mask hit = (det >= detEpsilon) & (dst > zero) & (dst < SimdT(closestDst))
+                    & (u >= zero) & (v >= zero) & ((one - u - v) >= zero);
+
+                int bits = hit.bits();
+                if (bits == 0)
+                    continue;
+
+                if (AnyHit)
+                {
+                    // Confirmed with the scalar test, which the binary traversal would have used
+                    for (int lane = 0; lane < N; lane++)
+                    {
+                        int triangleIndex = block.triangleIndex[lane];
+                        if (!((bits >> lane) & 1) || triangleIndex < 0 || triangleIndex == ignoreTriangle)
+                            continue;
+                        HitInfo hitInfo = rayTriangleIntersect(ray, tracer.triangles[triangleIndex], triangleIndex);
+                        if (hitInfo.didHit && hitInfo.dst < maxDst)
+                            return triangleIndex;
+                    }
+                    continue;
+                }
+
+                // Lowest lane wins ties, the order the binary traversal tests the triangles in
+                float dsts[N];
+                dst.store(dsts);
+                for (int lane = 0; lane < N; lane++)
+                    if (((bits >> lane) & 1) && dsts[lane] < closestDst)
+                    {
+                        closestDst = dsts[lane];
+                        closestTriangle = block.triangleIndex[lane];
+                    }
+            }
+            continue;
+        }
+
+        const WideNode<N>& node = bvh.nodes[entry.childIndex];
+        SimdT t0x = (SimdT::load(node.minX) - ox) * ix;
+        SimdT t1x = (SimdT::load(node.maxX) - ox) * ix;
+        SimdT t0y = (SimdT::load(node.minY) - oy) * iy;
+        SimdT t1y = (SimdT::load(node.maxY) - oy) * iy;
+        SimdT t0z = (SimdT::load(node.minZ) - oz) * iz;
+        SimdT t1z = (SimdT::load(node.maxZ) - oz) * iz;
+        SimdT tNear = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), zero));
+        SimdT tFar = min(min(max(t0x, t1x), max(t0y, t1y)), max(t0z, t1z));
+        int bits = ((tNear <= tFar) & (tNear < SimdT(closestDst))).bits() & ((1 << node.numChildren) - 1);
+        if (bits == 0)
+            continue;
+
+        // Children that were hit, pushed farthest first so the nearest is popped next
+        float nearDsts[N];
+        tNear.store(nearDsts);
+        Entry hits[N];
+        int numHits = 0;
+        for (int slot = 0; slot < N; slot++)
+        {
+            if (!((bits >> slot) & 1))
+                continue;
+
+            Entry hit = { node.childIndex[slot], node.blockCount[slot], nearDsts[slot] };
+            int i = numHits++;
+            for (; i > 0 && hits[i - 1].dst < hit.dst; i--)
+                hits[i] = hits[i - 1];
+            hits[i] = hit;
+        }
+        for (int i = 0; i < numHits; i++)
+            stack[stackIndex++] = hits[i];
+    }
+    return closestTriangle;
+}
+
+// Single ray version of CPUTracer::calculateRayCollisionBVH over a wide BVH
+template <typename SimdT>
+HitInfo intersectWideBVH(const CPUTracer& tracer, const WideBVH<SimdT::width>& bvh, const Ray& ray)
+{
+    int closestTriangle = traverseWideBVH<SimdT, false>(tracer, bvh, ray, 1e38f, -1);
+    if (closestTriangle < 0)
+        return HitInfo();
+
+    HitInfo hitInfo = rayTriangleIntersect(ray, tracer.triangles[closestTriangle], closestTriangle);
+    // The SIMD and scalar tests round differently, for the rare ray on the edge of a triangle trust the binary traversal
+    return hitInfo.didHit ? hitInfo : tracer.calculateRayCollisionBVH(ray);
+}
+
+// One entry per instruction set, compiled for it, in the form CPUTracer::closestHitKernel and occlusionKernel expect
+#ifdef SIMD_SSE
+HitInfo closestHitWide4(const CPUTracer& tracer, const void* bvh, const Ray& ray)
+{
+    return intersectWideBVH<SimdFloat4>(tracer, *static_cast<const WideBVH<4>*>(bvh), ray);
+}
+bool occludedWide4(const CPUTracer& tracer, const void* bvh, const Ray& ray, float tMax, int ignoreTriangle)
+{
+    return traverseWideBVH<SimdFloat4, true>(tracer, *static_cast<const WideBVH<4>*>(bvh), ray, tMax, ignoreTriangle) >= 0;
+}
+#endif
+#ifdef SIMD_AVX2
+SIMD_TARGET_AVX2 HitInfo closestHitWide8(const CPUTracer& tracer, const void* bvh, const Ray& ray)
+{
+    return intersectWideBVH<SimdFloat8>(tracer, *static_cast<const WideBVH<8>*>(bvh), ray);
+}
+SIMD_TARGET_AVX2 bool occludedWide8(const CPUTracer& tracer, const void* bvh, const Ray& ray, float tMax, int ignoreTriangle)
+{
+    return traverseWideBVH<SimdFloat8, true>(tracer, *static_cast<const WideBVH<8>*>(bvh), ray, tMax, ignoreTriangle) >= 0;
+}
+#endif
+
+// Wide BVHs of a scene, only the one of the width in use is built
+struct WideBVHs
+{
+    int width = 1;
+    WideBVH<4> bvh4;
+    WideBVH<8> bvh8;
+};
+
+// Builds the wide BVH for the requested node width (4 or 8, 0 for the widest the CPU runs, 1 keeps the binary BVH)
+// and makes the tracer use it for every single ray, returns the width in use
+int attachWideBVH(CPUTracer& tracer, const CPUScene& scene, int requestedWidth, WideBVHs& wide)
+{
+    // Nodes wider than 8 children collapse poorly, AVX-512 machines use the 8 wide kernel
+    int width = supportedSimdWidth(requestedWidth <= 0 ? 8 : std::min(requestedWidth, 8));
+
+    wide.width = 1;
+    tracer.closestHitKernel = nullptr;
+    tracer.occlusionKernel = nullptr;
+    tracer.closestHitBVH = nullptr;
+
+    TraceScope scope("build wide BVH", "load", width);
+    switch (width)
+    {
+#ifdef SIMD_AVX2
+        case 8:
+            wide.bvh8 = WideBVH<8>(scene.nodes, scene.rtxTriangles);
+            tracer.closestHitKernel = closestHitWide8;
+            tracer.occlusionKernel = occludedWide8;
+            tracer.closestHitBVH = &wide.bvh8;
+            break;
+#endif
+#ifdef SIMD_SSE
+        case 4:
+            wide.bvh4 = WideBVH<4>(scene.nodes, scene.rtxTriangles);
+            tracer.closestHitKernel = closestHitWide4;
+            tracer.occlusionKernel = occludedWide4;
+            tracer.closestHitBVH = &wide.bvh4;
+            break;
+#endif
+        default:
+            return 1;
+    }
+
+    wide.width = width;
+    return width;
+}
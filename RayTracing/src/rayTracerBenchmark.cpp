@@ -0,0 +1,169 @@
+#include <glm/glm.hpp>
+
+// The implementations have to come before the headers that include stb
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+
+#include <RayTracing/Assets/headers/cpuTracer.h>
+#include <RayTracing/Assets/headers/wideBVH.h>
+#include <RayTracing/Assets/headers/benchmark.h>
+#include <RayTracing/Assets/headers/renderSettings.h>
+
+#include <chrono>
+#include <thread>
+#include <iomanip>
+
+// Measures the CPU tracer on every model of the data folder, with and without the Cornell box: load and BVH build
+// times and the primary, diffuse and shadow ray throughput. Results are written as JSON, and compared with an earlier
+// results file to catch performance regressions
+//
+// Usage: rayTracerBenchmark <scene file> [-o results.json] [--baseline baseline.json] [--tolerance 0.1] [-t threads] [--set key=value]...
+
+void printUsage()
+{
+	std::cout << "Usage: rayTracerBenchmark <scene file> [options]" << std::endl
+		<< "  -o, --output <path>     JSON file the results are written to, benchmark.json by default" << std::endl
+		<< "  --baseline <path>       Results of an earlier run, slower rays or builds are reported as regressions" << std::endl
+		<< "  --tolerance <fraction>  How much slower than the baseline still passes, 0.1 by default" << std::endl
+		<< "  -t, --threads <count>   Number of tracing threads, 0 uses every hardware thread, 1 by default" << std::endl
+		<< "  --set <key>=<value>     Overrides any setting of the scene file, may be repeated" << std::endl;
+}
+
+float secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool benchmarkModels(const RenderSettings& baseSettings, std::vector<BenchmarkResult>& results, int& kernelWidth)
+{
+	int numThreads = baseSettings.threads > 0 ? baseSettings.threads : std::max(1u, std::thread::hardware_concurrency());
+	LightSampler lightSampler;
+	if (!parseLightSampler(baseSettings.lightSampler, lightSampler))
+		return false;
+	SamplerType samplerType;
+	if (!parseSamplerType(baseSettings.sampler, samplerType))
+		return false;
+
+	std::vector<std::string> models;
+	for (const fs::directory_entry& entry : fs::directory_iterator(resolveDataFolder(baseSettings)))
+		if (entry.is_directory())
+			models.push_back(entry.path().filename().string());
+	std::sort(models.begin(), models.end());
+
+	for (const std::string& model : models)
+		for (bool cornellBox : { true, false })
+		{
+			RenderSettings settings = baseSettings;
+			settings.model = model;
+			settings.cornellBox = cornellBox;
+
+			BenchmarkResult result;
+			result.name = model + (cornellBox ? "_cornell" : "");
+			std::cout << result.name << ": " << std::flush;
+
+			CPUScene scene;
+			loadCPUScene(settings, scene, &result.loadTimings);
+			result.numTriangles = scene.rtxTriangles.size();
+			if (scene.nodes.empty())
+			{
+				std::cout << "no triangles, skipped" << std::endl;
+				continue;
+			}
+
+			CPUTracer tracer = scene.tracer();
+			WideBVHs wideBVHs;
+			auto wideStart = std::chrono::steady_clock::now();
+			kernelWidth = attachWideBVH(tracer, scene, settings.kernelWidth, wideBVHs);
+			result.wideBVHSeconds = secondsSince(wideStart);
+
+			runBenchmark(tracer, scene, settings, samplerType, lightSampler, numThreads, 3, result);
+			std::cout << result.numTriangles << " triangles, BVH " << result.loadTimings.bvhSeconds * 1000.0f << " ms, "
+				<< std::fixed << std::setprecision(2) << result.primaryMrays << " / " << result.diffuseMrays << " / " << result.shadowMrays
+				<< " Mrays/s primary / diffuse / shadow" << std::defaultfloat << std::setprecision(6) << std::endl;
+			results.push_back(result);
+		}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	RenderSettings settings;
+	std::string scenePath;
+	std::string outputPath = "benchmark.json";
+	std::string baselinePath;
+	float tolerance = 0.1f;
+	std::vector<std::string> overrides;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if ((arg == "-o" || arg == "--output") && hasValue)
+			outputPath = argv[++i];
+		else if (arg == "--baseline" && hasValue)
+			baselinePath = argv[++i];
+		else if (arg == "--tolerance" && hasValue)
+			tolerance = std::stof(argv[++i]);
+		else if ((arg == "-t" || arg == "--threads") && hasValue)
+			overrides.push_back("threads=" + std::string(argv[++i]));
+		else if (arg == "--set" && hasValue)
+			overrides.push_back(argv[++i]);
+		else if (arg == "-h" || arg == "--help")
+		{
+			printUsage();
+			return EXIT_SUCCESS;
+		}
+		else if (scenePath.empty() && arg[0] != '-')
+			scenePath = arg;
+		else
+		{
+			std::cerr << "Unexpected argument: " << arg << std::endl;
+			printUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (scenePath.empty())
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (!loadRenderSettings(scenePath, settings))
+		return EXIT_FAILURE;
+	// One thread measures the traversal itself, not how many cores the machine has. --set still overrides both
+	settings.width = 256;
+	settings.height = 256;
+	settings.threads = 1;
+	for (const std::string& assignment : overrides)
+		if (!applySetting(settings, assignment))
+			return EXIT_FAILURE;
+
+	std::vector<BenchmarkResult> results;
+	int kernelWidth = 1;
+	if (!benchmarkModels(settings, results, kernelWidth))
+		return EXIT_FAILURE;
+
+	int numThreads = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+	if (!writeBenchmarkJson(outputPath, results, numThreads, kernelWidth, settings))
+		return EXIT_FAILURE;
+	std::cout << "Results written to " << toNativePath(outputPath) << std::endl;
+
+	if (!baselinePath.empty())
+	{
+		std::map<std::string, std::map<std::string, double>> baseline;
+		if (!readBenchmarkJson(baselinePath, baseline))
+			return EXIT_FAILURE;
+
+		std::cout << std::endl << "Compared with " << toNativePath(baselinePath) << ":" << std::endl;
+		int numRegressions = compareWithBaseline(results, baseline, tolerance);
+		std::cout << numRegressions << " regressions" << std::endl;
+		if (numRegressions > 0)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,864 @@
+#include <glm/glm.hpp>
+
+// The implementations have to come before the headers that include stb
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+
+#include <RayTracing/Assets/headers/camera.h>
+#include <RayTracing/Assets/headers/cpuTracer.h>
+#include <RayTracing/Assets/headers/rayPacket.h>
+#include <RayTracing/Assets/headers/wideBVH.h>
+#include <RayTracing/Assets/headers/tileScheduler.h>
+#include <RayTracing/Assets/headers/wavefront.h>
+#include <RayTracing/Assets/headers/adaptiveSampling.h>
+#include <RayTracing/Assets/headers/denoiser.h>
+#include <RayTracing/Assets/headers/imageOutput.h>
+#include <RayTracing/Assets/headers/regression.h>
+#include <RayTracing/Assets/headers/traversalStats.h>
+#include <RayTracing/Assets/headers/distributed.h>
+#include <RayTracing/Assets/headers/cameraPath.h>
+#include <RayTracing/Assets/headers/frameStream.h>
+#include <RayTracing/Assets/headers/renderSettings.h>
+
+#include <profiling/traceRecorder.h>
+
+#include <chrono>
+#include <thread>
+#include <iomanip>
+
+// Renders a scene file without a window or an OpenGL context, the same image screenshot() would produce
+//
+// Usage: rayTracerHeadless <scene file> [-o output.png] [-t threads] [--set key=value]... [--regression folder]
+//        rayTracerHeadless <scene file> --coordinator <port> [options]
+//        rayTracerHeadless --worker <host:port> [-t threads] [--set key=value]...
+//        rayTracerHeadless <scene file> --set cameraPath=<keyframe file> --set sequenceFrames=<count> [options]
+//        rayTracerHeadless <scene file> --set cameraPath=<keyframe file> --set stream=- | ffmpeg -i - orbit.mp4
+//        rayTracerHeadless <scene file> -o print.exr --set width=16384 --set height=16384 --set bandHeight=64 [options]
+
+void printUsage()
+{
+	std::cout << "Usage: rayTracerHeadless <scene file> [options]" << std::endl
+		<< "  -o, --output <path>     Image to write (png, jpg, bmp, tga, exr or hdr), overrides the scene's output" << std::endl
+		<< "  -t, --threads <count>   Number of render threads, 0 uses every hardware thread" << std::endl
+		<< "  --set <key>=<value>     Overrides any setting of the scene file, may be repeated" << std::endl
+		<< "  --regression <folder>   Renders every model of the data folder small and compares it with its golden image in folder" << std::endl
+		<< "  --coordinator <port>    Hands the render out to the workers that connect on port" << std::endl
+		<< "  --worker <host:port>    Renders jobs of the coordinator at host:port, --set and -t override its scene" << std::endl;
+}
+
+float secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds frames firstFrame to firstFrame + numFrames - 1 of the tile to pixels, each divided by the frame count of the
+// whole render. pixels points at the tile's top left pixel, rows are stride pixels apart
+void renderTileFrames(const CPUTracer& tracer, const GlobalUniforms& uniforms, int packetWidth, const Tile& tile, int firstFrame, int numFrames,
+	int frames, glm::vec3* pixels, int stride)
+{
+	// Every tile is covered with blocks of pixels, one packet each
+	int blockWidth, blockHeight;
+	packetBlockSize(packetWidth, blockWidth, blockHeight);
+
+	GlobalUniforms frameUniforms = uniforms;
+	int texelX[16], texelY[16], pixelIndex[16];
+	glm::vec3 colors[16];
+
+	for (int blockY = tile.y; blockY < tile.y + tile.height; blockY += blockHeight)
+		for (int blockX = tile.x; blockX < tile.x + tile.width; blockX += blockWidth)
+		{
+			int count = 0;
+			for (int y = blockY; y < std::min(tile.y + tile.height, blockY + blockHeight); y++)
+				for (int x = blockX; x < std::min(tile.x + tile.width, blockX + blockWidth); x++)
+				{
+					// Image rows are written top first, texel rows start at the bottom like in OpenGL
+					texelX[count] = x;
+					texelY[count] = uniforms.height - 1 - y;
+					pixelIndex[count] = (y - tile.y) * stride + x - tile.x;
+					count++;
+				}
+
+			for (int frame = firstFrame; frame < firstFrame + numFrames; frame++)
+			{
+				frameUniforms.frameIndex = frame;
+				renderPixels(packetWidth, tracer, frameUniforms, texelX, texelY, count, colors);
+				for (int i = 0; i < count; i++)
+					pixels[pixelIndex[i]] += colors[i] / float(frames);
+			}
+		}
+}
+
+void renderImage(const CPUTracer& tracer, const GlobalUniforms& uniforms, int frames, int packetWidth, const std::vector<Tile>& tiles,
+	int numThreads, std::vector<glm::vec3>& image, std::vector<TileTiming>& timings, int& numSteals)
+{
+	int width = uniforms.width;
+	image.assign(width * uniforms.height, glm::vec3(0.0f));
+
+	auto renderTile = [&](int, const Tile& tile)
+	{
+		renderTileFrames(tracer, uniforms, packetWidth, tile, 0, frames, frames, &image[tile.y * width + tile.x], width);
+	};
+
+	timings = renderTiles(tiles, numThreads, renderTile, &numSteals);
+}
+
+// Renders a job of the distributed render on all threads, split into tiles of tileSize
+void renderJob(const CPUTracer& tracer, const GlobalUniforms& uniforms, int frames, int packetWidth, int tileSize, TileOrder tileOrder,
+	int numThreads, const RenderJob& job, std::vector<glm::vec3>& colors)
+{
+	std::vector<Tile> tiles = makeTiles(job.width, job.height, tileSize, tileOrder);
+	renderTiles(tiles, numThreads, [&](int, const Tile& jobTile)
+	{
+		Tile tile = jobTile;
+		tile.x += job.x;
+		tile.y += job.y;
+		renderTileFrames(tracer, uniforms, packetWidth, tile, job.firstFrame, job.numFrames, frames, &colors[jobTile.y * job.width + jobTile.x], job.width);
+	}, nullptr, false);
+}
+
+// Jobs of jobSize pixels and jobFrames frames in tile order, the coordinator adds up what the workers send. Partial sums
+// of a pixel's frames round differently than the one sum of a local render, so deterministic renders give every job
+// all the frames
+bool renderImageDistributed(const CPUTracer& tracer, const GlobalUniforms& uniforms, const RenderSettings& settings, int packetWidth,
+	TileOrder tileOrder, int numThreads, const std::string& sceneText, std::vector<glm::vec3>& image)
+{
+	int frames = std::max(1, settings.frames);
+	int jobFrames = settings.jobFrames > 0 && !settings.deterministic ? std::min(settings.jobFrames, frames) : frames;
+	std::vector<RenderJob> jobs;
+	for (const Tile& tile : makeTiles(settings.width, settings.height, settings.jobSize, tileOrder))
+		for (int firstFrame = 0; firstFrame < frames; firstFrame += jobFrames)
+		{
+			RenderJob job;
+			job.x = tile.x;
+			job.y = tile.y;
+			job.width = tile.width;
+			job.height = tile.height;
+			job.firstFrame = firstFrame;
+			job.numFrames = std::min(jobFrames, frames - firstFrame);
+			jobs.push_back(job);
+		}
+
+	image.assign(settings.width * settings.height, glm::vec3(0.0f));
+	DistributedStats stats;
+	auto renderLocal = [&](const RenderJob& job, std::vector<glm::vec3>& colors)
+	{
+		renderJob(tracer, uniforms, frames, packetWidth, settings.tileSize, tileOrder, numThreads, job, colors);
+	};
+	if (!coordinateRender(settings.coordinatorPort, sceneText, jobs, settings.width, settings.workerTimeout, settings.workerWait, renderLocal, image, stats))
+		return false;
+
+	std::cout << jobs.size() << " jobs, " << stats.workers << " workers, " << stats.lostJobs << " handed out again, "
+		<< stats.localJobs << " rendered by the coordinator" << std::endl;
+	return true;
+}
+
+// Passes of numRaysPerPixel samples, each one only over the pixels the sampler still has active
+void renderImageAdaptive(const CPUTracer& tracer, const GlobalUniforms& uniforms, int maxPasses, int packetWidth, const std::vector<Tile>& tiles,
+	int numThreads, AdaptiveSampler& sampler, std::vector<TileTiming>& timings, int& numSteals)
+{
+	int width = uniforms.width;
+	int height = uniforms.height;
+
+	int blockWidth, blockHeight;
+	packetBlockSize(packetWidth, blockWidth, blockHeight);
+
+	GlobalUniforms passUniforms = uniforms;
+	auto renderTile = [&](int, const Tile& tile)
+	{
+		int texelX[16], texelY[16], pixelIndex[16];
+		glm::vec3 colors[16];
+
+		for (int blockY = tile.y; blockY < tile.y + tile.height; blockY += blockHeight)
+			for (int blockX = tile.x; blockX < tile.x + tile.width; blockX += blockWidth)
+			{
+				int count = 0;
+				for (int y = blockY; y < std::min(tile.y + tile.height, blockY + blockHeight); y++)
+					for (int x = blockX; x < std::min(tile.x + tile.width, blockX + blockWidth); x++)
+						if (sampler.active(y * width + x))
+						{
+							texelX[count] = x;
+							texelY[count] = height - 1 - y;
+							pixelIndex[count] = y * width + x;
+							count++;
+						}
+
+				if (count == 0)
+					continue;
+				renderPixels(packetWidth, tracer, passUniforms, texelX, texelY, count, colors);
+				for (int i = 0; i < count; i++)
+					sampler.addPass(pixelIndex[i], colors[i]);
+			}
+	};
+
+	timings.clear();
+	numSteals = 0;
+	for (int pass = 0; pass < maxPasses; pass++)
+	{
+		passUniforms.frameIndex = pass;
+		int passSteals = 0;
+		std::vector<TileTiming> passTimings = renderTiles(tiles, numThreads, renderTile, &passSteals, false);
+		timings.insert(timings.end(), passTimings.begin(), passTimings.end());
+		numSteals += passSteals;
+
+		int numActive = sampler.update();
+		std::cout << "Pass " << pass + 1 << ": " << numActive << " pixels above the noise threshold" << std::endl;
+		if (numActive == 0)
+			break;
+	}
+}
+
+void renderImageWavefront(const CPUTracer& tracer, const GlobalUniforms& uniforms, int frames, RaySort raySort, int raySortBatch,
+	const std::vector<Tile>& tiles, int numThreads, std::vector<glm::vec3>& image, std::vector<TileTiming>& timings, int& numSteals, WavefrontTimings& stageTimings)
+{
+	int width = uniforms.width;
+	image.assign(width * uniforms.height, glm::vec3(0.0f));
+
+	std::vector<WavefrontRenderer> renderers(numThreads, WavefrontRenderer(tracer, raySort, raySortBatch));
+	std::vector<WavefrontTimings> threadStageTimings(numThreads);
+	std::vector<std::vector<glm::vec3>> threadColors(numThreads);
+
+	auto renderTile = [&](int thread, const Tile& tile)
+	{
+		GlobalUniforms frameUniforms = uniforms;
+		std::vector<glm::vec3>& colors = threadColors[thread];
+
+		for (int frame = 0; frame < frames; frame++)
+		{
+			frameUniforms.frameIndex = frame;
+			renderers[thread].renderTile(frameUniforms, tile, colors, threadStageTimings[thread]);
+			for (int y = 0; y < tile.height; y++)
+				for (int x = 0; x < tile.width; x++)
+					image[(tile.y + y) * width + tile.x + x] += colors[y * tile.width + x] / float(frames);
+		}
+	};
+
+	timings = renderTiles(tiles, numThreads, renderTile, &numSteals);
+	for (const WavefrontTimings& threadTimings : threadStageTimings)
+		stageTimings.add(threadTimings);
+}
+
+void renderFeatures(const CPUTracer& tracer, const GlobalUniforms& uniforms, const std::vector<Tile>& tiles, int numThreads, FeatureBuffers& features)
+{
+	int width = uniforms.width;
+	int height = uniforms.height;
+	features.albedo.assign(width * height, glm::vec3(0.0f));
+	features.normal.assign(width * height, glm::vec3(0.0f));
+	features.depth.assign(width * height, 0.0f);
+
+	renderTiles(tiles, numThreads, [&](int, const Tile& tile)
+	{
+		for (int y = tile.y; y < tile.y + tile.height; y++)
+			for (int x = tile.x; x < tile.x + tile.width; x++)
+			{
+				int pixel = y * width + x;
+				tracer.firstHitFeatures(uniforms, x, height - 1 - y, features.albedo[pixel], features.normal[pixel], features.depth[pixel]);
+			}
+	}, nullptr, false);
+}
+
+// Normals mapped from [-1, 1] to [0, 1], depth scaled so the farthest hit is white
+bool writeFeatures(const std::string& stem, const FeatureBuffers& features, int width, int height)
+{
+	std::vector<glm::vec3> normals(features.normal.size());
+	for (size_t i = 0; i < normals.size(); i++)
+		normals[i] = features.normal[i] * 0.5f + 0.5f;
+
+	float farthest = *std::max_element(features.depth.begin(), features.depth.end());
+	std::vector<glm::vec3> depths(features.depth.size());
+	for (size_t i = 0; i < depths.size(); i++)
+		depths[i] = glm::vec3(farthest > 0.0f ? features.depth[i] / farthest : 0.0f);
+
+	return writeImage(stem + "_albedo.png", features.albedo, width, height)
+		&& writeImage(stem + "_normal.png", normals, width, height)
+		&& writeImage(stem + "_depth.png", depths, width, height);
+}
+
+// Shadow rays from the surface behind every pixel center, towards a light picked like next-event estimation does and
+// towards the basic shading light, traced over the binary BVH once for their closest hit and once as occlusion
+// queries. Prints the box and triangle tests the early exit saves
+void printOcclusionStats(const CPUTracer& tracer, const GlobalUniforms& uniforms)
+{
+	int width = uniforms.width;
+	int height = uniforms.height;
+	std::vector<ShadowRay> shadowRays;
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+		{
+			Ray ray = tracer.generateCenterRay(uniforms, x, y);
+			HitInfo hitInfo = tracer.closestHit(ray);
+			if (!hitInfo.didHit || tracer.materials[hitInfo.mtlIndex].materialType == LIGHT)
+				continue;
+
+			if (uniforms.numLights > 0 && tracer.lights)
+			{
+				PixelSampler sampler = tracer.pixelSampler(uniforms, x, y);
+				sampler.startSample();
+				ShadowRay shadowRay;
+				glm::vec3 origin = hitInfo.hitPoint - ray.direction * hitInfo.dst * -1e-3f;
+				tracer.sampleLight(hitInfo, origin, LightSampler(uniforms.lightSampler), glm::vec3(1.0f), glm::vec3(1.0f), sampler, shadowRay);
+				if (shadowRay.lightTriangle >= 0)
+					shadowRays.push_back(shadowRay);
+			}
+
+			glm::vec3 toLight = glm::vec3(uniforms.basicShadingLightPosition) - hitInfo.hitPoint;
+			ShadowRay shadowRay;
+			shadowRay.ray.origin = hitInfo.hitPoint + hitInfo.normal * 1e-4f;
+			shadowRay.ray.direction = glm::normalize(toLight);
+			shadowRay.ray.insideGlass = false;
+			shadowRay.maxDst = glm::length(toLight);
+			shadowRays.push_back(shadowRay);
+		}
+	if (shadowRays.empty())
+		return;
+
+	TraversalCounts closest, anyHit;
+	int numBlocked = 0, numDifferent = 0;
+	std::vector<char> blocked(shadowRays.size());
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < shadowRays.size(); i++)
+	{
+		const ShadowRay& shadowRay = shadowRays[i];
+		HitInfo hitInfo = tracer.calculateRayCollisionBVH(shadowRay.ray, &closest);
+		blocked[i] = hitInfo.didHit && hitInfo.triangleIndex != shadowRay.lightTriangle && hitInfo.dst < shadowRay.maxDst * 0.999f;
+	}
+	float closestSeconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < shadowRays.size(); i++)
+	{
+		const ShadowRay& shadowRay = shadowRays[i];
+		bool isBlocked = tracer.calculateRayOcclusionBVH(shadowRay.ray, shadowRay.maxDst * 0.999f, shadowRay.lightTriangle, &anyHit);
+		numBlocked += isBlocked;
+		numDifferent += isBlocked != bool(blocked[i]);
+	}
+	float anyHitSeconds = secondsSince(start);
+
+	double numRays = double(shadowRays.size());
+	std::cout << "Occlusion queries: " << shadowRays.size() << " shadow rays, " << numBlocked * 100.0 / numRays << "% blocked, "
+		<< numDifferent << " differ from the closest hit" << std::endl;
+	std::cout << "  closest hit: " << closest.nodeTests / numRays << " box tests, " << closest.triangleTests / numRays
+		<< " triangle tests per ray, " << closestSeconds * 1000.0f << " ms" << std::endl;
+	std::cout << "  any hit:     " << anyHit.nodeTests / numRays << " box tests, " << anyHit.triangleTests / numRays
+		<< " triangle tests per ray, " << anyHitSeconds * 1000.0f << " ms" << std::endl;
+	std::cout << "  saved " << 100.0 - anyHit.nodeTests * 100.0 / std::max(1LL, closest.nodeTests) << "% of the box tests, "
+		<< 100.0 - anyHit.triangleTests * 100.0 / std::max(1LL, closest.triangleTests) << "% of the triangle tests" << std::endl;
+}
+
+// A loaded scene and the tracer set up for it, the frames of a sequence and the jobs of a worker all render with one
+struct LoadedScene
+{
+	CPUScene scene;
+	std::unique_ptr<CPUTracer> tracer; // Refers to scene and wideBVHs, so a LoadedScene stays where it is
+	WideBVHs wideBVHs;
+	int kernelWidth = 1;
+};
+
+void loadScene(const RenderSettings& settings, LoadedScene& loaded)
+{
+	auto loadStart = std::chrono::steady_clock::now();
+	loadCPUScene(settings, loaded.scene);
+	std::cout << "Scene loaded in " << secondsSince(loadStart) << " seconds." << std::endl;
+
+	loaded.tracer.reset(new CPUTracer(loaded.scene.tracer()));
+	// Deterministic renders stay on the scalar code, whatever the CPU supports
+	loaded.kernelWidth = attachWideBVH(*loaded.tracer, loaded.scene, settings.deterministic ? 1 : settings.kernelWidth, loaded.wideBVHs);
+}
+
+// Uniforms of the settings' camera for a loaded scene
+GlobalUniforms makeSceneUniforms(const RenderSettings& settings, const CPUScene& scene, LightSampler lightSampler, SamplerType samplerType)
+{
+	Camera camera = makeCamera(settings);
+	GlobalUniforms uniforms = makeUniforms(settings, camera, scene.rtxTriangles.size(), scene.textures.size());
+	uniforms.numLights = scene.lights.lights.size();
+	uniforms.lightSampler = lightSampler;
+	uniforms.samplerType = samplerType;
+	return uniforms;
+}
+
+// Renders the scene of settings, image gets width * height pixels, top row first. The scene is loaded first unless
+// loadedScene already holds it. With a coordinator port the workers get sceneText, the scene file with the command
+// line settings appended
+bool renderScene(const RenderSettings& settings, std::vector<glm::vec3>& image, const std::string& sceneText = "", LoadedScene* loadedScene = nullptr)
+{
+	int numThreads = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+
+	TileOrder tileOrder;
+	if (!parseTileOrder(settings.tileOrder, tileOrder))
+		return false;
+	RaySort raySort;
+	if (!parseRaySort(settings.raySort, raySort))
+		return false;
+	LightSampler lightSampler;
+	if (!parseLightSampler(settings.lightSampler, lightSampler))
+		return false;
+	SamplerType samplerType;
+	if (!parseSamplerType(settings.sampler, samplerType))
+		return false;
+
+	// Loading mesh data
+	LoadedScene ownScene;
+	LoadedScene& loaded = loadedScene ? *loadedScene : ownScene;
+	if (!loadedScene)
+		loadScene(settings, loaded);
+	const CPUScene& scene = loaded.scene;
+	const CPUTracer& tracer = *loaded.tracer;
+	int kernelWidth = loaded.kernelWidth;
+
+	GlobalUniforms uniforms = makeSceneUniforms(settings, scene, lightSampler, samplerType);
+
+	int packetWidth = supportedSimdWidth(settings.deterministic ? 1 : settings.packetWidth);
+
+	std::cout << "Rendering " << settings.width << "x" << settings.height << " with " << numThreads << " threads, "
+		<< packetWidth << " wide ray packets, " << kernelWidth << " wide BVH nodes..." << std::endl;
+	auto renderStart = std::chrono::steady_clock::now();
+	TraceScope renderScope("render", "render", std::max(1, settings.frames));
+
+	std::vector<Tile> tiles = makeTiles(settings.width, settings.height, settings.tileSize, tileOrder);
+	std::vector<TileTiming> timings;
+	int numSteals = 0;
+	// Basic shading has no bounces to split into stages, workers only render fixed jobs with ray packets
+	bool distributed = settings.coordinatorPort > 0;
+	bool wavefront = settings.wavefront && !settings.basicShading && !distributed;
+	bool adaptive = settings.adaptive && !settings.basicShading && !distributed;
+	WavefrontTimings stageTimings;
+	// Its buffers take about 32 bytes a pixel, so only adaptive renders get one
+	std::unique_ptr<AdaptiveSampler> sampler;
+	if (distributed)
+	{
+		if (!renderImageDistributed(tracer, uniforms, settings, packetWidth, tileOrder, numThreads, sceneText, image))
+			return false;
+	}
+	else if (adaptive)
+	{
+		sampler.reset(new AdaptiveSampler(settings.width, settings.height, settings.adaptiveThreshold, settings.adaptiveMinPasses, std::max(1, settings.frames)));
+		renderImageAdaptive(tracer, uniforms, std::max(1, settings.frames), packetWidth, tiles, numThreads, *sampler, timings, numSteals);
+		image = sampler->image();
+	}
+	else if (wavefront)
+		renderImageWavefront(tracer, uniforms, std::max(1, settings.frames), raySort, settings.raySortBatch, tiles, numThreads, image, timings, numSteals, stageTimings);
+	else
+		renderImage(tracer, uniforms, std::max(1, settings.frames), packetWidth, tiles, numThreads, image, timings, numSteals);
+	renderScope.End();
+
+	std::cout << "Total render time: " << secondsSince(renderStart) << " seconds." << std::endl;
+	printTileStats(timings, numThreads, numSteals);
+	if (wavefront && !adaptive)
+		stageTimings.print();
+	if (adaptive)
+	{
+		long long uniformPasses = static_cast<long long>(settings.width) * settings.height * std::max(1, settings.frames);
+		std::cout << "Adaptive sampling: " << sampler->totalPasses() * settings.raysPerPixel << " samples, "
+			<< sampler->totalPasses() * 100.0 / uniformPasses << "% of a uniform render" << std::endl;
+		if (!settings.sampleHeatmap.empty() && writeImage(settings.sampleHeatmap, sampler->heatmap(), settings.width, settings.height))
+			std::cout << "Sample heatmap written to " << toNativePath(settings.sampleHeatmap) << std::endl;
+	}
+	if (!settings.tileTimings.empty() && writeTileTimings(settings.tileTimings, timings))
+		std::cout << "Tile timings written to " << toNativePath(settings.tileTimings) << std::endl;
+	if (settings.occlusionStats)
+		printOcclusionStats(tracer, uniforms);
+	if (!settings.traversalHeatmap.empty())
+	{
+		TraversalStatsImage stats;
+		collectTraversalStats(tracer, uniforms, numThreads, stats);
+		printTraversalHistograms(stats);
+		if (writeTraversalHeatmaps(settings.traversalHeatmap, stats))
+			std::cout << "Traversal heatmaps written to " << toNativePath(settings.traversalHeatmap) << "_*.png" << std::endl;
+	}
+
+	if (settings.denoise || !settings.featureOutput.empty())
+	{
+		auto denoiseStart = std::chrono::steady_clock::now();
+		FeatureBuffers features;
+		renderFeatures(tracer, uniforms, tiles, numThreads, features);
+		std::cout << "Feature buffers rendered in " << secondsSince(denoiseStart) << " seconds." << std::endl;
+
+		if (!settings.featureOutput.empty() && writeFeatures(settings.featureOutput, features, settings.width, settings.height))
+			std::cout << "Feature buffers written to " << toNativePath(settings.featureOutput) << "_*.png" << std::endl;
+
+		if (settings.denoise)
+		{
+			DenoiseSettings denoiseSettings;
+			denoiseSettings.iterations = settings.denoiseIterations;
+			denoiseSettings.colorSigma = settings.denoiseColorSigma;
+			denoiseSettings.depthSigma = settings.denoiseDepthSigma;
+
+			denoiseStart = std::chrono::steady_clock::now();
+			TraceScope denoiseScope("denoise", "render");
+			int denoiseWidth = packetWidth;
+			denoise(denoiseWidth, numThreads, settings.width, settings.height, features, denoiseSettings, image);
+			std::cout << "Denoised with " << denoiseWidth << " wide SIMD in " << secondsSince(denoiseStart) << " seconds." << std::endl;
+		}
+	}
+
+	if (settings.deterministic)
+		std::cout << "Image hash: " << std::hex << std::setw(16) << std::setfill('0') << imageHash(image) << std::dec << std::setfill(' ') << std::endl;
+	return true;
+}
+
+// Renders bandHeight rows at a time and writes every band to the output before the next one, so the memory grows with
+// the width of the image and not with its size. Bands render with the camera of the whole image, and with ray packets
+// only: denoising, adaptive sampling and the statistics need the whole image at once
+bool renderBands(const RenderSettings& settings)
+{
+	if (!ImageRowWriter::supports(settings.output))
+	{
+		std::cerr << "Band renders can only be written to png or exr: " << settings.output << std::endl;
+		return false;
+	}
+	int numThreads = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+
+	TileOrder tileOrder;
+	LightSampler lightSampler;
+	SamplerType samplerType;
+	if (!parseTileOrder(settings.tileOrder, tileOrder) || !parseLightSampler(settings.lightSampler, lightSampler) || !parseSamplerType(settings.sampler, samplerType))
+		return false;
+
+	LoadedScene loaded;
+	loadScene(settings, loaded);
+	GlobalUniforms uniforms = makeSceneUniforms(settings, loaded.scene, lightSampler, samplerType);
+	int packetWidth = supportedSimdWidth(settings.deterministic ? 1 : settings.packetWidth);
+	int frames = std::max(1, settings.frames);
+	int width = settings.width;
+
+	ImageRowWriter writer;
+	if (!writer.open(settings.output, width, settings.height, numThreads))
+		return false;
+
+	int bandHeight = std::min(settings.bandHeight, settings.height);
+	std::cout << "Rendering " << width << "x" << settings.height << " in bands of " << bandHeight << " rows with " << numThreads << " threads, "
+		<< packetWidth << " wide ray packets, " << loaded.kernelWidth << " wide BVH nodes..." << std::endl;
+	auto renderStart = std::chrono::steady_clock::now();
+
+	std::vector<glm::vec3> band(static_cast<size_t>(width) * bandHeight);
+	for (int bandY = 0; bandY < settings.height; bandY += bandHeight)
+	{
+		int numRows = std::min(bandHeight, settings.height - bandY);
+		std::fill(band.begin(), band.end(), glm::vec3(0.0f));
+
+		TraceScope scope("band", "render", bandY);
+		std::vector<Tile> tiles = makeTiles(width, numRows, settings.tileSize, tileOrder);
+		renderTiles(tiles, numThreads, [&](int, const Tile& bandTile)
+		{
+			Tile tile = bandTile;
+			tile.y += bandY;
+			renderTileFrames(*loaded.tracer, uniforms, packetWidth, tile, 0, frames, frames, &band[bandTile.y * width + bandTile.x], width);
+		}, nullptr, false);
+
+		if (!writer.writeRows(band.data(), numRows))
+		{
+			std::cerr << "Failed to write image: " << toNativePath(settings.output) << std::endl;
+			return false;
+		}
+		std::cout << "\rRows " << bandY + numRows << " of " << settings.height << " written" << std::flush;
+	}
+	std::cout << std::endl;
+
+	if (!writer.close())
+		return false;
+	std::cout << "Total render time: " << secondsSince(renderStart) << " seconds." << std::endl;
+	std::cout << "Image written to " << toNativePath(settings.output) << std::endl;
+	return true;
+}
+
+// Renders every model of the data folder at a low resolution and sample count, with and without the Cornell box, and
+// compares each with its golden image in referenceFolder. Returns the number of renders that failed
+int runRegression(const RenderSettings& baseSettings, const std::string& referenceFolder)
+{
+	std::vector<std::string> models;
+	for (const fs::directory_entry& entry : fs::directory_iterator(resolveDataFolder(baseSettings)))
+		if (entry.is_directory())
+			models.push_back(entry.path().filename().string());
+	std::sort(models.begin(), models.end());
+
+	std::vector<std::string> lines;
+	int numFailed = 0;
+	for (const std::string& model : models)
+		for (bool cornellBox : { true, false })
+		{
+			RenderSettings settings = baseSettings;
+			settings.model = model;
+			settings.cornellBox = cornellBox;
+			// Without the box's light the model is lit by the sky
+			settings.environmentalLight = settings.environmentalLight || !cornellBox;
+			settings.deterministic = true;
+
+			std::string name = model + (cornellBox ? "_cornell" : "");
+			std::string referencePath = (fs::path(toNativePath(referenceFolder)) / (name + ".png")).string();
+			if (!settings.createReferences && !fs::exists(referencePath))
+			{
+				lines.push_back(name + ": no reference image - FAILED");
+				numFailed++;
+				continue;
+			}
+
+			std::vector<glm::vec3> image;
+			ImageDifference difference;
+			if (!renderScene(settings, image)
+				|| !compareWithReference(referencePath, image, settings.width, settings.height, settings.createReferences, difference))
+			{
+				lines.push_back(name + ": could not be rendered or compared");
+				numFailed++;
+				continue;
+			}
+
+			lines.push_back(describeImageDifference(name, difference, settings.referenceTolerance));
+			numFailed += !difference.created && difference.rootMeanSquare > settings.referenceTolerance;
+		}
+
+	std::cout << std::endl << "Regression results:" << std::endl;
+	for (const std::string& line : lines)
+		std::cout << "  " << line << std::endl;
+	std::cout << numFailed << " of " << lines.size() << " renders failed" << std::endl;
+	if (numFailed > 0 && !baseSettings.createReferences)
+		std::cout << "Renders without a reference image fail, --set createReferences=1 records them" << std::endl;
+	return numFailed;
+}
+
+// Renders sequenceFrames frames along the camera path with one loaded scene, frame i goes to output_000i. The images
+// are written by writerThreads background threads while the next frames render. With a stream the frames go to it
+// instead
+bool renderSequence(const RenderSettings& settings)
+{
+	std::vector<CameraKeyframe> keyframes;
+	if (!loadCameraPath(settings.cameraPath, keyframes))
+		return false;
+
+	FrameStream stream;
+	StreamFormat streamFormat;
+	if (!settings.stream.empty()
+		&& (!parseStreamFormat(settings.streamFormat, streamFormat) || !stream.open(settings.stream, streamFormat, settings.width, settings.height, settings.streamFps)))
+		return false;
+
+	auto sequenceStart = std::chrono::steady_clock::now();
+	LoadedScene loaded;
+	loadScene(settings, loaded);
+
+	int numFrames = std::max(1, settings.sequenceFrames);
+	ImageWriterPool writers(settings.writerThreads, settings.writerThreads + 1);
+	std::vector<glm::vec3> image;
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		CameraKeyframe camera = sampleCameraPathFrame(keyframes, frame, numFrames);
+		RenderSettings frameSettings = settings;
+		frameSettings.cameraPosition = camera.position;
+		frameSettings.yaw = camera.yaw;
+		frameSettings.pitch = camera.pitch;
+		frameSettings.focusDistance = camera.focusDistance;
+		frameSettings.defocusAngle = camera.defocusAngle;
+		frameSettings.zoom = camera.zoom;
+
+		std::cout << "Frame " << frame + 1 << " of " << numFrames << std::endl;
+		TraceScope scope("sequence frame", "render", frame);
+		if (!renderScene(frameSettings, image, "", &loaded))
+			return false;
+		if (stream.isOpen())
+			stream.addFrame(image.data());
+		else
+			writers.add(sequenceFramePath(settings.output, frame), std::move(image), settings.width, settings.height);
+	}
+
+	int numFailed = writers.finish();
+	if (stream.isOpen())
+	{
+		numFailed += !stream.close();
+		std::cout << numFrames << " frames rendered in " << secondsSince(sequenceStart) << " seconds, streamed to " << settings.stream << std::endl;
+	}
+	else
+		std::cout << numFrames << " frames rendered in " << secondsSince(sequenceStart) << " seconds, written to "
+			<< sequenceFramePath(settings.output, 0) << " and on" << std::endl;
+	return numFailed == 0;
+}
+
+// Renders jobs for the coordinator at address (host:port) with its scene, overrides are applied on top of it
+bool runWorker(const std::string& address, const std::vector<std::string>& overrides)
+{
+	size_t colonPos = address.rfind(':');
+	if (colonPos == std::string::npos)
+	{
+		std::cerr << "Expected host:port, got: " << address << std::endl;
+		return false;
+	}
+	std::string host = address.substr(0, colonPos);
+	int port = std::atoi(address.substr(colonPos + 1).c_str());
+
+	RenderSettings settings;
+	for (const std::string& assignment : overrides)
+		if (!applySetting(settings, assignment))
+			return false;
+	float connectWait = settings.workerWait;
+
+	LoadedScene loaded;
+	GlobalUniforms uniforms{};
+	TileOrder tileOrder = TileOrder::Morton;
+	int numThreads = 1;
+	int packetWidth = 1;
+
+	auto loadSceneText = [&](const std::string& sceneText, RenderJob& whole)
+	{
+		settings = RenderSettings();
+		std::stringstream sceneStream(sceneText);
+		if (!loadRenderSettings(sceneStream, "coordinator scene", settings))
+			return false;
+		for (const std::string& assignment : overrides)
+			if (!applySetting(settings, assignment))
+				return false;
+
+		LightSampler lightSampler;
+		SamplerType samplerType;
+		if (!parseTileOrder(settings.tileOrder, tileOrder) || !parseLightSampler(settings.lightSampler, lightSampler) || !parseSamplerType(settings.sampler, samplerType))
+			return false;
+		numThreads = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+
+		loadScene(settings, loaded);
+
+		uniforms = makeSceneUniforms(settings, loaded.scene, lightSampler, samplerType);
+
+		packetWidth = supportedSimdWidth(settings.deterministic ? 1 : settings.packetWidth);
+		std::cout << "Rendering jobs with " << numThreads << " threads, " << packetWidth << " wide ray packets, "
+			<< loaded.kernelWidth << " wide BVH nodes..." << std::endl;
+
+		whole.width = settings.width;
+		whole.height = settings.height;
+		whole.numFrames = std::max(1, settings.frames);
+		return true;
+	};
+
+	auto render = [&](const RenderJob& job, std::vector<glm::vec3>& colors)
+	{
+		renderJob(*loaded.tracer, uniforms, std::max(1, settings.frames), packetWidth, settings.tileSize, tileOrder, numThreads, job, colors);
+	};
+
+	return serveRenderJobs(host, port, connectWait, loadSceneText, render);
+}
+
+int main(int argc, char* argv[])
+{
+	RenderSettings settings;
+	std::string scenePath;
+	std::string regressionFolder;
+	std::string workerAddress;
+	std::vector<std::string> overrides;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if ((arg == "-o" || arg == "--output") && hasValue)
+			overrides.push_back("output=" + std::string(argv[++i]));
+		else if ((arg == "-t" || arg == "--threads") && hasValue)
+			overrides.push_back("threads=" + std::string(argv[++i]));
+		else if (arg == "--set" && hasValue)
+			overrides.push_back(argv[++i]);
+		else if (arg == "--regression" && hasValue)
+			regressionFolder = argv[++i];
+		else if (arg == "--coordinator" && hasValue)
+			overrides.push_back("coordinatorPort=" + std::string(argv[++i]));
+		else if (arg == "--worker" && hasValue)
+			workerAddress = argv[++i];
+		else if (arg == "-h" || arg == "--help")
+		{
+			printUsage();
+			return EXIT_SUCCESS;
+		}
+		else if (scenePath.empty() && arg[0] != '-')
+			scenePath = arg;
+		else
+		{
+			std::cerr << "Unexpected argument: " << arg << std::endl;
+			printUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Workers get their scene from the coordinator
+	if (!workerAddress.empty())
+		return runWorker(workerAddress, overrides) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (scenePath.empty())
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (!loadRenderSettings(scenePath, settings))
+		return EXIT_FAILURE;
+	// Small and noisy is enough to notice a change, --set still overrides it
+	if (!regressionFolder.empty())
+	{
+		settings.width = 128;
+		settings.height = 128;
+		settings.raysPerPixel = 4;
+		settings.frames = 1;
+	}
+	for (const std::string& assignment : overrides)
+		if (!applySetting(settings, assignment))
+			return EXIT_FAILURE;
+
+	if (!regressionFolder.empty())
+		return runRegression(settings, regressionFolder) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	// Workers get the scene file's camera and end after one image, they can't follow a camera path
+	if (!settings.cameraPath.empty() && settings.coordinatorPort > 0)
+	{
+		std::cerr << "cameraPath can't be combined with --coordinator, render sequences locally" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// The frames have stdout to themselves
+	if (settings.stream == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+
+	enableTracing(!settings.trace.empty());
+	setTraceThreadName("main");
+
+	// Workers load the same scene file and command line settings, "key=value" becomes a "key value" line
+	std::string sceneText;
+	if (settings.coordinatorPort > 0)
+	{
+		sceneText = getFileContents(toNativePath(scenePath)) + "\n";
+		for (std::string assignment : overrides)
+			sceneText += assignment.replace(assignment.find('='), 1, " ") + "\n";
+	}
+
+	if (!settings.cameraPath.empty())
+	{
+		bool rendered = renderSequence(settings);
+		if (!settings.trace.empty() && writeTrace(toNativePath(settings.trace)))
+			std::cout << "Trace written to " << toNativePath(settings.trace) << std::endl;
+		return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (settings.bandHeight > 0 && settings.coordinatorPort <= 0)
+	{
+		bool rendered = renderBands(settings);
+		if (!settings.trace.empty() && writeTrace(toNativePath(settings.trace)))
+			std::cout << "Trace written to " << toNativePath(settings.trace) << std::endl;
+		return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	std::vector<glm::vec3> image;
+	if (!renderScene(settings, image, sceneText))
+		return EXIT_FAILURE;
+	if (!settings.trace.empty() && writeTrace(toNativePath(settings.trace)))
+		std::cout << "Trace written to " << toNativePath(settings.trace) << std::endl;
+
+	if (!writeImage(settings.output, image, settings.width, settings.height))
+		return EXIT_FAILURE;
+	std::cout << "Image written to " << toNativePath(settings.output) << std::endl;
+
+	if (!settings.reference.empty())
+	{
+		ImageDifference difference;
+		if (!compareWithReference(settings.reference, image, settings.width, settings.height, settings.createReferences, difference))
+			return EXIT_FAILURE;
+		std::cout << describeImageDifference(toNativePath(settings.reference), difference, settings.referenceTolerance) << std::endl;
+		if (!difference.created && difference.rootMeanSquare > settings.referenceTolerance)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -11,15 +11,26 @@
 #include <OpenGL/SSBO.h>
 #include <OpenGL/UBO.h>
 #include <OpenGL/FBO.h>
+#include <OpenGL/frameCapture.h>
+#include <OpenGL/atrousDenoiser.h>
+#include <OpenGL/frameProfiler.h>
+
+#include <profiling/traceRecorder.h>
 
 #include <RayTracing/Assets/headers/BVH.h>
 
 #include <RayTracing/Assets/headers/camera.h>
 #include <RayTracing/Assets/headers/mesh.h>
+#include <RayTracing/Assets/headers/scene.h>
+#include <RayTracing/Assets/headers/lights.h>
+#include <RayTracing/Assets/headers/sampler.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
+#include <RayTracing/Assets/headers/imageOutput.h>
+#include <RayTracing/Assets/headers/frameStream.h>
+
 #include <iomanip>
 #include <sstream>
 
@@ -46,17 +57,50 @@ const bool BASIC_SHADING = true;
 const bool BASIC_SHADING_SHADOW = false;
 const glm::vec3 LIGHT_POSITION = glm::vec3(10.0f, 10.0f, 1.0f);
 const bool ENVIRONMENTAL_LIGHT = false;
+// Keep averaging frames while the camera and settings stay the same, instead of showing every frame on its own
+const bool PROGRESSIVE = true;
+
+const bool NEXT_EVENT_ESTIMATION = true;
+const LightSampler LIGHT_SAMPLER = LIGHT_SAMPLER_ALIAS;
+const SamplerType SAMPLER = SAMPLER_SOBOL;
+// Filter what is shown with the à-trous denoiser, guided by the albedo, normal and depth of the first hits
+const bool DENOISE = false;
 
 const bool SCREENSHOT_BASIC_SHADING = false;
 const int SCREENSHOT_ENVIRONMENTAL_LIGHT = false;
 const int SCREENSHOT_MAX_BOUNCE_COUNT = 20;
 const int SCREENSHOT_RAYS_PER_PIXEL = 20;
 const int SCREENSHOT_FRAMES = 20;
+// Also writes the average after every frame to Images/test_<frame>.png
+const bool SCREENSHOT_SAVE_PROGRESS = false;
+// Saves the denoised average instead of the raw one
+const bool SCREENSHOT_DENOISE = false;
+// .png, or .exr / .hdr to keep the float average unclamped
+const std::string SCREENSHOT_FORMAT = ".png";
+// Screenshots are compressed and written by these threads while rendering goes on
+const int SCREENSHOT_WRITER_THREADS = 2;
 
 const float CORNELL_LIGHT_BRIGHTNESS = 10.0f;
 const float CORNELL_PADDING = 0.25f;
 const float CORNELL_LIGHT_SIZE = 0.3f;
 
+// Times the stages of every frame on the CPU and the GPU, prints a summary every PROFILE_SUMMARY_SECONDS and writes
+// the startup and the last frames to frameTrace.json on exit (open it in chrome://tracing or Perfetto)
+const bool PROFILE = false;
+const float PROFILE_SUMMARY_SECONDS = 5.0f;
+
+// Records model parsing, texture decoding, BVH building, shader compiles, buffer uploads and every frame as trace
+// events and writes them to lifecycleTrace.json on exit
+const bool TRACE = false;
+
+// Sends every frame shown to a video encoder, "-" for stdout or a named pipe like "\\\\.\\pipe\\rayTracer", empty to skip
+// it. See frameStream.h for the formats and the ffmpeg command lines
+const std::string STREAM_PATH = "";
+const StreamFormat STREAM_FORMAT = StreamFormat::Y4M;
+
+// Compares the first sample of a few pixels on the GPU with sampler.h at startup, so the two can't drift apart unnoticed
+const bool CHECK_SAMPLER = true;
+
 const int FPS = 120;
 const float SPF = 1.0f / FPS;
 
@@ -79,7 +123,72 @@ float vertices[] = {
 	 1.0f,  1.0f, 0.0f
 };
 
-void screenshot(GLFWwindow* window, Camera& camera, VAO& VAO, UBO& UBO, GlobalUniforms& uniforms, Shader& renderShader, ComputeShader& computeShader, Texture2D screenTexture, bool& terminateProgram)
+// Has the compute shader write the numbers of the first sample of SAMPLE_CHECK_PIXELS pixels, in every dimension up to
+// SAMPLE_CHECK_DIMENSIONS and with every sampler, and compares them with what sampler.h gives for the same pixels.
+// Returns the number of values that differ
+int checkSamplerAgainstCPU(ComputeShader& computeShader, UBO& UBO, Texture2D& screenTexture, GlobalUniforms uniforms)
+{
+	const int SPACING = 97, PIXELS = 8, DIMENSIONS = 12; // As in compute.glsl
+	std::vector<glm::vec4> gpuValues(PIXELS * DIMENSIONS, glm::vec4(-1.0f));
+	SSBO checkSSBO(gpuValues.data(), sizeof(glm::vec4) * gpuValues.size(), 6);
+	computeShader.bindSSBOToBlock(checkSSBO, "SampleCheckBlock");
+
+	uniforms.width = SCR_WIDTH;
+	uniforms.height = SCR_HEIGHT;
+	uniforms.frameIndex = 3;
+	uniforms.numRaysPerPixel = 5;
+	uniforms.seed = 7;
+
+	int numDifferent = 0;
+	for (SamplerType samplerType : { SAMPLER_PCG, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE })
+	{
+		uniforms.samplerType = samplerType;
+		UBO.Update(&uniforms, sizeof(GlobalUniforms));
+		// The shader takes the pixel index from the size of its output image
+		screenTexture.BindImage(0, GL_READ_WRITE);
+		computeShader.Activate();
+		computeShader.setBool("checkSamples", true);
+		glDispatchCompute(ceil(SCR_WIDTH / WORK_SIZE_X), ceil(SCR_HEIGHT / WORK_SIZE_Y), 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		checkSSBO.Read(gpuValues.data(), sizeof(glm::vec4) * gpuValues.size());
+
+		for (int pixel = 0; pixel < PIXELS; pixel++)
+		{
+			// The same setup as the shader's main() and CPUTracer::pixelSampler()
+			int texel = pixel * SPACING;
+			uint32_t pixelIndex = texel + texel * SCR_WIDTH;
+			PixelSampler sampler;
+			sampler.type = samplerType;
+			sampler.seedHash = hashInt(uniforms.seed);
+			sampler.rngState = pixelIndex + uniforms.frameIndex * 968824447u + sampler.seedHash;
+			sampler.pixelHash = hashInt(pixelIndex ^ sampler.seedHash);
+			sampler.pixelX = texel;
+			sampler.pixelY = texel;
+			sampler.nextSampleIndex = uniforms.frameIndex * uint32_t(uniforms.numRaysPerPixel);
+			sampler.startSample();
+
+			for (int dimension = 0; dimension < DIMENSIONS; dimension++)
+			{
+				float value = sampler.get1D(dimension);
+				glm::vec2 value2D = sampler.get2D(dimension);
+				glm::vec4 gpu = gpuValues[pixel * DIMENSIONS + dimension];
+				// GPU division and fract() may round differently in the last bits
+				if (std::abs(gpu.x - value) > 1e-4f || std::abs(gpu.y - value2D.x) > 1e-4f || std::abs(gpu.z - value2D.y) > 1e-4f)
+				{
+					if (numDifferent++ < 10)
+						std::cout << "Sampler " << samplerType << ", pixel (" << texel << ", " << texel << "), dimension " << dimension << ": GPU "
+							<< gpu.x << " " << gpu.y << " " << gpu.z << ", CPU " << value << " " << value2D.x << " " << value2D.y << std::endl;
+				}
+			}
+		}
+	}
+
+	computeShader.setBool("checkSamples", false);
+	checkSSBO.Delete();
+	return numDifferent;
+}
+
+void screenshot(GLFWwindow* window, Camera& camera, VAO& VAO, UBO& UBO, GlobalUniforms& uniforms, Shader& renderShader, ComputeShader& computeShader, Texture2D screenTexture, AtrousDenoiser& denoiser, ImageWriterPool& writers, bool& terminateProgram)
 {
 	std::cout << "High quality image is being drawn, this may takes a while..." << std::endl;
 
@@ -88,65 +197,66 @@ void screenshot(GLFWwindow* window, Camera& camera, VAO& VAO, UBO& UBO, GlobalUn
 	uniforms.maxBounceCount = SCREENSHOT_MAX_BOUNCE_COUNT;
 	uniforms.numRaysPerPixel = SCREENSHOT_RAYS_PER_PIXEL;
 	uniforms.frameIndex = 0;
+	// The compute shader averages the frames in screenTexture itself, so nothing is read back until the end
+	uniforms.accumulate = true;
+	uniforms.writeFeatures = SCREENSHOT_DENOISE;
 
 	camera.updateUniforms(uniforms);
 	UBO.Update(&uniforms, sizeof(GlobalUniforms));
 
-	// Allocate memory to store pixel data
-	GLubyte* pixels = new GLubyte[3 * SCR_WIDTH * SCR_HEIGHT]{ 0 };
-	float* pixelsCumulative = new float[3 * SCR_WIDTH * SCR_HEIGHT]{ 0 };
-
 	// Draw	
 	VAO.Bind();
 
-	Texture2D screenshotTexture(SCR_WIDTH, SCR_HEIGHT, nullptr, 0, GL_RGB, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_TEXTURE6);
-	FBO FBO(screenshotTexture);
-
 	float renderStart = glfwGetTime();
 
+	// Read back asynchronously, so saving the average of one frame overlaps with rendering the next
+	FrameCapture capture(SCR_WIDTH, SCR_HEIGHT, GL_RGBA, GL_FLOAT, 4 * sizeof(float), [&writers](int frame, const void* data)
+	{
+		// Only copied here, the writer threads flip the image vertically (OpenGL's origin is at the bottom-left, but most
+		// images start at the top-left). Progress images are skipped while the writers are behind, the last one never is
+		bool last = frame == SCREENSHOT_FRAMES - 1;
+		std::string name = last ? "Images/test" : "Images/test_" + std::to_string(frame);
+		if (!writers.addTexels(getPath(name + SCREENSHOT_FORMAT, 1), static_cast<const glm::vec4*>(data), SCR_WIDTH, SCR_HEIGHT, !last))
+			std::cout << "Writers are busy, skipped " << name << SCREENSHOT_FORMAT << std::endl;
+	});
+
 	for (int i = 0; i < SCREENSHOT_FRAMES; i++)
 	{	
-		float start = glfwGetTime();
 		uniforms.frameIndex = i;
 		UBO.Update(&uniforms, sizeof(GlobalUniforms));
 
+		screenTexture.BindImage(0, GL_READ_WRITE);
+		if (SCREENSHOT_DENOISE)
+			denoiser.BindFeatures();
 		computeShader.Activate();
 		glDispatchCompute(ceil(SCR_WIDTH / WORK_SIZE_X), ceil(SCR_HEIGHT / WORK_SIZE_Y), 1);
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 		
-		screenTexture.SetActive();
-		screenTexture.Bind();
-		FBO.Bind();
+		// Show the average so far
 		glClear(GL_COLOR_BUFFER_BIT);
 		renderShader.Activate();
 		VAO.Bind();
+		screenTexture.SetActive();
+		screenTexture.Bind();
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 
-		glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-		for (int j = 0; j < 3 * SCR_WIDTH * SCR_HEIGHT; j++)
-			pixelsCumulative[j] += pixels[j];
-		
-		std::cout << "Frame " << i << " done. Render time: " << glfwGetTime() - start << std::endl;
+		// The float average is only rounded to 8 bits once, when it is saved
+		if (SCREENSHOT_SAVE_PROGRESS || i == SCREENSHOT_FRAMES - 1)
+		{
+			Texture2D& result = SCREENSHOT_DENOISE ? denoiser.Denoise(screenTexture) : screenTexture;
+			glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+			capture.Capture(result, i);
+		}
+		capture.Poll();
+
+		std::cout << "Frame " << i << " queued." << std::endl;
 		glfwSwapBuffers(window);
 	}
 
-	screenshotTexture.Delete();
-	FBO.Delete();
-
-	// Get the average result of all frames
-	for (int j = 0; j < 3 * SCR_WIDTH * SCR_HEIGHT; j++)
-		pixels[j] = pixelsCumulative[j] / SCREENSHOT_FRAMES;
-
-	// Flip the image vertically(OpenGL's origin is at the bottom-left, but most images start at the top-left)
-	for (int y = 0; y < SCR_HEIGHT / 2; y++)
-		for (int x = 0; x < SCR_WIDTH * 3; x++)
-			std::swap(pixels[y * SCR_WIDTH * 3 + x], pixels[(SCR_HEIGHT - 1 - y) * SCR_WIDTH * 3 + x]);
-
-	std::string path = getPath("\\Images\\test.png", 1);
-	stbi_write_png(path.c_str(), SCR_WIDTH, SCR_HEIGHT, 3, pixels, SCR_WIDTH * 3);
-
-	delete[] pixels;
-	delete[] pixelsCumulative;
+	capture.Flush();
+	capture.Delete();
+	uniforms.accumulate = false;
+	uniforms.writeFeatures = false;
 
 	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -207,144 +317,6 @@ void keyBoardInput(GLFWwindow* window, Camera& camera, float dt, bool& isScreens
 	isScreenshot = (glfwGetKey(window, GLFW_KEY_S) && glfwGetKey(window, GLFW_KEY_LEFT_CONTROL));
 }
 
-void addSkyLightPlane(std::vector<RTXTriangle>& rtxTriangles, std::vector<BVHTriangle>& bvhTriangles, int lightMtlIndex)
-{
-	BoundingBox sceneBounds;
-	for (const BVHTriangle& tri : bvhTriangles)
-		sceneBounds.growToInclude(tri);
-
-	glm::vec3 sceneSize = sceneBounds.size();
-	float minX = sceneBounds.min.x;
-	float maxX = sceneBounds.max.x;
-	float minY = sceneBounds.min.y;
-	float maxY = sceneBounds.max.y;
-	float minZ = sceneBounds.min.z;
-	float maxZ = sceneBounds.max.z;
-	
-	float planeY = maxY + sceneSize.y * 0.1f;
-
-	glm::vec3 boxSize = glm::vec3(maxX, maxY, maxZ) - glm::vec3(minX, minY, minZ);
-
-	std::vector<glm::vec3> skyCorners = 
-	{
-		glm::vec3(minX, planeY, maxZ),
-		glm::vec3(maxX, planeY, maxZ),
-		glm::vec3(minX, planeY, minZ),
-		glm::vec3(maxX, planeY, minZ),
-	};
-
-	int skyCornersIndicies[2][3] =
-	{
-		{0, 3, 1},
-		{0, 2, 3}
-	};
-
-	std::vector<RTXTriangle> skyTrianglesRTX;
-	for (int i = 0 ; i < 2; i++)
-		skyTrianglesRTX.push_back(RTXTriangle(lightMtlIndex, glm::vec4(skyCorners[skyCornersIndicies[i][0]], 0.0f),  glm::vec4(skyCorners[skyCornersIndicies[i][1]], 0.0f),
-							 glm::vec4(skyCorners[skyCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
-	std::vector<BVHTriangle> skyTrianglesBVH;
-	for (int i = 0 ; i < 2; i++)
-		skyTrianglesBVH.push_back(BVHTriangle(skyCorners[skyCornersIndicies[i][0]], skyCorners[skyCornersIndicies[i][1]], skyCorners[skyCornersIndicies[i][2]]));
-
-	rtxTriangles.insert(rtxTriangles.end(), skyTrianglesRTX.begin(), skyTrianglesRTX.end());
-	bvhTriangles.insert(bvhTriangles.end(), skyTrianglesBVH.begin(), skyTrianglesBVH.end());
-	rtxTriangles.insert(rtxTriangles.end(), skyTrianglesRTX.begin(), skyTrianglesRTX.end());
-	bvhTriangles.insert(bvhTriangles.end(), skyTrianglesBVH.begin(), skyTrianglesBVH.end());
-}
-
-void addCornellBox(std::vector<RTXTriangle>& rtxTriangles, std::vector<BVHTriangle>& bvhTriangles, float lightSize, float padPercentage, int lightMtlIndex)
-{
-	BoundingBox sceneBounds;
-	for (const BVHTriangle& tri : bvhTriangles)
-		sceneBounds.growToInclude(tri);
-
-	glm::vec3 sceneSize = sceneBounds.size();
-	float minX = sceneBounds.min.x - sceneSize.x * padPercentage;
-	float maxX = sceneBounds.max.x + sceneSize.x * padPercentage;
-	float minY = sceneBounds.min.y - sceneSize.y * padPercentage * 0.1f;
-	float maxY = sceneBounds.max.y + sceneSize.y * padPercentage;
-	float minZ = sceneBounds.min.z - sceneSize.z * padPercentage;
-	float maxZ = sceneBounds.max.z + sceneSize.z * padPercentage;
-
-	std::vector<glm::vec3> corners = 
-	{
-		glm::vec3(minX, minY, maxZ),
-		glm::vec3(maxX, minY, maxZ),
-		glm::vec3(minX, maxY, maxZ),
-		glm::vec3(maxX, maxY, maxZ),
-		glm::vec3(minX, minY, minZ),
-		glm::vec3(maxX, minY, minZ),
-		glm::vec3(minX, maxY, minZ),
-		glm::vec3(maxX, maxY, minZ),
-	};
-
-	glm::vec3 boxSize = glm::vec3(maxX, maxY, maxZ) - glm::vec3(minX, minY, minZ);
-	float centerX = (maxX + minX) / 2.0f;
-	float centerZ = (maxZ + minZ) / 2.0f;
-	float lightMinX = centerX - lightSize * boxSize.x / 2.0f;
-	float lightMaxX = centerX + lightSize * boxSize.x / 2.0f;
-	float lightMinZ = centerZ - lightSize * boxSize.z / 2.0f;
-	float lightMaxZ = centerZ + lightSize * boxSize.z / 2.0f;
-	float lightY = maxY - 1e-3f;
-
-	std::vector<glm::vec3> lightCorners =
-	{
-		glm::vec3(lightMinX, lightY, lightMaxZ),
-		glm::vec3(lightMaxX, lightY, lightMaxZ),
-		glm::vec3(lightMinX, lightY, lightMinZ),
-		glm::vec3(lightMaxX, lightY, lightMinZ),
-	};
-
-	int triCornersIndicies[12][3] =
-	{
-		{0, 3, 1},
-		{0, 2, 3},
-		{0, 5, 4},
-		{0, 1, 5},
-		{0, 6, 2},
-		{0, 4, 6},
-		{7, 1, 3},
-		{7, 5, 1},
-		{7, 2, 6},
-		{7, 3, 2},
-		{7, 4, 5},
-		{7, 6, 4}
-	};
-
-	int lightCornersIndicies[4][3] =
-	{
-		{0, 3, 1},
-		{0, 2, 3},
-		{0, 1, 3},
-		{0, 3, 2}
-	};
-
-	std::vector<RTXTriangle> cornellCornersRTX;
-	for (int i = 0 ; i < 12; i++)
-	{
-		Material mat = Material();
-		cornellCornersRTX.push_back(RTXTriangle(0, glm::vec4(corners[triCornersIndicies[i][0]], 0.0f),  glm::vec4(corners[triCornersIndicies[i][1]], 0.0f),
-							 glm::vec4(corners[triCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
-	}
-	std::vector<BVHTriangle> cornellCornersBVH;
-	for (int i = 0 ; i < 12; i++)
-		cornellCornersBVH.push_back(BVHTriangle(corners[triCornersIndicies[i][0]], corners[triCornersIndicies[i][1]], corners[triCornersIndicies[i][2]]));
-
-	std::vector<RTXTriangle> cornellLightRTX;
-	for (int i = 0 ; i < 4; i++)
-		cornellLightRTX.push_back(RTXTriangle(lightMtlIndex, glm::vec4(lightCorners[lightCornersIndicies[i][0]], 0.0f),  glm::vec4(lightCorners[lightCornersIndicies[i][1]], 0.0f),
-							 glm::vec4(lightCorners[lightCornersIndicies[i][2]], 0.0f), glm::vec2(), glm::vec2(), glm::vec2()));
-	std::vector<BVHTriangle> cornellLightBVH;
-	for (int i = 0 ; i < 4; i++)
-		cornellLightBVH.push_back(BVHTriangle(lightCorners[triCornersIndicies[i][0]], lightCorners[triCornersIndicies[i][1]], lightCorners[triCornersIndicies[i][2]]));
-
-	rtxTriangles.insert(rtxTriangles.end(), cornellCornersRTX.begin(), cornellCornersRTX.end());
-	bvhTriangles.insert(bvhTriangles.end(), cornellCornersBVH.begin(), cornellCornersBVH.end());
-	rtxTriangles.insert(rtxTriangles.end(), cornellLightRTX.begin(), cornellLightRTX.end());
-	bvhTriangles.insert(bvhTriangles.end(), cornellLightBVH.begin(), cornellLightBVH.end());
-}
-
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	glViewport(0, 0, width, height);
@@ -364,6 +336,9 @@ GLfloat ndcVertices[] =
 
 int main(int argc, char* argv[])
 {
+	enableTracing(TRACE);
+	setTraceThreadName("main");
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
@@ -395,12 +370,34 @@ int main(int argc, char* argv[])
 	}
 	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
+	FrameProfiler profiler;
+	ImageWriterPool screenshotWriters(SCREENSHOT_WRITER_THREADS, SCREENSHOT_WRITER_THREADS + 1);
+
+	// The frames have stdout to themselves
+	if (STREAM_PATH == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+	FrameStream frameStream;
+	if (!STREAM_PATH.empty() && !frameStream.open(STREAM_PATH, STREAM_FORMAT, SCR_WIDTH, SCR_HEIGHT, FPS))
+		return -1;
+	// Shown frames are read back through the capture's PBOs and converted straight from the mapped memory
+	FrameCapture streamCapture(SCR_WIDTH, SCR_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 4, [&frameStream](int frame, const void* data)
+	{
+		frameStream.addFrame(static_cast<const unsigned char*>(data), true);
+	}, STREAM_PATH.empty() ? 0 : 3);
+	profiler.enabled = PROFILE;
+
 	// Loading mesh data
+	profiler.BeginStage("load model");
 	std::vector<RTXTriangle> rtxTriangles;
 	std::vector<BVHTriangle> bvhTriangles;
 	std::vector<Material> materials;
+	std::vector<std::string> texturePaths;
+	getTrianglesData_(getPath("Data/" + modelFolderName, 1), rtxTriangles, bvhTriangles, materials, texturePaths);
+
+	profiler.BeginStage("load textures");
 	std::vector<Texture2D> textures;
-	getTrianglesData_("Data\\" + modelFolderName, 1, rtxTriangles, bvhTriangles, materials, textures);
+	for (int i = 0; i < texturePaths.size(); i++)
+		textures.push_back(Texture2D(texturePaths[i], GL_TEXTURE0 + i));
 
 	Material mat;
 	mat.makeLight(glm::vec3(1.0f), CORNELL_LIGHT_BRIGHTNESS);
@@ -408,16 +405,23 @@ int main(int argc, char* argv[])
 	addCornellBox(rtxTriangles, bvhTriangles, CORNELL_LIGHT_SIZE, CORNELL_PADDING, materials.size() - 1);
 	// addSkyLightPlane(rtxTriangles, bvhTriangles, materials.size() - 1);
 
+	profiler.BeginStage("build BVH");
 	BVH BVH(bvhTriangles, rtxTriangles);
+	profiler.BeginStage("build light list");
+	LightList lights = buildLightList(rtxTriangles, materials);
+	// An SSBO can't be empty, the shader doesn't read the entries when numLights is 0
+	std::vector<LightEntry> lightEntries = lights.lights.empty() ? std::vector<LightEntry>(1, LightEntry{}) : lights.lights;
+	std::vector<LightNode> lightNodes = lights.nodes.empty() ? std::vector<LightNode>(1, LightNode{}) : lights.nodes;
 
 	// for (RTXTriangle& tri : rtxTriangles)
 	// 	tri.material.makeSpecular(glm::vec3(0.0f, 1.0f, 1.0f), glm::vec3(1.0f), 1.0f, 1.0f);
 
 	// build and compile shaders
 	// -------------------------
-	std::string shaderFolderPath = getPath("Assets\\Shaders", 1);
-	Shader renderShader(shaderFolderPath + "\\vert.glsl", shaderFolderPath + "\\newFrag.glsl");
-	ComputeShader computeShader(shaderFolderPath + "\\compute.glsl");
+	profiler.BeginStage("compile shaders");
+	std::string shaderFolderPath = getPath("Assets/Shaders", 1);
+	Shader renderShader(toNativePath(shaderFolderPath + "/vert.glsl"), toNativePath(shaderFolderPath + "/newFrag.glsl"));
+	ComputeShader computeShader(toNativePath(shaderFolderPath + "/compute.glsl"));
 	renderShader.Activate();
 	renderShader.setInt("tex", 5);
 
@@ -426,6 +430,8 @@ int main(int argc, char* argv[])
 
 	// Texture for the compute shader to draw on
 	Texture2D screenTexture(SCR_WIDTH, SCR_HEIGHT, GL_TEXTURE5);
+	// Its results go to the same unit, so the quad shows them the same way
+	AtrousDenoiser denoiser(SCR_WIDTH, SCR_HEIGHT, toNativePath(shaderFolderPath + "/denoise.glsl"), GL_TEXTURE5);
 	for (int i = 0; i < textures.size(); i++)
 	{
 		computeShader.setInt(("texture" + std::to_string(i)).c_str(), i);
@@ -434,22 +440,39 @@ int main(int argc, char* argv[])
 	}
 
 	// SSBOs for triangles and nodes
+	profiler.BeginStage("upload scene");
 	SSBO trianglesSSBO(rtxTriangles.data(), sizeof(RTXTriangle) * rtxTriangles.size(), 1);
 	SSBO nodesSSBO(BVH.allNodes.data(), sizeof(Node) * BVH.allNodes.size(), 2);
 	SSBO materialsSSBO(materials.data(), sizeof(Material) * materials.size(), 3);
+	SSBO lightsSSBO(lightEntries.data(), sizeof(LightEntry) * lightEntries.size(), 4);
+	SSBO lightNodesSSBO(lightNodes.data(), sizeof(LightNode) * lightNodes.size(), 5);
 
 	// Set shader's constants
 	computeShader.bindSSBOToBlock(trianglesSSBO, "TrianglesBlock");
 	computeShader.bindSSBOToBlock(nodesSSBO, "NodesBlock");
 	computeShader.bindSSBOToBlock(materialsSSBO, "MaterialsBlock");
+	computeShader.bindSSBOToBlock(lightsSSBO, "LightsBlock");
+	computeShader.bindSSBOToBlock(lightNodesSSBO, "LightNodesBlock");
+	profiler.EndStage();
+	if (PROFILE)
+		profiler.PrintStartup(std::cout);
 
 	// Transfer uniforms with UBO
-	GlobalUniforms uniforms;
+	GlobalUniforms uniforms{};
 	UBO UBO(3, sizeof(GlobalUniforms));
 
 	// Create camera
 	Camera camera = Camera(SCR_WIDTH, SCR_HEIGHT, speed, cameraPos, hfov, pitch, yaw, focusDistance, defocusAngle, zoom);
 
+	if (CHECK_SAMPLER)
+	{
+		int numDifferent = checkSamplerAgainstCPU(computeShader, UBO, screenTexture, uniforms);
+		if (numDifferent > 0)
+			std::cout << numDifferent << " GPU sample values differ from sampler.h" << std::endl;
+		else
+			std::cout << "GPU samples match sampler.h" << std::endl;
+	}
+
 	// Is later used by glfwGetWindowUserPointer in glfwSetCursorPosCallback and glfwSetScrollCallback to get the camera, avoiding global variables
 	glfwSetWindowUserPointer(window, &camera);
 	glfwSetCursorPosCallback(window, mouseCallback);
@@ -475,26 +498,37 @@ int main(int argc, char* argv[])
 		if (deltaTime < SPF)
 			continue;
 		lastFrame = currentFrame;
+		TraceScope frameScope("frame", "frame", frameIndex);
+		profiler.BeginFrame();
 
 		// Set window title with FPS
 		std::ostringstream fps;
 		fps << std::fixed << std::setprecision(2) << 1.0f / deltaTime;
 		std::string title = "Demo - FPS:" + fps.str();
+		if (PROGRESSIVE)
+			title += " - Frames: " + std::to_string(frameIndex);
 		glfwSetWindowTitle(window, title.c_str());
 
 		// Keyboard input
+		profiler.BeginStage("input", false);
 		bool isScreenshot;
 		keyBoardInput(window, camera, deltaTime, isScreenshot);
 
 		// Screenshot
 		bool terminateProgram = false;
 		if (isScreenshot)
-			screenshot(window, camera, VAO, UBO, uniforms, renderShader, computeShader, screenTexture, terminateProgram);
+		{
+			profiler.BeginStage("screenshot", false);
+			screenshot(window, camera, VAO, UBO, uniforms, renderShader, computeShader, screenTexture, denoiser, screenshotWriters, terminateProgram);
+			// The screenshot left its own average in screenTexture
+			camera.viewChanged = true;
+		}
 
 		if (terminateProgram)
 			glfwSetWindowShouldClose(window, true);		
 
 		// Uniforms
+		profiler.BeginStage("update uniforms");
 		uniforms.numTextures = textures.size();
 		uniforms.width = SCR_WIDTH;
 		uniforms.height = SCR_HEIGHT;
@@ -505,32 +539,79 @@ int main(int argc, char* argv[])
 		uniforms.basicShadingLightPosition = glm::vec4(LIGHT_POSITION, 0.0f);
 		uniforms.environmentalLight = ENVIRONMENTAL_LIGHT;
 		uniforms.maxBounceCount = MAX_BOUNCE_COUNT;
+		uniforms.nextEventEstimation = NEXT_EVENT_ESTIMATION;
+		uniforms.numLights = lights.lights.size();
+		uniforms.lightSampler = LIGHT_SAMPLER;
+		uniforms.samplerType = SAMPLER;
+		// Start a new average when the view or the number of rays changes, frameIndex counts the frames in it
+		if (camera.viewChanged || uniforms.numRaysPerPixel != int(numRaysPerPixel))
+		{
+			camera.viewChanged = false;
+			frameIndex = 0;
+		}
 		uniforms.numRaysPerPixel = numRaysPerPixel;
 		uniforms.frameIndex = frameIndex;
+		uniforms.accumulate = PROGRESSIVE;
+		uniforms.writeFeatures = DENOISE;
 		frameIndex++;
 		// Update uniforms based on changes of position, rotation, and zooming
 		camera.updateUniforms(uniforms);
 
 		UBO.Update(&uniforms, sizeof(GlobalUniforms));
 
+		// The denoiser uses image unit 0 as well
+		profiler.BeginStage("dispatch");
+		screenTexture.BindImage(0, GL_READ_WRITE);
+		if (DENOISE)
+			denoiser.BindFeatures();
 		computeShader.Activate();
 		glDispatchCompute(ceil(SCR_WIDTH / WORK_SIZE_X), ceil(SCR_HEIGHT / WORK_SIZE_Y), 1);
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
+		if (DENOISE)
+			profiler.BeginStage("denoise");
+		Texture2D& shownTexture = DENOISE ? denoiser.Denoise(screenTexture) : screenTexture;
+
 		// render image to quad
+		profiler.BeginStage("blit");
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		renderShader.Activate();
 		VAO.Bind();
 
-		screenTexture.SetActive();
-		screenTexture.Bind();
+		shownTexture.SetActive();
+		shownTexture.Bind();
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 
+		if (frameStream.isOpen())
+		{
+			profiler.BeginStage("stream");
+			glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+			streamCapture.Capture(shownTexture, frameIndex);
+			streamCapture.Poll();
+		}
+
+		profiler.BeginStage("swap");
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		profiler.EndFrame();
+
+		if (PROFILE)
+			profiler.PrintSummaryEvery(PROFILE_SUMMARY_SECONDS, std::cout);
 	}
 
+	if (PROFILE && profiler.WriteChromeTrace(getPath("frameTrace.json", 1)))
+		std::cout << "Frame trace written to " << getPath("frameTrace.json", 1) << std::endl;
+	profiler.Delete();
+	screenshotWriters.finish();
+	streamCapture.Flush();
+	streamCapture.Delete();
+	frameStream.close();
+
+	if (TRACE && writeTrace(getPath("lifecycleTrace.json", 1)))
+		std::cout << "Lifecycle trace written to " << getPath("lifecycleTrace.json", 1) << std::endl;
+
 	screenTexture.Delete();
+	denoiser.Delete();
 	computeShader.Delete();
 	renderShader.Delete();
 	VAO.Delete();
@@ -539,6 +620,8 @@ int main(int argc, char* argv[])
 	trianglesSSBO.Delete();
 	nodesSSBO.Delete();
 	materialsSSBO.Delete();
+	lightsSSBO.Delete();
+	lightNodesSSBO.Delete();
 
 	for (Texture2D& tex : textures)
 		tex.Delete();
@@ -3,27 +3,51 @@
 #include <fstream>
 #include <sstream>
 #include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#include <climits>
+#endif
 
 // Returns the path to the executable directory
 std::string getExecutableDirectory() {
+#ifdef _WIN32
     char buffer[MAX_PATH];
     GetModuleFileNameA(NULL, buffer, MAX_PATH);
-    std::string::size_type pos = std::string(buffer).find_last_of("\\/");
-    return std::string(buffer).substr(0, pos);
+    std::string exePath(buffer);
+#else
+    char buffer[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+    std::string exePath = length > 0 ? std::string(buffer, length) : (fs::current_path() / "_").string();
+#endif
+    return fs::path(exePath).parent_path().string();
+}
+
+// Accepts both '\\' and '/' as separators so the same relative paths work on every platform
+std::string toNativePath(const std::string& path)
+{
+    std::string genericPath = path;
+    std::replace(genericPath.begin(), genericPath.end(), '\\', '/');
+    return fs::path(genericPath).make_preferred().string();
 }
 
 std::string getPath(const std::string& pathRelative, int dirUpTraversal)
 {
-    std::string exeDir = getExecutableDirectory();
+    fs::path exeDir = getExecutableDirectory();
     for (int i = 0; i < dirUpTraversal; i++) {
-        std::size_t pos = exeDir.find_last_of("\\");
-        if (pos != std::string::npos)
-            exeDir = exeDir.substr(0, pos);
+        if (exeDir.has_parent_path())
+            exeDir = exeDir.parent_path();
     }
-    
-    std::string fullPath = exeDir + "\\" + pathRelative;
-    return fullPath;
+
+    // A leading separator would make the relative part absolute and discard exeDir
+    std::string relative = pathRelative;
+    relative.erase(0, relative.find_first_not_of("\\/"));
+
+    fs::path fullPath = exeDir / toNativePath(relative);
+    return fullPath.string();
 }
 
 std::string getFileContents(const std::string& filePath)
@@ -75,6 +99,8 @@ std::vector<std::string> getFilenamesInFolder(const std::string& folderPath) {
                 filenames.push_back(entry.path().filename().string());
             }
         }
+        // Directory iteration order is unspecified, sort so indices are the same on every platform
+        std::sort(filenames.begin(), filenames.end());
     } else {
         std::cerr << "Folder does not exist or is not a directory or the model doesn't have any textures." << std::endl;
     }
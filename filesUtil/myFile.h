@@ -8,6 +8,8 @@ namespace fs = std::filesystem;
 
 std::string getExecutableDirectory();
 
+std::string toNativePath(const std::string& path);
+
 std::string getPath(const std::string& pathRelative, int dirUpTraversal);
 
 std::string getFileContents(const std::string& filePath);
@@ -0,0 +1,172 @@
+#include <profiling/traceRecorder.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        const char* category;
+        uint64_t start;
+        uint64_t end;
+        long long value;
+    };
+
+    struct ThreadBuffer
+    {
+        int id;
+        std::string name;
+        std::vector<TraceEvent> events; // Grows up to capacity, then the oldest events are overwritten
+        size_t capacity;
+        std::atomic<uint64_t> count{ 0 }; // Events ever written, the next one goes to count % capacity
+    };
+
+    std::atomic<bool> enabled{ false };
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    int eventsPerThread = 1 << 16;
+
+    // Only taken when a thread records its first event and when the trace is written
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    thread_local ThreadBuffer* threadBuffer = nullptr;
+
+    ThreadBuffer& currentBuffer()
+    {
+        if (!threadBuffer)
+        {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            threadBuffer = buffers.back().get();
+            threadBuffer->id = int(buffers.size());
+            threadBuffer->name = "thread " + std::to_string(threadBuffer->id);
+            threadBuffer->capacity = eventsPerThread;
+        }
+        return *threadBuffer;
+    }
+
+    void writeEscaped(std::ostream& out, const std::string& text)
+    {
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+    }
+}
+
+void enableTracing(bool enable, int eventsPerThread_)
+{
+    if (enable && !enabled)
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        // Threads that already have a buffer keep its size
+        if (buffers.empty())
+            origin = std::chrono::steady_clock::now();
+        eventsPerThread = std::max(1, eventsPerThread_);
+    }
+    enabled = enable;
+}
+
+bool tracingEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void recordTraceEvent(const char* name, const char* category, uint64_t start, uint64_t end, long long value)
+{
+    if (!tracingEnabled())
+        return;
+
+    ThreadBuffer& buffer = currentBuffer();
+    uint64_t index = buffer.count.load(std::memory_order_relaxed);
+    if (index < buffer.capacity)
+        buffer.events.push_back({ name, category, start, end, value });
+    else
+        buffer.events[index % buffer.capacity] = { name, category, start, end, value };
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+
+void setTraceThreadName(const std::string& name)
+{
+    if (!tracingEnabled())
+        return;
+
+    ThreadBuffer& buffer = currentBuffer();
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffer.name = name;
+}
+
+bool writeTrace(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot write trace: " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    // Microseconds, to the nanosecond
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+    {
+        file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"";
+        writeEscaped(file, buffer->name);
+        file << "\"}}";
+        first = false;
+
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t size = buffer->capacity;
+        for (uint64_t i = count > size ? count - size : 0; i < count; i++)
+        {
+            const TraceEvent& event = buffer->events[i % size];
+            file << ",\n{\"name\":\"";
+            writeEscaped(file, event.name);
+            file << "\",\"cat\":\"";
+            writeEscaped(file, event.category);
+            file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id << ",\"ts\":" << event.start * 1e-3 << ",\"dur\":" << (event.end - event.start) * 1e-3;
+            if (event.value >= 0)
+                file << ",\"args\":{\"value\":" << event.value << "}";
+            file << "}";
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    return true;
+}
+
+TraceScope::TraceScope(const char* name_, const char* category_, long long value_)
+    : name(name_), category(category_), value(value_), start(0), open(tracingEnabled())
+{
+    if (open)
+        start = traceNow();
+}
+
+TraceScope::~TraceScope()
+{
+    End();
+}
+
+void TraceScope::End()
+{
+    if (!open)
+        return;
+    recordTraceEvent(name, category, start, traceNow(), value);
+    open = false;
+}
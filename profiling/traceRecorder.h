@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Records what the program spends its time on as Chrome trace events, for chrome://tracing or Perfetto. Every thread
+// writes into its own ring buffer without locks: only its own thread writes a buffer, and an event becomes visible
+// to writeTrace() by the release store of the buffer's event count. A buffer grows up to eventsPerThread events, then
+// overwrites its oldest ones. Buffers outlive their threads, so worker threads that already finished still show up.
+// Tracing is off until enableTracing() is called, a TraceScope then costs a flag check.
+//
+//     enableTracing(true);
+//     { TraceScope scope("build BVH", "load"); ... }
+//     writeTrace("trace.json");
+//
+// Names and categories are not copied, they have to be string literals or live as long as the trace.
+
+void enableTracing(bool enable, int eventsPerThread = 1 << 16);
+
+bool tracingEnabled();
+
+// Nanoseconds since tracing was first enabled
+uint64_t traceNow();
+
+// value, when not negative, is shown with the event (e.g. the number of a frame or of triangles)
+void recordTraceEvent(const char* name, const char* category, uint64_t start, uint64_t end, long long value = -1);
+
+// Name of the calling thread's track, e.g. "render 3"
+void setTraceThreadName(const std::string& name);
+
+// Writes the events of every thread, should be called when no other thread is recording
+bool writeTrace(const std::string& path);
+
+// Records the time from its construction to End() or its destruction
+class TraceScope
+{
+public:
+    TraceScope(const char* name_, const char* category_, long long value_ = -1);
+    ~TraceScope();
+
+    void End();
+
+private:
+    const char* name;
+    const char* category;
+    long long value;
+    uint64_t start;
+    bool open;
+};
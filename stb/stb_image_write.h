@@ -785,7 +785,11 @@ static int stbi_write_hdr_core(stbi__write_context* s, int x, int y, int comp, f
         char header[] = "#?RADIANCE\n# Written by stb_image_write.h\nFORMAT=32-bit_rle_rgbe\n";
         s->func(s->context, header, sizeof(header) - 1);
 
+#ifdef __STDC_LIB_EXT1__
         len = sprintf_s(buffer, sizeof(buffer), "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
+#else
+        len = sprintf(buffer, "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
+#endif
 
         s->func(s->context, buffer, len);
 